@@ -37,8 +37,92 @@ layout(std140, binding = 0) uniform CBPerFrame
     float metallic;
 
     float roughness;
-    float pad1;
-    float pad2;
-    float pad3;
+    // seconds, drives the baked crowd animations
+    float animationTime;
+    // log(view depth) * clusterScale - clusterBias is the cluster depth slice
+    float clusterScale;
+    float clusterBias;
 } cbPerFrame;
 
+// the palettes of all the skinned meshes for this frame, each draw knows where its own starts
+layout(std430, binding = 0) readonly buffer BonePalette
+{
+    mat4 gBones[];
+} bonePalette;
+
+// crowd animations baked by SkeletonMesh::bakeAnimations(), a clip is frameCount palettes of boneCount matrices
+struct BakedClip
+{
+    int firstMatrix;
+    int frameCount;
+    int boneCount;
+    float frameRate;
+};
+
+struct CrowdInstance
+{
+    mat4 world;
+    int clip;
+    float timeOffset;
+    float speed;
+    float pad;
+};
+
+layout(std430, binding = 3) readonly buffer BakedFrames
+{
+    mat4 gFrames[];
+} bakedFrames;
+
+layout(std430, binding = 4) readonly buffer BakedClips
+{
+    BakedClip gClips[];
+} bakedClips;
+
+layout(std430, binding = 5) readonly buffer CrowdInstances
+{
+    CrowdInstance gInstances[];
+} crowdInstances;
+
+// where a vertex gets its bones from: a palette in the bone palette buffer,
+// or the two baked frames around a crowd instance's current time
+struct SkinningSource
+{
+    bool crowd;
+    int first;
+    int second;
+    float blend;
+};
+
+// crowdInstance is -1 for everything but crowds
+SkinningSource getSkinningSource(int boneOffset, int crowdInstance) {
+    SkinningSource source;
+    source.crowd = crowdInstance >= 0;
+    source.first = boneOffset;
+    source.second = boneOffset;
+    source.blend = 0.0;
+
+    if (source.crowd) {
+        int clipIndex = crowdInstances.gInstances[crowdInstance].clip;
+        float timeOffset = crowdInstances.gInstances[crowdInstance].timeOffset;
+        float speed = crowdInstances.gInstances[crowdInstance].speed;
+        BakedClip clip = bakedClips.gClips[clipIndex];
+
+        // clips loop, mod() keeps negative times in range too
+        float frame = mod((cbPerFrame.animationTime * speed + timeOffset) * clip.frameRate, float(clip.frameCount));
+        int frame0 = min(int(frame), clip.frameCount - 1);
+        int frame1 = (frame0 + 1) % clip.frameCount;
+
+        source.first = clip.firstMatrix + frame0 * clip.boneCount;
+        source.second = clip.firstMatrix + frame1 * clip.boneCount;
+        source.blend = frame - float(frame0);
+    }
+    return source;
+}
+
+mat4 getBoneMatrix(SkinningSource source, int boneID) {
+    if (source.crowd) {
+        return bakedFrames.gFrames[source.first + boneID] * (1.0 - source.blend) +
+               bakedFrames.gFrames[source.second + boneID] * source.blend;
+    }
+    return bonePalette.gBones[source.first + boneID];
+}
@@ -18,36 +18,45 @@ layout(std140, binding = 1) uniform CBPerObject
     float emissionIntensity;
     float animated;
     float pad2;
+    // first matrix of our palette, or our first instance for crowds
+    int boneOffset;
+    int crowd;
 } cbPerObject;
 
-const int MAX_BONES = 200;
-
-layout(std140, binding = 8) uniform CBPerAnimatedObject
-{
-    mat4 gBones[MAX_BONES];
-} cbPerAnimatedObject;
-
 out vec4 FragPos;
 
 void main() {
-    if (cbPerObject.animated == 1) {
+    int crowdInstance = -1;
+    mat4 world = cbPerObject.world;
+    if (cbPerObject.crowd == 1) {
+        crowdInstance = cbPerObject.boneOffset + gl_InstanceID;
+        world = crowdInstances.gInstances[crowdInstance].world * cbPerObject.world;
+    }
+
+    if (cbPerObject.animated != 0) {
+        // crowd instances blend two frames of their baked clip, the rest read their palette
+        SkinningSource source = getSkinningSource(cbPerObject.boneOffset, crowdInstance);
+
         mat4 BoneTransform = mat4(0.0);
 
-        BoneTransform += cbPerAnimatedObject.gBones[int(BoneIDs[0])] * Weights[0];
-        BoneTransform += cbPerAnimatedObject.gBones[int(BoneIDs[1])] * Weights[1];
-        BoneTransform += cbPerAnimatedObject.gBones[int(BoneIDs[2])] * Weights[2];
-        BoneTransform += cbPerAnimatedObject.gBones[int(BoneIDs[3])] * Weights[3];
+        BoneTransform += getBoneMatrix(source, int(BoneIDs[0])) * Weights[0];
+        BoneTransform += getBoneMatrix(source, int(BoneIDs[1])) * Weights[1];
+        BoneTransform += getBoneMatrix(source, int(BoneIDs[2])) * Weights[2];
+        BoneTransform += getBoneMatrix(source, int(BoneIDs[3])) * Weights[3];
 
-        BoneTransform += cbPerAnimatedObject.gBones[int(BoneIDs2[0])] * Weights2[0];
-        BoneTransform += cbPerAnimatedObject.gBones[int(BoneIDs2[1])] * Weights2[1];
-        BoneTransform += cbPerAnimatedObject.gBones[int(BoneIDs2[2])] * Weights2[2];
-        BoneTransform += cbPerAnimatedObject.gBones[int(BoneIDs2[3])] * Weights2[3];
+        // the compact vertex format (animated == 2) only carries 4 influences
+        if (cbPerObject.animated == 1) {
+            BoneTransform += getBoneMatrix(source, int(BoneIDs2[0])) * Weights2[0];
+            BoneTransform += getBoneMatrix(source, int(BoneIDs2[1])) * Weights2[1];
+            BoneTransform += getBoneMatrix(source, int(BoneIDs2[2])) * Weights2[2];
+            BoneTransform += getBoneMatrix(source, int(BoneIDs2[3])) * Weights2[3];
+        }
 
         vec4 totalPosition = BoneTransform * vec4(position, 1.0);
 
-        FragPos = cbPerObject.world * totalPosition;
+        FragPos = world * totalPosition;
     } else {
-        FragPos = cbPerObject.world * vec4(position, 1.0);
+        FragPos = world * vec4(position, 1.0);
     }
 	gl_Position = FragPos;
 }
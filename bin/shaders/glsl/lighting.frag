@@ -14,12 +14,11 @@ layout(binding = 3) uniform sampler2D emissionMap;
 layout(binding = 4) uniform sampler2D metallicMap;
 layout(binding = 5) uniform sampler2D roughnessMap;
 
-layout(binding = 6) uniform sampler2DShadow cascadedShadowMaps1;
-layout(binding = 7) uniform sampler2DShadow cascadedShadowMaps2;
-layout(binding = 8) uniform sampler2DShadow cascadedShadowMaps3;
+// one layer per cascade
+layout(binding = 6) uniform sampler2DArrayShadow cascadedShadowMaps;
 
-const int MAX_POINT_LIGHTS = 16;
-layout(binding = 9) uniform samplerCube shadowCubeMapArray[MAX_POINT_LIGHTS];
+const int MAX_SHADOW_CUBE_MAPS = 16;
+layout(binding = 9) uniform samplerCube shadowCubeMapArray[MAX_SHADOW_CUBE_MAPS];
 
 layout(std140, binding = 1) uniform CBPerObject
 {
@@ -34,6 +33,7 @@ layout(std140, binding = 1) uniform CBPerObject
     float isTransparent;
 } cbPerObject;
 
+// position.w is the range, direction.x is 1 for shadow casters and direction.y their shadow cube map
 struct PointLight
 {
     vec4 position;
@@ -41,11 +41,31 @@ struct PointLight
     vec4 color;
 };
 
-layout(std140, binding = 2) uniform CBLightArray
+struct LightCluster
 {
-    vec4 lightCount;
-    PointLight lights[MAX_POINT_LIGHTS];
-} cbLightArray;
+    uint offset;
+    uint count;
+};
+
+// must match CLUSTER_X/Y/Z in game.h
+const uint CLUSTER_X = 16;
+const uint CLUSTER_Y = 9;
+const uint CLUSTER_Z = 24;
+
+layout(std430, binding = 6) readonly buffer PointLights
+{
+    PointLight gLights[];
+} pointLights;
+
+layout(std430, binding = 7) readonly buffer LightClusters
+{
+    LightCluster gClusters[];
+} lightClusters;
+
+layout(std430, binding = 8) readonly buffer ClusterLightIndices
+{
+    uint gIndices[];
+} clusterLightIndices;
 
 layout(std140, binding = 7) uniform CBCascadedShadow
 {
@@ -69,14 +89,7 @@ vec3 ShadowCoords(mat4 shadowMapViewProjection) {
 */
 
 float CascadeDepthSample(int index, vec3 coords) {
-    if (index == 0) {
-        return texture(cascadedShadowMaps1, coords);
-    } else if (index == 1) {
-        return texture(cascadedShadowMaps2, coords);
-    } else if (index == 2) {
-        return texture(cascadedShadowMaps3, coords);
-    }
-    return 0;
+    return texture(cascadedShadowMaps, vec4(coords.xy, float(index), coords.z));
 }
 
 float CascadedShadow(vec3 lightDir, vec3 normal) {
@@ -118,17 +131,14 @@ float CascadedShadow(vec3 lightDir, vec3 normal) {
     float EPSILON = 0;
     float Factor = 0.0;
 
-    vec2 texelSize = vec2(1.0f);
+    vec2 texelSize = 1.0f / vec2(textureSize(cascadedShadowMaps, 0).xy);
 
     if (index == 0) {
         EPSILON = 0.0001;
-        texelSize = 1.0f / textureSize(cascadedShadowMaps1, 0);
     } else if (index == 1) {
         EPSILON = 0.0002;
-        texelSize = 1.0f / textureSize(cascadedShadowMaps2, 0);
     } else if (index == 2) {
         EPSILON = 0.0001;
-        texelSize = 1.0f / textureSize(cascadedShadowMaps3, 0);
     }
 
     for (int y = -1 ; y <= 1 ; y++) {
@@ -292,6 +302,28 @@ vec3 CalcDirLight(vec3 lightDir, vec3 normal, vec3 viewDir, vec4 color) {
     */
 }
 
+// the cube map index comes from the light list of the cluster so it isn't uniform,
+// sampler arrays may only be indexed with constants then
+float ShadowCubeSample(int index, vec3 coords) {
+    for (int i = 0; i < MAX_SHADOW_CUBE_MAPS; i++) {
+        if (i == index) {
+            return texture(shadowCubeMapArray[i], coords).r;
+        }
+    }
+    return 1;
+}
+
+uint getClusterIndex() {
+    uvec2 tile = uvec2(gl_FragCoord.xy / vec2(cbPerFrame.screenWidth, cbPerFrame.screenHeight) * vec2(CLUSTER_X, CLUSTER_Y));
+    tile = min(tile, uvec2(CLUSTER_X - 1, CLUSTER_Y - 1));
+
+    float depth = max(-fs_in.fragViewPos.z, cbPerFrame.cameraNear);
+    uint slice = uint(max(log(depth) * cbPerFrame.clusterScale - cbPerFrame.clusterBias, 0.0));
+    slice = min(slice, CLUSTER_Z - 1);
+
+    return (slice * CLUSTER_Y + tile.y) * CLUSTER_X + tile.x;
+}
+
 vec3 CalcPointLight(PointLight light, vec3 normal, vec3 fragPos, vec3 viewDir, vec4 color, int cubeMapIndex) {
     vec3 lightPos = light.position.xyz;
     float farPlane = light.position.w;
@@ -322,6 +354,9 @@ vec3 CalcPointLight(PointLight light, vec3 normal, vec3 fragPos, vec3 viewDir, v
     float distance    = length(lightPos - fragPos);
     float attenuation = 1.0 / (constant + linear * distance + 
   			     quadratic * (distance * distance));
+    // fade out to nothing at the range, the light isn't in the clusters beyond it
+    float rangeFactor = clamp(1.0 - pow(distance / farPlane, 4.0), 0.0, 1.0);
+    attenuation *= rangeFactor * rangeFactor;
 
     // ambient lighting
 	float ambientIntensity = 0.7f;
@@ -344,7 +379,7 @@ vec3 CalcPointLight(PointLight light, vec3 normal, vec3 fragPos, vec3 viewDir, v
             {
                 for(int x = -sampleRadius; x <= sampleRadius; x++)
                 {
-                    float closestDepth = texture(shadowCubeMapArray[cubeMapIndex], fragToLight + vec3(x, y, z) * offset).r;
+                    float closestDepth = ShadowCubeSample(cubeMapIndex, fragToLight + vec3(x, y, z) * offset);
                     // Remember that we divided by the farPlane?
                     // Also notice how the currentDepth is not in the range [0, 1]
                     closestDepth *= farPlane;
@@ -449,13 +484,11 @@ void main() {
 
     lighting += CalcDirLight(lightDir, normal, viewDir, color);
 
-    int cubeShadowMapIndex = 0;
-    for(int i = 0; i < cbLightArray.lightCount.x; i++) {
-        PointLight light = cbLightArray.lights[i];
-        lighting += CalcPointLight(light, normal, fs_in.fragPos, viewDir, color, cubeShadowMapIndex);
-        if (light.direction.x == 1) {
-            cubeShadowMapIndex++;
-        }
+    // only the lights whose range reaches this fragment's cluster
+    LightCluster cluster = lightClusters.gClusters[getClusterIndex()];
+    for(uint i = 0; i < cluster.count; i++) {
+        PointLight light = pointLights.gLights[clusterLightIndices.gIndices[cluster.offset + i]];
+        lighting += CalcPointLight(light, normal, fs_in.fragPos, viewDir, color, int(light.direction.y));
     }
 
     if (cbPerObject.hasEmissionMap == 1) {
@@ -30,30 +30,38 @@ layout(std140, binding = 1) uniform CBPerObject
     float emissionIntensity;
     float animated;
     float isTransparent;
+    // first matrix of our palette, or our first instance for crowds
+    int boneOffset;
+    int crowd;
 } cbPerObject;
 
-const int MAX_BONES = 200;
-
-layout(std140, binding = 8) uniform CBPerAnimatedObject
-{
-    mat4 gBones[MAX_BONES];
-} cbPerAnimatedObject;
-
 void main() {
+    int crowdInstance = -1;
+    mat4 world = cbPerObject.world;
+    if (cbPerObject.crowd == 1) {
+        crowdInstance = cbPerObject.boneOffset + gl_InstanceID;
+        world = crowdInstances.gInstances[crowdInstance].world * cbPerObject.world;
+    }
 
-    if (cbPerObject.animated == 1) {
+    if (cbPerObject.animated != 0) {
 
-        mat4 BoneTransform = mat4(0.0);
+        // crowd instances blend two frames of their baked clip, the rest read their palette
+        SkinningSource source = getSkinningSource(cbPerObject.boneOffset, crowdInstance);
 
-        BoneTransform += cbPerAnimatedObject.gBones[int(BoneIDs[0])] * Weights[0];
-        BoneTransform += cbPerAnimatedObject.gBones[int(BoneIDs[1])] * Weights[1];
-        BoneTransform += cbPerAnimatedObject.gBones[int(BoneIDs[2])] * Weights[2];
-        BoneTransform += cbPerAnimatedObject.gBones[int(BoneIDs[3])] * Weights[3];
+        mat4 BoneTransform = mat4(0.0);
 
-        BoneTransform += cbPerAnimatedObject.gBones[int(BoneIDs2[0])] * Weights2[0];
-        BoneTransform += cbPerAnimatedObject.gBones[int(BoneIDs2[1])] * Weights2[1];
-        BoneTransform += cbPerAnimatedObject.gBones[int(BoneIDs2[2])] * Weights2[2];
-        BoneTransform += cbPerAnimatedObject.gBones[int(BoneIDs2[3])] * Weights2[3];
+        BoneTransform += getBoneMatrix(source, int(BoneIDs[0])) * Weights[0];
+        BoneTransform += getBoneMatrix(source, int(BoneIDs[1])) * Weights[1];
+        BoneTransform += getBoneMatrix(source, int(BoneIDs[2])) * Weights[2];
+        BoneTransform += getBoneMatrix(source, int(BoneIDs[3])) * Weights[3];
+
+        // the compact vertex format (animated == 2) only carries 4 influences
+        if (cbPerObject.animated == 1) {
+            BoneTransform += getBoneMatrix(source, int(BoneIDs2[0])) * Weights2[0];
+            BoneTransform += getBoneMatrix(source, int(BoneIDs2[1])) * Weights2[1];
+            BoneTransform += getBoneMatrix(source, int(BoneIDs2[2])) * Weights2[2];
+            BoneTransform += getBoneMatrix(source, int(BoneIDs2[3])) * Weights2[3];
+        }
 
         vec4 totalPosition = BoneTransform * vec4(position, 1.0);
         mat4 invTrans = transpose(inverse(BoneTransform));
@@ -61,13 +69,13 @@ void main() {
         vec4 localNormal = invTrans * vec4(aNormal, 1.0);
         vec4 localTangent = invTrans * vec4(aTangent, 1.0);
 
-        gl_Position = cbPerFrame.proj * cbPerFrame.view * cbPerObject.world * totalPosition;
+        gl_Position = cbPerFrame.proj * cbPerFrame.view * world * totalPosition;
 
         vs_out.textureCoordinate = textureCoord;
 
-        mat4 wInv = transpose(inverse(cbPerObject.world));
+        mat4 wInv = transpose(inverse(world));
 
-        vs_out.fragPos = vec3(cbPerObject.world * totalPosition);
+        vs_out.fragPos = vec3(world * totalPosition);
         vs_out.tangent = vec3(wInv * localTangent);
 
         if (cbPerObject.hasNormalMap == 1) {
@@ -78,14 +86,14 @@ void main() {
 
     } else {
 
-        gl_Position = cbPerFrame.proj * cbPerFrame.view * cbPerObject.world * vec4(position, 1.0);
+        gl_Position = cbPerFrame.proj * cbPerFrame.view * world * vec4(position, 1.0);
 
         vs_out.textureCoordinate = textureCoord;
 
-        vs_out.fragPos = vec3(cbPerObject.world * vec4(position, 1.0));
-        vs_out.tangent = vec3(cbPerObject.world * vec4(aTangent, 0.0));
+        vs_out.fragPos = vec3(world * vec4(position, 1.0));
+        vs_out.tangent = vec3(world * vec4(aTangent, 0.0));
 
-	    mat4 wInv = transpose(inverse(cbPerObject.world));
+	    mat4 wInv = transpose(inverse(world));
 
         if (cbPerObject.hasNormalMap == 1) {
             vs_out.normal = vec3(wInv * vec4(aNormal, 0.0));
@@ -19,41 +19,46 @@ layout(std140, binding = 1) uniform CBPerObject
     float emissionIntensity;
     float animated;
     float pad2;
+    // first matrix of our palette, or our first instance for crowds
+    int boneOffset;
+    int crowd;
 } cbPerObject;
 
-layout(std140, binding = 6) uniform CBCascadedShadowProj
-{
-    mat4 lightviewproj;
-} cbCascadedShadowProj;
-
-const int MAX_BONES = 200;
+// world space, shadow_depth.geom projects it into every cascade the object is in
+out vec2 geomTextureCoordinate;
 
-layout(std140, binding = 8) uniform CBPerAnimatedObject
-{
-    mat4 gBones[MAX_BONES];
-} cbPerAnimatedObject;
+void main(){
+    int crowdInstance = -1;
+    mat4 world = cbPerObject.world;
+    if (cbPerObject.crowd == 1) {
+        crowdInstance = cbPerObject.boneOffset + gl_InstanceID;
+        world = crowdInstances.gInstances[crowdInstance].world * cbPerObject.world;
+    }
 
-out vec2 textureCoordinate;
+    if (cbPerObject.animated != 0) {
+        // crowd instances blend two frames of their baked clip, the rest read their palette
+        SkinningSource source = getSkinningSource(cbPerObject.boneOffset, crowdInstance);
 
-void main(){
-    if (cbPerObject.animated == 1) {
         mat4 BoneTransform = mat4(0.0);
 
-        BoneTransform += cbPerAnimatedObject.gBones[int(BoneIDs[0])] * Weights[0];
-        BoneTransform += cbPerAnimatedObject.gBones[int(BoneIDs[1])] * Weights[1];
-        BoneTransform += cbPerAnimatedObject.gBones[int(BoneIDs[2])] * Weights[2];
-        BoneTransform += cbPerAnimatedObject.gBones[int(BoneIDs[3])] * Weights[3];
+        BoneTransform += getBoneMatrix(source, int(BoneIDs[0])) * Weights[0];
+        BoneTransform += getBoneMatrix(source, int(BoneIDs[1])) * Weights[1];
+        BoneTransform += getBoneMatrix(source, int(BoneIDs[2])) * Weights[2];
+        BoneTransform += getBoneMatrix(source, int(BoneIDs[3])) * Weights[3];
 
-        BoneTransform += cbPerAnimatedObject.gBones[int(BoneIDs2[0])] * Weights2[0];
-        BoneTransform += cbPerAnimatedObject.gBones[int(BoneIDs2[1])] * Weights2[1];
-        BoneTransform += cbPerAnimatedObject.gBones[int(BoneIDs2[2])] * Weights2[2];
-        BoneTransform += cbPerAnimatedObject.gBones[int(BoneIDs2[3])] * Weights2[3];
+        // the compact vertex format (animated == 2) only carries 4 influences
+        if (cbPerObject.animated == 1) {
+            BoneTransform += getBoneMatrix(source, int(BoneIDs2[0])) * Weights2[0];
+            BoneTransform += getBoneMatrix(source, int(BoneIDs2[1])) * Weights2[1];
+            BoneTransform += getBoneMatrix(source, int(BoneIDs2[2])) * Weights2[2];
+            BoneTransform += getBoneMatrix(source, int(BoneIDs2[3])) * Weights2[3];
+        }
 
         vec4 totalPosition = BoneTransform * vec4(position, 1.0);
 
-        gl_Position = cbCascadedShadowProj.lightviewproj * cbPerObject.world * totalPosition;
+        gl_Position = world * totalPosition;
     } else {
-	    gl_Position = cbCascadedShadowProj.lightviewproj * cbPerObject.world * vec4(position, 1.0);
+	    gl_Position = world * vec4(position, 1.0);
     }
-	textureCoordinate = textureCoord;
+	geomTextureCoordinate = textureCoord;
 }
@@ -11,6 +11,11 @@ public:
 	// http://iquilezles.org/www/articles/frustumcorrect/frustumcorrect.htm
 	bool IsBoxVisible(const glm::vec3& minp, const glm::vec3& maxp) const;
 
+	bool IsSphereVisible(const glm::vec3& center, float radius) const;
+
+	// spheres are xyz = center, w = radius, visible[i] is set to 1 for the ones that are in
+	void CullSpheres(const glm::vec4* spheres, uint32_t count, uint8_t* visible) const;
+
 private:
 	enum Planes
 	{
@@ -107,6 +112,41 @@ inline bool Frustum::IsBoxVisible(const glm::vec3& minp, const glm::vec3& maxp)
 	return true;
 }
 
+inline bool Frustum::IsSphereVisible(const glm::vec3& center, float radius) const
+{
+	// the planes aren't normalized, scale the radius instead
+	for (int i = 0; i < Count; i++)
+	{
+		const glm::vec3 normal = glm::vec3(m_planes[i]);
+		if (glm::dot(normal, center) + m_planes[i].w < -radius * glm::length(normal))
+		{
+			return false;
+		}
+	}
+	return true;
+}
+
+inline void Frustum::CullSpheres(const glm::vec4* spheres, uint32_t count, uint8_t* visible) const
+{
+	for (uint32_t s = 0; s < count; s++)
+	{
+		visible[s] = 1;
+	}
+
+	// one plane against all the spheres at a time, the inner loop is branch free
+	for (int i = 0; i < Count; i++)
+	{
+		const float invLength = 1.0f / glm::length(glm::vec3(m_planes[i]));
+		const glm::vec4 plane = m_planes[i] * invLength;
+		for (uint32_t s = 0; s < count; s++)
+		{
+			const glm::vec4& sphere = spheres[s];
+			const float distance = plane.x * sphere.x + plane.y * sphere.y + plane.z * sphere.z + plane.w;
+			visible[s] &= (uint8_t)(distance >= -sphere.w);
+		}
+	}
+}
+
 template<Frustum::Planes a, Frustum::Planes b, Frustum::Planes c>
 inline glm::vec3 Frustum::intersection(const glm::vec3* crosses) const
 {
@@ -132,10 +172,11 @@ public:
     float mNear;
     float mFar;
     float mFOV;
-    TransformComponent* mTransform;
 public:
     CameraEntity(const std::string& name, Entity_T id, const glm::vec3& position);
 
+    TransformComponent& getTransform();
+
     float getNear() const { return mNear; }
     float getFar() const { return mFar; }
     float getFOV() const { return mFOV; }
@@ -109,3 +109,51 @@ private:
 };
 
 
+
+/// Finds the key frame to interpolate from (index i, so that time lies between
+/// key i and key i + 1). cursor holds the result of the previous lookup, during
+/// normal playback the time only moves forward a bit so we just walk on from there,
+/// when it jumps (loops, seeks or runs backwards) we binary search instead.
+/// getTime(i) returns the time stamp of key i.
+template<typename GetTime>
+uint32_t findKeyFrame(uint32_t keyCount, float time, uint32_t& cursor, GetTime getTime)
+{
+    if (keyCount < 2) {
+        cursor = 0;
+        return 0;
+    }
+    const uint32_t lastSegment = keyCount - 2;
+    const uint32_t maxSteps = 4;
+
+    uint32_t index = cursor;
+    bool search = (index > lastSegment || time < getTime(index));
+
+    if (!search) {
+        uint32_t steps = 0;
+        while (index < lastSegment && time >= getTime(index + 1)) {
+            index++;
+            if (++steps == maxSteps) {
+                search = true;
+                break;
+            }
+        }
+    }
+
+    if (search) {
+        // first key that comes after the time, we want the one before it
+        uint32_t low = 1;
+        uint32_t high = keyCount;
+        while (low < high) {
+            uint32_t mid = (low + high) / 2;
+            if (getTime(mid) > time) {
+                high = mid;
+            } else {
+                low = mid + 1;
+            }
+        }
+        index = std::min(low - 1, lastSegment);
+    }
+
+    cursor = index;
+    return index;
+}
@@ -2,6 +2,19 @@
 
 using Entity_T = uint32_t;
 
+// Entity ids are generational handles, the low bits are the entity slot and the high bits
+// count how many times that slot got reused, so a stale id never matches a new entity.
+// A slot is retired once its generation hits ENTITY_GENERATION_MASK instead of wrapping
+constexpr uint32_t ENTITY_INDEX_BITS = 20;
+constexpr uint32_t ENTITY_INDEX_MASK = (1u << ENTITY_INDEX_BITS) - 1;
+constexpr uint32_t ENTITY_GENERATION_MASK = (1u << (32 - ENTITY_INDEX_BITS)) - 1;
+
+inline uint32_t getEntityIndex(Entity_T id) { return id & ENTITY_INDEX_MASK; }
+inline uint32_t getEntityGeneration(Entity_T id) { return id >> ENTITY_INDEX_BITS; }
+inline Entity_T makeEntityId(uint32_t index, uint32_t generation) {
+    return ((generation & ENTITY_GENERATION_MASK) << ENTITY_INDEX_BITS) | (index & ENTITY_INDEX_MASK);
+}
+
 class Renderer;
 class ResourceManager;
 class Light;
@@ -12,6 +25,7 @@ class World;
 class SceneEntity;
 class CameraEntity;
 class Texture;
+class JobSystem;
 
 #include "coremath.h"
 
@@ -32,6 +46,7 @@ protected:
     Renderer* mRenderer;
     ResourceManager* mResourceManager;
     World* mWorld;
+    JobSystem* mJobSystem;
 public:
     Engine(GLFWwindow* windowHandle);
     virtual ~Engine();
@@ -41,6 +56,7 @@ public:
     static Engine* get() { return sEngine; }
 
     World* getWorld() { return mWorld; }
+    JobSystem* getJobSystem() { return mJobSystem; }
     Renderer* getRenderingSystem();
     ResourceManager* getResourceManager() { return mResourceManager; }
     GLFWwindow* getWindowHandle() { return mWindowHandle; }
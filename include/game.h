@@ -93,9 +93,7 @@ class Player : public Character
 public:
     SceneEntity* mPlayerEntity;
     CameraEntity* mCamera;
-    TransformComponent* mHandTransform;
-    TransformComponent* mMuzzleTransform;
-    BillboardComponent* mMuzzle;
+    SceneEntity* mMuzzleEntity;
     PointLight* mMuzzleLight;
     float mAnimationTime;
     float mShakeAnimationTime;
@@ -162,9 +160,11 @@ struct cbPerFrame {
     float metallic;
 
     float roughness;
-    float pad1;
-    float pad2;
-    float pad3;
+    // seconds, drives the baked crowd animations
+    float animationTime;
+    // log(view depth) * clusterScale - clusterBias is the cluster depth slice
+    float clusterScale;
+    float clusterBias;
 };
 
 struct cbPerObject {
@@ -177,21 +177,58 @@ struct cbPerObject {
     float emissionIntensity;
     float animated;
     float isTransparent;
+    // first matrix of the mesh's palette in the bone palette buffer
+    int32_t boneOffset;
+    // 1 for crowd draws, boneOffset is then the first instance in the crowd instance buffer
+    int32_t crowd;
+    // bit i set if the object is drawn to shadow cascade i
+    uint32_t cascadeMask;
+    float pad3;
 };
 
-struct cbPerAnimatedObject {
-    glm::mat4 gBones[MAX_BONES];
-};
-
+// std430 layout of the light buffer, position.w is the range of the light,
+// direction.x is 1 if it casts shadows and direction.y is then its shadow cube map
 struct cbPointLight {
     glm::vec4 position;
     glm::vec4 direction;
     glm::vec4 color;
 };
 
-struct cbLightArray {
-    glm::vec4 lightCount;
-    cbPointLight lights[16];
+// clustered lighting, the view frustum is cut into CLUSTER_X * CLUSTER_Y screen tiles
+// and CLUSTER_Z exponential depth slices, each with its own list of lights
+const uint32_t CLUSTER_X = 16;
+const uint32_t CLUSTER_Y = 9;
+const uint32_t CLUSTER_Z = 24;
+const uint32_t CLUSTER_COUNT = CLUSTER_X * CLUSTER_Y * CLUSTER_Z;
+
+// the lighting shader has one cube map sampler per shadow casting light
+const int MAX_SHADOW_CUBE_MAPS = 16;
+
+struct sbLightCluster {
+    // first light index of the cluster in the cluster light index buffer
+    uint32_t offset;
+    uint32_t count;
+};
+
+// a point light that survived culling this frame, see _cullLights()
+struct VisibleLight {
+    PointLight* Light;
+    glm::vec3 Position;
+    float Range;
+    // rough share of the screen the light brightens, the list is sorted on it
+    float Contribution;
+    // -1 if the light doesn't get a shadow cube map this frame
+    int ShadowCubeMap;
+    // casters in range changed and the light is within this frame's budget, see _scheduleShadowUpdates()
+    bool UpdateShadow;
+    uint64_t ShadowSignature;
+};
+
+// clusters touched by a light, inclusive
+struct LightClusterRange {
+    uint32_t MinX, MaxX;
+    uint32_t MinY, MaxY;
+    uint32_t MinZ, MaxZ;
 };
 
 struct cbShadowCube {
@@ -211,8 +248,78 @@ struct cbCascadedShadow {
     glm::vec4 cascadePlaneDistances;
 };
 
-struct cbCascadedShadowProj {
-    glm::mat4 lightProjView;
+// every cascade, for the draws that don't get culled against them one by one
+const uint32_t ALL_CASCADES_MASK = (1 << MAX_CSSM_SPLITS) - 1;
+
+// size of every layer of the cascade shadow map
+const uint32_t CASCADE_SHADOW_MAP_SIZE = 4096;
+
+// a cascade that only moves in whole texels and keeps its size while the camera turns,
+// so the static depth rendered into it stays valid (see Game::_renderSunShadows())
+struct ShadowCascade {
+    glm::mat4 ViewProj;
+    // the center of the cascade in light space, in texels
+    int32_t TexelX, TexelY;
+    float Radius;
+    // light space depth the depth range is centered on, in steps of Radius
+    float DepthCenter;
+};
+
+// tags of the sun shadow GPU timer
+enum ShadowTimerTag {
+    SHADOW_TIMER_FULL,
+    SHADOW_TIMER_CACHED
+};
+
+// with the static shadows cached, a full redraw gets forced (and timed) this often, so the
+// cached and full costs shown are at most this many frames apart
+const uint32_t SHADOW_FULL_REDRAW_INTERVAL = 120;
+
+// rate the crowd meshes get their animations baked at on load
+const float CROWD_BAKE_FRAME_RATE = 30.0f;
+// the crowd animation clock wraps after this many seconds, the float sent to the shaders
+// keeps sub-millisecond precision below it (the crowds skip a bit once per wrap)
+const double ANIMATION_TIME_WRAP = 3600.0;
+
+struct cbSkinning {
+    int32_t vertexCount;
+    int32_t boneOffset;
+    // size of one source vertex, in 32-bit words
+    int32_t sourceStride;
+    int32_t compact;
+};
+
+// std430 layouts of the crowd buffers
+struct sbBakedClip {
+    // first matrix of the clip in the baked frame buffer
+    int32_t firstMatrix;
+    int32_t frameCount;
+    int32_t boneCount;
+    float frameRate;
+};
+
+struct sbCrowdInstance {
+    glm::mat4 world;
+    // index into the baked clip buffer
+    int32_t clip;
+    float timeOffset;
+    float speed;
+    float pad;
+};
+
+// the static geometry draws of one material, one indirect draw call
+struct IndirectDrawGroup {
+    Material* Mat;
+    uint32_t CascadeMask;
+    uint32_t FirstCommand;
+    uint32_t CommandCount;
+};
+
+// the members of a crowd sharing a mesh, drawn with one instanced draw per sub-mesh
+struct CrowdBatch {
+    SkeletonMesh* Mesh;
+    uint32_t FirstInstance;
+    uint32_t InstanceCount;
 };
 
 class GameState
@@ -326,7 +433,6 @@ private:
 public:
     SceneEntity* mLastObject;
     SceneEntity* mActiveObject;
-    InteractComponent* mComponent;
     float mAnimationTime;
 public:
     InteractionManager();
@@ -361,7 +467,6 @@ public:
     DirectionalLight* mSunLight;
     GameState* mCurrentState;
     CameraEntity* mCamera;
-    TransformComponent* mCameraTransform;
     bool mBindConstBuffers;
 
     char debugText[512];
@@ -388,8 +493,59 @@ public:
     cbPerFrame mPerFrameData;
     cbPerObject mPerObjectData;
     cbCascadedShadow mCascadedShadowData;
-    cbPerAnimatedObject mPerAnimatedObjectData;
-    cbLightArray mLightArrayData;
+    Frustum mCascadeFrustums[MAX_CSSM_SPLITS];
+    // _getCascadeMask() only tests these
+    uint32_t mActiveCascadeMask;
+    // static shadow casters (the static geometry) are kept in mStaticShadowCacheFBO,
+    // rendered with mStaticCascades, until the sun turns or a cascade can't be scrolled
+    bool mCacheStaticShadows;
+    bool mStaticShadowValid[MAX_CSSM_SPLITS];
+    ShadowCascade mStaticCascades[MAX_CSSM_SPLITS];
+    glm::vec3 mShadowSunDirection;
+    uint32_t mShadowTexelsRedrawn;
+    // GPU time of the sun shadow pass, with the static depth redrawn and with it cached (0 until measured)
+    float mShadowFullMs;
+    float mShadowCachedMs;
+    // bone palettes of all the skinned meshes, uploaded once per frame
+    std::vector<glm::mat4> mBonePaletteData;
+    // vertices skinned by the pre-skinning stage this frame
+    uint32_t mPreSkinnedVertexCount;
+    // the draws of the pass being rendered, and what executing them took this frame
+    RenderQueue mRenderQueue;
+    uint32_t mRenderQueueDraws;
+    uint32_t mRenderQueueBinds;
+    uint32_t mRenderQueueBindsSaved;
+    // the level merged into one vertex/index buffer, drawn with indirect draws (see _drawStaticGeometry())
+    StaticGeometry* mStaticGeometry;
+    bool mUseIndirectDraws;
+    std::vector<DrawIndirectCommand> mIndirectCommands;
+    std::vector<IndirectDrawGroup> mIndirectGroups;
+    uint32_t mIndirectDraws;
+    uint32_t mIndirectCalls;
+    // crowd instances of this frame grouped by mesh, see _prepareCrowds()
+    std::vector<CrowdBatch> mCrowdBatches;
+    std::vector<sbCrowdInstance> mCrowdInstanceData;
+    // meshes whose baked clips are in mBakedFrameBuffer, in upload order
+    std::vector<SkeletonMesh*> mBakedMeshes;
+    // lights of this frame and the clusters they fall in, see _prepareLightData()
+    std::vector<VisibleLight> mVisibleLights;
+    std::vector<glm::vec4> mLightSpheres;
+    std::vector<uint8_t> mLightSphereVisible;
+    std::vector<cbPointLight> mLightData;
+    std::vector<LightClusterRange> mLightClusterRanges;
+    std::vector<sbLightCluster> mClusterData;
+    std::vector<uint32_t> mClusterLightIndices;
+    uint32_t mLightsKept;
+    uint32_t mLightsCulled;
+    // cube shadow maps redrawn per frame at most, the stale ones take turns
+    int mPointShadowBudget;
+    std::vector<VisibleLight*> mStaleShadowLights;
+    uint32_t mPointShadowsStale;
+    uint32_t mPointShadowsRedrawn;
+    uint32_t mPointShadowsCached;
+    uint32_t mFrameIndex;
+    // game time the crowds are animated with, stands still when update() doesn't run
+    double mAnimationTime;
     cbPostProcess mPostProcessData;
 
     QuadBufferIndexed* mScreenQuad;
@@ -424,6 +580,7 @@ public:
     IGPUShaderProgram* fxProgram;
     IGPUShaderProgram* skyProgram;
     IGPUShaderProgram* sunProgram;
+    IGPUShaderProgram* skinningProgram;
 // Textures:
     IGPUTexture* mNoiseTexture;
     IGPUTexture* mCrosshairTexture;
@@ -438,19 +595,26 @@ public:
     Texture* mSkyTexture;
 // Buffers:
     IGPUConstantBuffer* mCBPerFrame;
-    IGPUConstantBuffer* mCBPerObject;
+    IGPUConstantRingBuffer* mCBPerObject;
     IGPUConstantBuffer* mCBCascadedShadow;
-    IGPUConstantBuffer* mCBCascadedShadowProj;
-    IGPUConstantBuffer* mCBPerAnimatedObject;
-    IGPUConstantBuffer* mCBLightArray;
     IGPUConstantBuffer* mCBShadowCube;
     IGPUConstantBuffer* mCBPostProcess;
     IGPUConstantBuffer* mCBSSAO;
+    IGPUConstantBuffer* mCBSkinning;
+    IGPUStorageBuffer* mBonePaletteBuffer;
+    IGPUStorageBuffer* mBakedFrameBuffer;
+    IGPUStorageBuffer* mBakedClipBuffer;
+    IGPUStorageBuffer* mCrowdInstanceBuffer;
+    IGPUStorageBuffer* mIndirectBuffer;
+    IGPUTimer* mShadowTimer;
+    IGPUStorageBuffer* mLightBuffer;
+    IGPUStorageBuffer* mClusterBuffer;
+    IGPUStorageBuffer* mClusterLightIndexBuffer;
 
     FrameBuffer* depthFBO;
-    FrameBuffer* mCascadedFBOSplit1;
-    FrameBuffer* mCascadedFBOSplit2;
-    FrameBuffer* mCascadedFBOSplit3;
+    // all the cascades, one layer each
+    FrameBuffer* mCascadedShadowFBO;
+    FrameBuffer* mStaticShadowCacheFBO;
     FrameBuffer* primaryFBO;
     FrameBuffer* ssaoFBO;
     FrameBuffer* blurPassFBO1;
@@ -465,9 +629,34 @@ public:
     bool loadResources();
     bool loadMap(const std::string& filename);
     void initDynamicObjects();
+    void spawnCrowd(const glm::vec3& center, int count);
     void update(float dt);
     void _preparePerFrameData();
+    // tests the enabled point lights against the camera frustum, fills mVisibleLights
+    void _cullLights(const Frustum& frustum);
+    // hash of the light and the casters in its range, changes when any of them moves
+    uint64_t _getShadowCasterSignature(const VisibleLight& light);
+    // picks the lights whose cube shadow map gets redrawn this frame, within mPointShadowBudget
+    void _scheduleShadowUpdates();
     void _prepareLightData();
+    // the cascades bb is in, 0 if none
+    uint32_t _getCascadeMask(const AABB& bb) const;
+    // static depth from the cache (scrolled and patched), dynamic casters drawn over it
+    void _renderSunShadows();
+    // puts every light into the clusters its range overlaps, false if it's out of view
+    bool _getLightClusterRange(const glm::vec3& viewPosition, float range, LightClusterRange& clusters);
+    void _prepareBonePalettes();
+    void _preSkinMeshes();
+    void _prepareCrowds();
+    void _drawCrowds(bool lightingPass, bool transparent = false);
+    // culls the mesh components for the pass and submits the rest to mRenderQueue, bounds (if any)
+    // replaces the frustum. Solid draws go front to back from viewPosition
+    void _queueMeshes(enum RenderPassType pass, Frustum* frustum, const AABB* bounds, const glm::vec3& viewPosition, float viewDistance);
+    // draws the sorted mRenderQueue draws [begin, end), skipping the binds the previous draw already did
+    void _executeRenderQueue(enum RenderPassType pass, uint32_t begin, uint32_t end);
+    void _buildStaticGeometry();
+    // the visible static geometry (solid only in the lighting pass), one indirect draw per material
+    void _drawStaticGeometry(enum RenderPassType pass, Frustum* frustum, const AABB* bounds);
     void _bindShaders();
     void renderScene(enum RenderPassType pass, Frustum* frustum);
     void render();
@@ -23,15 +23,25 @@ struct GLCubeMapTextureDesc {
     GLuint DataType;
 };
 
+struct GLTextureArrayDesc {
+    uint32_t Width, Height, Layers;
+    GLuint InternalFormat;
+    GLuint WrapType;
+    GLuint Format;
+    GLuint DataType;
+};
+
 class GLTexture : public IGPUTexture
 {
 protected:
     GLuint mTextureId;
     uint32_t mWidth, mHeight;
     bool mCubeMap;
+    bool mArray;
 public:
     GLTexture(const GLTextureDesc& desc, bool cubemap);
     GLTexture(const GLCubeMapTextureDesc& desc);
+    GLTexture(const GLTextureArrayDesc& desc);
     virtual ~GLTexture();
     virtual uint64_t getResourceId() const { return mTextureId; }
     virtual GPUResourceType getType() const { return GRT_TEXTURE; }
@@ -40,6 +50,7 @@ public:
     virtual uint32_t getHeight() const { return mHeight; }
 
     virtual bool isCubeMap() const { return mCubeMap; }
+    virtual bool isArray() const { return mArray; }
 };
 
 class GLVertexBuffer : public IGPUVertexBuffer
@@ -51,11 +62,13 @@ protected:
 public:
     GLVertexBuffer(const Vertex* data, uint32_t count);
     GLVertexBuffer(const AnimatedVertex* data, uint32_t count);
+    GLVertexBuffer(const CompactAnimatedVertex* data, uint32_t count);
     virtual ~GLVertexBuffer();
     virtual uint64_t getResourceId() const { return mVBO; }
     virtual GPUResourceType getType() const { return GRT_VERTEX_BUFFER; }
 
     virtual void updateData(const Vertex* data, uint32_t count);
+    virtual void readData(void* data, uint32_t size);
 
     GLuint getVertexArrayObject() const { return mVAO; }
 
@@ -90,6 +103,70 @@ public:
     virtual uint32_t getBufferSize() const { return mSize; }
 };
 
+class GLStorageBuffer : public IGPUStorageBuffer
+{
+protected:
+    GLuint mBufferId;
+    uint32_t mSize;
+public:
+    GLStorageBuffer(uint32_t sizeinBytes);
+    virtual ~GLStorageBuffer();
+    virtual uint64_t getResourceId() const { return mBufferId; }
+    virtual GPUResourceType getType() const { return GRT_STORAGE_BUFFER; }
+
+    virtual void updateData(const void* data, uint32_t sizeinBytes);
+    virtual uint32_t getBufferSize() const { return mSize; }
+};
+
+// frames of blocks in a GLConstantRingBuffer, the GPU is never more than a couple of frames behind
+const uint32_t RING_BUFFER_FRAMES = 3;
+
+class GLConstantRingBuffer : public IGPUConstantRingBuffer
+{
+protected:
+    GLuint mBufferId;
+    // persistently mapped and coherent, writes need no flush
+    uint8_t* mMappedData;
+    uint32_t mBlockSize;
+    // block size rounded up to GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT
+    uint32_t mBlockStride;
+    uint32_t mBlocksPerFrame;
+    uint32_t mFrame;
+    uint32_t mBlock;
+    GLsync mFences[RING_BUFFER_FRAMES];
+public:
+    GLConstantRingBuffer(uint32_t blockSize, uint32_t blocksPerFrame);
+    virtual ~GLConstantRingBuffer();
+    virtual uint64_t getResourceId() const { return mBufferId; }
+    virtual GPUResourceType getType() const { return GRT_CONSTANT_RING_BUFFER; }
+
+    virtual uint32_t write(const void* data);
+    virtual void nextFrame();
+    virtual uint32_t getBlockSize() const { return mBlockSize; }
+};
+
+// measurements a GLTimer can have in flight, begin() skips one if they're all still pending
+const uint32_t GPU_TIMER_QUERIES = 4;
+
+class GLTimer : public IGPUTimer
+{
+protected:
+    GLuint mQueries[GPU_TIMER_QUERIES];
+    uint32_t mTags[GPU_TIMER_QUERIES];
+    uint32_t mFirstPending;
+    uint32_t mPendingCount;
+    bool mRunning;
+public:
+    GLTimer();
+    virtual ~GLTimer();
+    virtual uint64_t getResourceId() const { return mQueries[0]; }
+    virtual GPUResourceType getType() const { return GRT_TIMER; }
+
+    virtual void begin(uint32_t tag);
+    virtual void end();
+    virtual bool getResult(float& milliseconds, uint32_t& tag);
+};
+
 class GLShader : public IGPUResource
 {
 protected:
@@ -108,6 +185,7 @@ protected:
     GLuint mProgramId;
 public:
     GLProgram(GLShader* vs, GLShader* ps, GLShader* gs);
+    GLProgram(GLShader* cs);
     virtual ~GLProgram();
 
     virtual uint64_t getResourceId() const { return mProgramId; }
@@ -138,11 +216,50 @@ public:
     virtual uint64_t getResourceId() const { return mBufferId; }
 };
 
+const int MAX_CACHED_TEXTURE_UNITS = 32;
+const int MAX_CACHED_BUFFER_BINDINGS = 16;
+const GLuint UNKNOWN_GL_STATE = 0xFFFFFFFF;
+
+// what the renderer last told GL, so the same binding/state twice in a row costs nothing.
+// UNKNOWN_GL_STATE means we don't know and the next call goes through
+struct GLStateCache {
+    GLuint Program;
+    GLuint VertexArray;
+    // part of the vertex array's state, unknown again whenever the vertex array changes
+    GLuint ElementBuffer;
+    GLuint IndirectBuffer;
+    GLuint ActiveTexture;
+    GLuint Textures[MAX_CACHED_TEXTURE_UNITS];
+    GLuint UniformBuffers[MAX_CACHED_BUFFER_BINDINGS];
+    GLuint StorageBuffers[MAX_CACHED_BUFFER_BINDINGS];
+    GLuint Blend;
+    GLuint CullFace;
+    GLuint DepthTest;
+    GLuint DepthWrite;
+    GLuint ScissorTest;
+};
+
 class OpenGLRenderer : public Renderer
 {
 protected:
     GLFWwindow* mWindowHandle;
     std::vector<IGPUResource*> mResources;
+    GLStateCache mState;
+    RenderStateStats mStateStats;
+
+    // true if GL needs to be told, the cache takes the new value then
+    bool _changeState(GLuint& cached, GLuint value) {
+        if (cached == value) {
+            mStateStats.Filtered++;
+            return false;
+        }
+        cached = value;
+        mStateStats.Calls++;
+        return true;
+    }
+    // creating GL objects binds them behind the cache's back
+    void _invalidateBindings();
+    void _setCapability(GLenum cap, GLuint& cached, bool enable);
 public:
     OpenGLRenderer(GLFWwindow* windowHandle);
     virtual ~OpenGLRenderer();
@@ -152,22 +269,30 @@ public:
     virtual void swapBuffers();
 
     virtual IGPUShaderProgram* createGPUProgram(IGPUResource* vs, IGPUResource* ps, IGPUResource* gs);
+    virtual IGPUShaderProgram* createGPUComputeProgram(IGPUResource* cs);
     virtual IGPUTexture* createGPUTexture(int width, int height, void* data, TextureFormat format);
     virtual IGPUTexture* createGPUCubeMapTexture(int width, int height, std::vector<void*> dataList, TextureFormat format);
     virtual IGPUVertexBuffer* createGPUVertexBuffer(const Vertex* data, uint32_t count);
     virtual IGPUVertexBuffer* createGPUAnimatedVertexBuffer(const AnimatedVertex* data, uint32_t count);
+    virtual IGPUVertexBuffer* createGPUAnimatedVertexBuffer(const CompactAnimatedVertex* data, uint32_t count);
     virtual IGPUIndexBuffer* createGPUIndexBuffer(const uint32_t* data, uint32_t count);
     virtual FrameBuffer* createFrameBufferObject(const FrameBufferDesc& desc);
 
     virtual IGPUConstantBuffer* createGPUConstantBuffer(uint32_t sizeinBytes);
+    virtual IGPUStorageBuffer* createGPUStorageBuffer(uint32_t sizeinBytes);
+    virtual IGPUConstantRingBuffer* createGPUConstantRingBuffer(uint32_t blockSize, uint32_t blocksPerFrame);
+    virtual IGPUTimer* createGPUTimer();
 
     virtual IGPUResource* createVertexShader(const std::string& code);
     virtual IGPUResource* createPixelShader(const std::string& code);
     virtual IGPUResource* createGeometryShader(const std::string& code);
+    virtual IGPUResource* createComputeShader(const std::string& code);
 
     virtual void bindConstantBuffer(IGPUConstantBuffer* buffer, enum CBufferBindType type, uint32_t index);
+    virtual void bindStorageBuffer(IGPUResource* buffer, uint32_t index);
+    virtual void pushConstantData(IGPUConstantRingBuffer* ring, const void* data, uint32_t index);
 
-    virtual void bindFrameBuffer(FrameBuffer* fb, const ColorF& color);
+    virtual void bindFrameBuffer(FrameBuffer* fb, const ColorF& color, bool clear = true);
 
     virtual void bindGPUTexture(IGPUTexture* tex, int index);
 
@@ -175,11 +300,26 @@ public:
     virtual void unbindResource(IGPUResource* r);
 
     virtual void setDepthTest(bool enable);
+    virtual void setDepthWrite(bool enable);
+    virtual void setCulling(bool enable);
+    virtual void setBlending(bool enable);
     virtual void setViewport(float left, float top, float width, float height);
+    virtual void setScissor(bool enable, int left, int bottom, int width, int height);
+
+    virtual void copyTextureRegion(IGPUTexture* src, uint32_t srcLayer, int srcX, int srcY,
+                                   IGPUTexture* dst, uint32_t dstLayer, int dstX, int dstY, int width, int height);
+    virtual void clearDepthRegion(IGPUTexture* tex, uint32_t layer, int x, int y, int width, int height, float depth);
 
     virtual void draw(uint32_t numTriangle);
     virtual void drawInstanced(uint32_t numTriangle, uint32_t numInstance);
     virtual void drawNonIndexed(uint32_t numVertices);
+    virtual void drawIndirect(IGPUResource* commands, uint32_t firstCommand, uint32_t commandCount);
+
+    virtual void dispatchCompute(uint32_t groupsX, uint32_t groupsY, uint32_t groupsZ);
+    virtual void memoryBarrier();
+
+    virtual void invalidateState();
+    virtual RenderStateStats resetStateStats();
 };
 
 GLuint getGLTextureFormat(TextureFormat format);
@@ -0,0 +1,94 @@
+#pragma once
+
+typedef std::function<void()> JobFunction;
+typedef std::function<void(uint32_t start, uint32_t end)> JobRangeFunction;
+
+struct JobCounter;
+
+// a function to run and the counter (optional) it decrements when done
+struct Job
+{
+    JobFunction Function;
+    JobCounter* Counter;
+};
+
+// Counts the jobs of a batch that haven't finished yet. Wait on it, or pass it
+// as a dependency so the next jobs only start once it reaches zero
+struct JobCounter
+{
+    std::atomic<int> Value;
+    // jobs depending on this counter, they stay off the queues until it reaches zero
+    std::mutex Lock;
+    std::vector<Job> Waiting;
+
+    JobCounter() : Value(0) { }
+
+    bool isDone() const { return Value.load(std::memory_order_acquire) == 0; }
+};
+
+struct JobSystemStats
+{
+    uint32_t JobsExecuted;
+    uint32_t JobsStolen;
+};
+
+// Work-stealing job system. Every thread has its own queue, the owner pops its newest
+// job while idle threads steal the oldest ones from the others. The main thread
+// (queue 0) takes part in the work whenever it waits on a counter.
+class JobSystem
+{
+private:
+    static JobSystem* sJobSystem;
+
+    struct JobQueue
+    {
+        std::mutex Lock;
+        std::deque<Job> Jobs;
+    };
+
+    std::vector<std::thread> mThreads;
+    std::vector<JobQueue*> mQueues;
+    std::atomic<bool> mRunning;
+    // jobs ready to run, the ones waiting on a dependency aren't counted
+    std::atomic<int> mQueuedJobs;
+    std::mutex mWakeLock;
+    std::condition_variable mWakeCondition;
+
+    std::atomic<uint32_t> mJobsExecuted;
+    std::atomic<uint32_t> mJobsStolen;
+public:
+    // 0 workers means one per hardware thread (minus the main thread)
+    JobSystem(uint32_t workerCount = 0);
+    ~JobSystem();
+
+    static JobSystem* get() { return sJobSystem; }
+
+    // worker threads plus the main thread
+    uint32_t getThreadCount() const { return (uint32_t)mQueues.size(); }
+
+    // counter (optional) gets incremented now and decremented when the job is done,
+    // the job won't start before dependency (optional) reaches zero
+    void run(const JobFunction& function, JobCounter* counter = nullptr, JobCounter* dependency = nullptr);
+
+    // splits [0, count) into groups of groupSize items, func gets called once per group
+    void parallelFor(uint32_t count, uint32_t groupSize, const JobRangeFunction& func,
+        JobCounter* counter, JobCounter* dependency = nullptr);
+
+    // executes pending jobs on the calling thread until the counter reaches zero
+    void wait(JobCounter* counter);
+
+    // returns and resets the counters
+    JobSystemStats resetStats();
+
+    // schedules jobCount empty jobs and returns the average cost per job (in microseconds)
+    double runStressTest(uint32_t jobCount);
+private:
+    void _push(uint32_t queueIndex, const Job* jobs, uint32_t count);
+    // parks the jobs on dependency unless it's done already, false if they can be queued
+    bool _defer(const Job* jobs, uint32_t count, JobCounter* dependency);
+    // decrements counter, the job taking it to zero queues the jobs waiting on it
+    void _finishJob(JobCounter* counter);
+    void _wakeWorkers(bool all);
+    bool _executeNext(uint32_t queueIndex);
+    void _workerLoop(uint32_t queueIndex);
+};
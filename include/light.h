@@ -75,6 +75,10 @@ protected:
     bool mNeedUpdate;
     float mRadius;
     bool mEnabled;
+    // the cube map is kept until the casters in range change (see Game::_scheduleShadowUpdates())
+    uint64_t mShadowSignature;
+    bool mShadowMapValid;
+    uint32_t mShadowUpdateFrame;
 public:
     PointLight(const glm::vec3& pos, bool castShadow);
     const glm::vec3& getPosition() const {
@@ -92,6 +96,18 @@ public:
     float getRadius() const { return mRadius; }
 
     const glm::mat4& getShadowViewProj(int index) const { return mShadowViewProjArray[index]; }
+    // the six face matrices for the light placed at position (its entity may move it)
+    void getShadowViewProj(const glm::vec3& position, glm::mat4* viewProjArray) const;
+
+    bool isShadowMapValid() const { return mShadowMapValid; }
+    uint64_t getShadowSignature() const { return mShadowSignature; }
+    uint32_t getShadowUpdateFrame() const { return mShadowUpdateFrame; }
+    void setShadowMapUpdated(uint64_t signature, uint32_t frame) {
+        mShadowSignature = signature;
+        mShadowUpdateFrame = frame;
+        mShadowMapValid = true;
+    }
+    void invalidateShadowMap() { mShadowMapValid = false; }
 
     AABB getBoundingBox();
 
@@ -9,6 +9,19 @@ protected:
     AABB mLocalBoundingBox;
 public:
     glm::mat4 tempMat;
+    // inverse(tempMat), worked out at load so skinned draws only need a multiply
+    glm::mat4 tempMatInverse;
+    // pre-skinning (skinned sub-meshes only): the CPU copy of the source vertices and the
+    // CPU skinning output (both only kept with CPU skinning, see SkeletonMesh::keepBindVertices())
+    // and the plain Vertex buffer all the passes draw once skinned
+    std::vector<AnimatedVertex> mBindVertices;
+    std::vector<Vertex> mSkinnedVertices;
+    IGPUVertexBuffer* mSkinnedVertexBuffer;
+    // CPU copy of the geometry, only for meshes loaded with keepGeometry (freed by StaticGeometry::build)
+    std::vector<Vertex> mVertices;
+    std::vector<uint32_t> mIndices;
+    // small unique id, the render queue sorts by it
+    uint32_t mSortId;
 public:
     SubMesh(IGPUResource* vb, IGPUIndexBuffer* ib);
     IGPUResource* getVertexBuffer() {
@@ -17,6 +30,9 @@ public:
     IGPUIndexBuffer* getIndexBuffer() {
         return mIndexBuffer;
     }
+    IGPUVertexBuffer* getSkinnedVertexBuffer() {
+        return mSkinnedVertexBuffer;
+    }
     void setMaterial(Material* mat) {
         mMaterial = mat;
     }
@@ -72,6 +88,40 @@ public:
     virtual SkeletonMesh* isSkeletonMesh() { return nullptr; }
 };
 
+// a sub-mesh inside the merged buffers of a StaticGeometry
+struct StaticDraw
+{
+    SubMesh* Mesh;
+    uint32_t IndexCount;
+    uint32_t FirstIndex;
+    uint32_t BaseVertex;
+    // world space, like the merged vertices
+    AABB Bounds;
+};
+
+// meshes that never move, merged into one vertex and one index buffer (in world space)
+// so any set of their sub-meshes can be drawn with a single indirect draw call.
+// The draws are sorted by material, every material is one contiguous range of mDraws
+class StaticGeometry
+{
+protected:
+    std::vector<std::pair<Mesh*, glm::mat4>> mPendingMeshes;
+public:
+    std::vector<StaticDraw> mDraws;
+    IGPUVertexBuffer* mVertexBuffer;
+    IGPUIndexBuffer* mIndexBuffer;
+public:
+    StaticGeometry() : mVertexBuffer(nullptr), mIndexBuffer(nullptr) {
+    }
+    // the mesh must have been loaded with keepGeometry
+    void addMesh(Mesh* mesh, const glm::mat4& world) {
+        mPendingMeshes.push_back(std::make_pair(mesh, world));
+    }
+    // merges the meshes added so far and creates the buffers, call once
+    void build(Renderer* rend);
+    bool isEmpty() const { return mDraws.empty(); }
+};
+
 class KeyPosition
 {
 public:
@@ -96,70 +146,115 @@ public:
 class Bone;
 class Skeleton;
 
+// Where the last sample of a track landed, so the next one can carry on from there
+struct TrackCursor
+{
+    uint32_t Position;
+    uint32_t Rotation;
+    uint32_t Scale;
+
+    TrackCursor() : Position(0), Rotation(0), Scale(0) { }
+};
+
+// Rotation packed with the "smallest three" method, the largest component is dropped
+// (it comes back from the unit length), the other three get 15 bits each. 48 bits total
+struct PackedQuat
+{
+    uint16_t Data[3];
+};
+
+// 16 bits per component, relative to the range of the track it belongs to
+struct PackedVec3
+{
+    uint16_t Data[3];
+};
+
+// error allowed while dropping keys at import time
+const float ANIM_POSITION_TOLERANCE = 0.001f;
+const float ANIM_ROTATION_TOLERANCE = 0.1f * M_DEGTORAD;
+const float ANIM_SCALE_TOLERANCE = 0.001f;
+
+struct AnimationCompressionStats
+{
+    uint32_t RawKeyCount;
+    uint32_t KeyCount;
+    size_t RawSize;
+    size_t CompressedSize;
+    // worst difference between the original and the compressed keys, in bone local space
+    float MaxPositionError;
+    float MaxRotationError;     // radians
+    float MaxScaleError;
+
+    AnimationCompressionStats()
+        : RawKeyCount(0), KeyCount(0), RawSize(0), CompressedSize(0),
+        MaxPositionError(0), MaxRotationError(0), MaxScaleError(0) { }
+};
+
+// Local (parent relative) transform of a bone, kept as TRS so poses can be
+// sampled and blended without going through matrices
+struct BonePose
+{
+    glm::vec3 Position;
+    glm::quat Rotation;
+    glm::vec3 Scale;
+};
+
 class BoneAnimationTrack
 {
 public:
     Bone* mBone;
-    std::vector<KeyPosition> mPositions;
-    std::vector<KeyRotation> mRotations;
-    std::vector<KeyScale> mScales;
+    // time stamps and values live in separate arrays, the key searches only touch the times
+    std::vector<float> mPositionTimes;
+    std::vector<PackedVec3> mPositions;
+    glm::vec3 mPositionMin;
+    glm::vec3 mPositionExtent;
+    std::vector<float> mRotationTimes;
+    std::vector<PackedQuat> mRotations;
+    std::vector<float> mScaleTimes;
+    std::vector<PackedVec3> mScales;
+    glm::vec3 mScaleMin;
+    glm::vec3 mScaleExtent;
+    // full precision keys as they come from the file, compress() turns them
+    // into the arrays above and frees them
+    std::vector<KeyPosition> mRawPositions;
+    std::vector<KeyRotation> mRawRotations;
+    std::vector<KeyScale> mRawScales;
 public:
     BoneAnimationTrack(Bone* bone)
-        : mBone(bone) {
+        : mBone(bone), mPositionMin(0.0f), mPositionExtent(0.0f), mScaleMin(0.0f), mScaleExtent(0.0f) {
     }
 
     void insertPositionKey(const KeyPosition& key) {
-        mPositions.push_back(key);
+        mRawPositions.push_back(key);
     }
 
     void insertRotationKey(const KeyRotation& key) {
-        mRotations.push_back(key);
+        mRawRotations.push_back(key);
     }
 
     void insertScaleKey(const KeyScale& key) {
-        mScales.push_back(key);
+        mRawScales.push_back(key);
     }
 
+    // drops the keys that can be interpolated from their neighbours (within the
+    // ANIM_*_TOLERANCE) and quantizes the rest, must be called once all the keys are in
+    void compress(AnimationCompressionStats& stats);
+
+    glm::vec3 getPosition(uint32_t index) const;
+    glm::quat getRotation(uint32_t index) const;
+    glm::vec3 getScale(uint32_t index) const;
+
     /* Gets the current index on mKeyPositions to interpolate to based on
-    the current animation time*/
-    int GetPositionIndex(float animationTime);
+    the current animation time (cursor is the index found by the previous call)*/
+    int GetPositionIndex(float animationTime, uint32_t& cursor);
     /* Gets the current index on mKeyRotations to interpolate to based on the
-    current animation time*/
-    int GetRotationIndex(float animationTime)
-    {
-        for (size_t index = 0; index < mRotations.size() - 1; ++index)
-        {
-            if (animationTime < mRotations[index + 1].timeStamp)
-                return index;
-        }
-        return 0;
-    }
-
+    current animation time (cursor is the index found by the previous call)*/
+    int GetRotationIndex(float animationTime, uint32_t& cursor);
     /* Gets the current index on mKeyScalings to interpolate to based on the
-    current animation time */
-    int GetScaleIndex(float animationTime)
-    {
-        for (size_t index = 0; index < mScales.size() - 1; ++index)
-        {
-            if (animationTime < mScales[index + 1].timeStamp)
-                return index;
-        }
-        return 0;
-    }
+    current animation time (cursor is the index found by the previous call)*/
+    int GetScaleIndex(float animationTime, uint32_t& cursor);
 
     float GetScaleFactor(float lastTimeStamp, float nextTimeStamp, float animationTime);
-
-    /*figures out which position keys to interpolate b/w and performs the interpolation
-    and returns the translation matrix*/
-    glm::mat4 InterpolatePosition(float animationTime);
-
-    /*figures out which rotations keys to interpolate b/w and performs the interpolation
-    and returns the rotation matrix*/
-    glm::mat4 InterpolateRotation(float animationTime);
-
-    /*figures out which scaling keys to interpolate b/w and performs the interpolation
-    and returns the scale matrix*/
-    glm::mat4 InterpolateScaling(float animationTime);
 };
 
 class SkeletonAnimation
@@ -167,6 +262,9 @@ class SkeletonAnimation
 public:
     std::string mName;
     std::map<Bone*, BoneAnimationTrack*> mAnimationTrackList;
+    // the tracks again, sorted by bone index along with the indices (see bindTracks())
+    std::vector<BoneAnimationTrack*> mTracks;
+    std::vector<uint32_t> mTrackBones;
     float mDuration;
     float mTicks;
 public:
@@ -188,7 +286,15 @@ public:
         return track;
     }
 
-    void applyToSkeleton(Skeleton* ske, float timeStamp, float weight);
+    // flattens mAnimationTrackList into mTracks/mTrackBones, call once all the tracks are in
+    // and the skeleton has its bone indices (Skeleton::_buildBoneList())
+    void bindTracks();
+
+    // samples every track at timeStamp and writes the result into pose (indexed by bone index),
+    // bones without a track are left untouched. cursors holds one entry per track,
+    // owned by whoever plays the animation. Only the tracks of the first boneCount bones
+    // get sampled, the others are left untouched too. Needs bindTracks()
+    void samplePose(float timeStamp, std::vector<TrackCursor>& cursors, BonePose* pose, uint32_t boneCount);
 };
 
 class AnimationState
@@ -199,6 +305,13 @@ public:
     float mSpeed;
     float mTime;
     bool mLoop;
+    SkeletonAnimation* mAnimation;
+    // keyframe lookup cache for each track of the animation
+    std::vector<TrackCursor> mCursors;
+    // blend weight, moves towards mTargetWeight by mFadeSpeed per second
+    float mWeight;
+    float mTargetWeight;
+    float mFadeSpeed;
 public:
     AnimationState(const std::string& name, float length);
     void setSpeed(float speed);
@@ -223,6 +336,9 @@ public:
     std::string mName;
     Bone* mParent;
     uint32_t boneId;
+    // position in Skeleton::mBones (and the pose buffers), parents come first
+    uint32_t mIndex;
+    int32_t mParentIndex;
     std::vector<Bone*> mChildren;
     std::vector<KeyPosition> mPositions;
     std::vector<KeyRotation> mRotations;
@@ -243,9 +359,32 @@ class Skeleton
 public:
     std::map<std::string, Bone*> mBoneList;
     std::vector<Bone*> mRootBoneList;
+    // all the bones in breadth-first order, parents always come before their children
+    std::vector<Bone*> mBones;
+    // rest pose, bones that aren't animated keep this
+    std::vector<BonePose> mBindPose;
+    std::vector<BonePose> mLocalPose;
     std::map<std::string, SkeletonAnimation*> mAnimationList;
     std::map<std::string, AnimationState*> mAnimationStateList;
     AnimationState* mCurrentAnimState = nullptr;
+    // states that contribute to the pose, blended by their weights
+    std::vector<AnimationState*> mActiveStates;
+    // one pose per active state, back to back (only used when blending)
+    std::vector<BonePose> mLayerPoses;
+    std::vector<float> mLayerWeights;
+    // animation LOD (see setLOD), mLODTick counts the ticks since the last sample
+    // and mLODTime the time they add up to
+    uint32_t mLODUpdateInterval;
+    uint32_t mLODBoneCount;
+    uint32_t mLODTick;
+    float mLODTime;
+    // the pose on screen when the last sample was taken and that sample,
+    // mLocalPose moves from one to the other until the next sample
+    std::vector<BonePose> mLODSourcePose;
+    std::vector<BonePose> mLODTargetPose;
+    // bumped by update() when the pose really changed (see getPoseVersion) and the pose it was bumped for
+    uint32_t mPoseVersion;
+    std::vector<BonePose> mVersionedPose;
     glm::mat4 mGlobalInverseTransform;
 public:
     Skeleton();
@@ -258,10 +397,32 @@ public:
 
     AnimationState* getCurrentAnimationState() { return mCurrentAnimState; }
     AnimationState* getAnimationState(const std::string& name);
+    // switches to the state right away, dropping all the others
     AnimationState* setAnimationState(const std::string& name);
     AnimationState* setAnimationState(AnimationState* state);
 
+    // fades the state to weight over fadeTime seconds, states that fade out to zero get dropped
+    void fadeAnimationState(AnimationState* state, float weight, float fadeTime);
+    // fades the state in and all the others out, it becomes the current state right away
+    AnimationState* crossFade(AnimationState* state, float fadeTime);
+
+    // animation LOD: the pose gets sampled every updateInterval ticks only (and blended
+    // in between), with just the first boneCount bones of mBones animated (the others
+    // keep the bind pose). Parents come first, so that drops the fingers before the arms
+    void setLOD(uint32_t updateInterval, uint32_t boneCount);
+
+    // changes only when update() writes a different pose, with a LOD interval only the samples
+    // count (not the blends in between). Lets the cached shadows skip idle or sparsely updated skeletons
+    uint32_t getPoseVersion() const { return mPoseVersion; }
+
+    // call once all the bones have been created
+    void _buildBoneList();
     void _initAnimationStates();
+private:
+    void _updateAnimationWeights(float dt);
+    void _samplePose(float dt);
+    void _updatePoseVersion();
+    void _blendLayers(uint32_t layerCount);
 };
 
 struct BoneInfo {
@@ -271,12 +432,41 @@ struct BoneInfo {
     glm::mat4 offset;
 };
 
+// one animation of a SkeletonMesh baked into bone palettes at a fixed rate, see SkeletonMesh::bakeAnimations()
+struct BakedAnimationClip
+{
+    std::string Name;
+    // in frames, each frame holds mBoneCounter matrices of SkeletonMesh::mBakedFrames
+    uint32_t FirstFrame;
+    uint32_t FrameCount;
+    float FrameRate;
+};
+
 class SkeletonMesh : public Mesh
 {
 public:
     std::map<std::string, BoneInfo> mBoneInfoMap; //
     int mBoneCounter = 0;
     Skeleton mSkeleton;
+    // for each palette slot (BoneInfo::id), the bone's index in mSkeleton.mBones and its offset
+    std::vector<uint32_t> mPaletteBones;
+    std::vector<glm::mat4> mPaletteOffsets;
+    // final skinning matrices indexed by BoneInfo::id, recomputed once per frame in World::update
+    std::vector<glm::mat4> mBonePalette;
+    // where mBonePalette starts in this frame's palette buffer (set by the renderer)
+    uint32_t mBonePaletteOffset = 0;
+    // sub-meshes use CompactAnimatedVertex (4 influences) instead of AnimatedVertex
+    bool mCompactVertices = false;
+    // skinned once this frame into the sub-meshes' mSkinnedVertexBuffer, draw them as static meshes
+    bool mPreSkinned = false;
+    // the bind pose bounds grown to the box around their bounding sphere, so a limb swinging out in
+    // any pose stays inside (root motion doesn't), the passes cull every sub-mesh with it
+    AABB mAnimatedBoundingBox;
+    // every animation of mSkeleton sampled into bone palettes, for instanced crowds
+    std::vector<BakedAnimationClip> mBakedClips;
+    std::vector<glm::mat4> mBakedFrames;
+    // where mBakedClips starts in the renderer's baked clip buffer (set by the renderer)
+    uint32_t mBakedClipOffset = 0;
 public:
     SkeletonMesh(const std::string& name) : Mesh(name) {
     }
@@ -288,6 +478,21 @@ public:
     auto& GetBoneInfoMap() { return mBoneInfoMap; }
     int& GetBoneCount() { return mBoneCounter; }
 
+    const std::vector<glm::mat4>& getBonePalette() const { return mBonePalette; }
+    void updateBonePalette();
+    // CPU skinning of every sub-mesh into SubMesh::mSkinnedVertices, call after updateBonePalette()
+    void skinVertices();
+    // reads SubMesh::mBindVertices back from the vertex buffers, or frees them (and the CPU skinning
+    // output) when nothing reads them. Needs the GL context
+    void keepBindVertices(bool keep);
+    // samples every animation into mBakedClips/mBakedFrames at frameRate frames per second
+    void bakeAnimations(float frameRate);
+    // index into mBakedClips, -1 if there's no clip with that name
+    int getBakedClipIndex(const std::string& name) const;
+
+    // turns the bone names of mBoneInfoMap into skeleton bone indices, call after Skeleton::_buildBoneList()
+    void _resolveBones();
+
     virtual SkeletonMesh* isSkeletonMesh() { return this; }
 };
 
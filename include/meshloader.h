@@ -131,7 +131,7 @@ public:
         return index;
     };
 
-    bool loadFromFile(const std::string& modelpath, Mesh* mesh, bool createCollisionMesh) {
+    bool loadFromFile(const std::string& modelpath, Mesh* mesh, bool createCollisionMesh, bool keepGeometry) {
         std::ifstream file(modelpath);
 
         if (!file.is_open()) {
@@ -354,6 +354,11 @@ public:
             sm->setMaterial(mat);
             sm->setLocalBoundingBox(bbSubMesh);
 
+            if (keepGeometry) {
+                sm->mVertices = omat->vertices;
+                sm->mIndices = omat->indices;
+            }
+
             // Build a bullet physics mesh for collision
             if (nocollision == std::string::npos) {
                 if (createCollisionMesh) {
@@ -33,7 +33,10 @@ enum GPUResourceType {
     GRT_VERTEX_BUFFER,
     GRT_INDEX_BUFFER,
     GRT_CONSTANT_BUFFER,
+    GRT_STORAGE_BUFFER,
+    GRT_CONSTANT_RING_BUFFER,
     GRT_FRAMEBUFFER,
+    GRT_TIMER,
 };
 
 class IGPUResource
@@ -51,6 +54,7 @@ public:
     virtual uint32_t getWidth() const = 0;
     virtual uint32_t getHeight() const = 0;
     virtual bool isCubeMap() const = 0;
+    virtual bool isArray() const = 0;
 };
 
 class IGPUIndexBuffer : public IGPUResource
@@ -64,6 +68,8 @@ class IGPUVertexBuffer : public IGPUResource
 public:
     virtual void updateData(const Vertex* data, uint32_t count) = 0;
     virtual uint32_t getVertexCount() const = 0;
+    // copies size bytes of the buffer back (stalls, only for the odd mode switch)
+    virtual void readData(void* data, uint32_t size) = 0;
 };
 
 class IGPUConstantBuffer : public IGPUResource
@@ -73,6 +79,38 @@ public:
     virtual uint32_t getBufferSize() const = 0;
 };
 
+// Constant data that changes for every draw: each write goes to a new block, and a block
+// doesn't get written again until the GPU is done with the frame that used it
+class IGPUConstantRingBuffer : public IGPUResource
+{
+public:
+    // copies one block of data, returns its offset in bytes
+    virtual uint32_t write(const void* data) = 0;
+    // call once per frame, waits if the GPU is still reading the blocks we're about to reuse
+    virtual void nextFrame() = 0;
+    virtual uint32_t getBlockSize() const = 0;
+};
+
+// Shader storage buffer, for data that doesn't have a fixed size
+class IGPUStorageBuffer : public IGPUResource
+{
+public:
+    // the buffer grows if the data doesn't fit
+    virtual void updateData(const void* data, uint32_t sizeinBytes) = 0;
+    virtual uint32_t getBufferSize() const = 0;
+};
+
+// Measures how long the GPU spends on the commands between begin() and end(). The results
+// come back a few frames late, each one with the tag it was started with
+class IGPUTimer : public IGPUResource
+{
+public:
+    virtual void begin(uint32_t tag) = 0;
+    virtual void end() = 0;
+    // the newest measurement the GPU has finished, false if there's none since the last call
+    virtual bool getResult(float& milliseconds, uint32_t& tag) = 0;
+};
+
 class Shader : public Resource
 {
 public:
@@ -133,6 +171,8 @@ public:
     ColorF mSpecularColor;
     Texture* mEmissionMap;
     bool mTwoSided;
+    // small unique id, the render queue sorts by it
+    uint32_t mSortId;
 public:
     Material(const std::string& name)
         : Resource(name),
@@ -141,7 +181,8 @@ public:
             mMetalnessMap(nullptr),
             mRoughnessMap(nullptr),
             mEmissionMap(nullptr),
-            mTwoSided(false) {
+            mTwoSided(false),
+            mSortId(0) {
     }
     void setDiffuseMap(Texture* map) {
         mDiffuseMap = map;
@@ -186,6 +227,7 @@ class ResourceManager
 protected:
     std::vector<Resource*> mResources;
     std::string mCommonShaderCodes;
+    uint32_t mMaterialCount;
 public:
     ResourceManager();
     virtual ~ResourceManager();
@@ -195,10 +237,14 @@ public:
     SkeletonMesh* createSkeletonMesh(const std::string& name);
 
     IGPUShaderProgram* loadShaders(const char* vertex_file_path, const char* fragment_file_path, const char* geom_file_path = 0);
+    IGPUShaderProgram* loadComputeShader(const char* compute_file_path);
     Texture* loadTexture(const std::string& path, bool linear = false);
     Texture* loadCubeMapTexture(const std::vector<std::string>& paths, bool linear = false);
-    Mesh* loadMesh(const std::string& path, const std::string& name, bool createCollisionMesh = false);
-    SkeletonMesh* loadSkeletonMesh(const std::string& path, const std::string& name);
+    // keepGeometry leaves a CPU copy of the vertices/indices in the sub-meshes (see StaticGeometry)
+    Mesh* loadMesh(const std::string& path, const std::string& name, bool createCollisionMesh = false, bool keepGeometry = false);
+    // compactVertices stores the skinned vertices as CompactAnimatedVertex, a bakeFrameRate above 0
+    // also bakes the animations at that rate so the mesh can be used by crowds
+    SkeletonMesh* loadSkeletonMesh(const std::string& path, const std::string& name, bool compactVertices = true, float bakeFrameRate = 0.0f);
 };
 
 std::string loadFile(const char* file_path);
@@ -303,6 +349,19 @@ struct AnimatedVertex {
     }
 };
 
+const int NUM_COMPACT_BONES_PER_VERTEX = 4;
+
+// Skinned vertex with only the 4 strongest influences, 8-bit bone ids and
+// normalized 16-bit weights (they add up to 65535)
+struct CompactAnimatedVertex {
+    glm::vec3 position;
+    glm::vec3 normal;
+    glm::vec3 tangent;
+    glm::vec2 texCoord;
+    uint8_t boneIDs[NUM_COMPACT_BONES_PER_VERTEX];
+    uint16_t boneWeights[NUM_COMPACT_BONES_PER_VERTEX];
+};
+
 const Vertex quadVertices[] = {
     // positions        // texture Coords
     Vertex(-1.0f,    1.0f, 0.0f, 0.0f, 1.0f),
@@ -355,7 +414,7 @@ enum FRAME_BUFFER_FLAG {
     FRAME_BUFFER_FLAG_SHADOW = 1 << 2, // 4
     FRAME_BUFFER_FLAG_SHADOW_CUBE = 1 << 3, // 8
     FRAME_BUFFER_FLAG_DEPTH = 1 << 4, // 16
-    Flag6 = 1 << 5, // 32
+    FRAME_BUFFER_FLAG_SHADOW_ARRAY = 1 << 5, // 32
     Flag7 = 1 << 6, // 64
     Flag8 = 1 << 7  //128
 };
@@ -371,6 +430,8 @@ struct FrameBufferDesc {
     TextureFilterType FilterType;
     int NumRenderTarget;
     std::vector<RenderTargetDesc> RenderTargetDescList;
+    // layers of a FRAME_BUFFER_FLAG_SHADOW_ARRAY depth attachment
+    uint32_t Layers = 1;
 };
 
 enum CBufferBindType {
@@ -379,6 +440,21 @@ enum CBufferBindType {
     CBBT_GS
 };
 
+// layout fixed by the API, one command of Renderer::drawIndirect()
+struct DrawIndirectCommand {
+    uint32_t Count;
+    uint32_t InstanceCount;
+    uint32_t FirstIndex;
+    int32_t BaseVertex;
+    uint32_t BaseInstance;
+};
+
+// GL calls the renderer's state cache let through / filtered out, see Renderer::resetStateStats()
+struct RenderStateStats {
+    uint32_t Calls;
+    uint32_t Filtered;
+};
+
 class Renderer
 {
 protected:
@@ -396,24 +472,35 @@ public:
 
     virtual IGPUVertexBuffer* createGPUVertexBuffer(const Vertex* data, uint32_t count) = 0;
     virtual IGPUVertexBuffer* createGPUAnimatedVertexBuffer(const AnimatedVertex* data, uint32_t count) = 0;
+    virtual IGPUVertexBuffer* createGPUAnimatedVertexBuffer(const CompactAnimatedVertex* data, uint32_t count) = 0;
     virtual IGPUIndexBuffer* createGPUIndexBuffer(const uint32_t* data, uint32_t count) = 0;
 
     virtual QuadBufferIndexed* createQuadBufferIndexed();
 
     virtual IGPUConstantBuffer* createGPUConstantBuffer(uint32_t sizeinBytes) = 0;
+    virtual IGPUStorageBuffer* createGPUStorageBuffer(uint32_t sizeinBytes) = 0;
+    virtual IGPUConstantRingBuffer* createGPUConstantRingBuffer(uint32_t blockSize, uint32_t blocksPerFrame) = 0;
+    virtual IGPUTimer* createGPUTimer() = 0;
 
     virtual IGPUResource* createVertexShader(const std::string& code) = 0;
     virtual IGPUResource* createPixelShader(const std::string& code) = 0;
     virtual IGPUResource* createGeometryShader(const std::string& code) = 0;
+    virtual IGPUResource* createComputeShader(const std::string& code) = 0;
     virtual IGPUShaderProgram* createGPUProgram(IGPUResource* vs, IGPUResource* ps, IGPUResource* gs) = 0;
+    virtual IGPUShaderProgram* createGPUComputeProgram(IGPUResource* cs) = 0;
 
     virtual FrameBuffer* createFrameBufferObject(const FrameBufferDesc& desc) = 0;
 
-    virtual void bindFrameBuffer(FrameBuffer* fb, const ColorF& color) = 0;
+    // clear is false to keep drawing over what's already in fb
+    virtual void bindFrameBuffer(FrameBuffer* fb, const ColorF& color, bool clear = true) = 0;
 
     virtual void bindGPUTexture(IGPUTexture* tex, int index) = 0;
 
     virtual void bindConstantBuffer(IGPUConstantBuffer* buffer, enum CBufferBindType type, uint32_t index) { assert(0); }
+    // vertex buffers can be bound here too, so compute shaders can read/write them
+    virtual void bindStorageBuffer(IGPUResource* buffer, uint32_t index) { assert(0); }
+    // writes data into the next block of the ring and binds that block at index
+    virtual void pushConstantData(IGPUConstantRingBuffer* ring, const void* data, uint32_t index) { assert(0); }
 
     virtual void bindQuadBuffer(QuadBufferIndexed* qb);
 
@@ -421,11 +508,34 @@ public:
     virtual void unbindResource(IGPUResource* r) = 0;
 
     virtual void setDepthTest(bool enable) = 0;
+    virtual void setDepthWrite(bool enable) = 0;
+    virtual void setCulling(bool enable) = 0;
+    // alpha blending (src alpha, one minus src alpha)
+    virtual void setBlending(bool enable) = 0;
     virtual void setViewport(float left, float top, float width, float height) = 0;
+    // the draws only touch pixels inside the rectangle while it's enabled
+    virtual void setScissor(bool enable, int left, int bottom, int width, int height) = 0;
+
+    // copies a rectangle of one texture (array) layer into another, the formats have to match
+    virtual void copyTextureRegion(IGPUTexture* src, uint32_t srcLayer, int srcX, int srcY,
+                                   IGPUTexture* dst, uint32_t dstLayer, int dstX, int dstY, int width, int height) = 0;
+    // fills a rectangle of one layer of a depth texture (array) with depth
+    virtual void clearDepthRegion(IGPUTexture* tex, uint32_t layer, int x, int y, int width, int height, float depth) = 0;
 
     virtual void draw(uint32_t numTriangle) = 0;
     virtual void drawInstanced(uint32_t numTriangle, uint32_t numInstance) = 0;
     virtual void drawNonIndexed(uint32_t numVertices) = 0;
+    // commandCount DrawIndirectCommand's from commands (any buffer), starting at firstCommand, in one call
+    virtual void drawIndirect(IGPUResource* commands, uint32_t firstCommand, uint32_t commandCount) = 0;
+
+    virtual void dispatchCompute(uint32_t groupsX, uint32_t groupsY, uint32_t groupsZ) = 0;
+    // makes what the compute shaders wrote into vertex buffers visible to the following draws
+    virtual void memoryBarrier() = 0;
+
+    // forget the cached state, for when something else (the GUI) has been talking to the API
+    virtual void invalidateState() = 0;
+    // returns the stats since the last call and starts over
+    virtual RenderStateStats resetStateStats() = 0;
 };
 
 class FrameBuffer : public IGPUResource
@@ -451,6 +561,53 @@ public:
     virtual GPUResourceType getType() const { return GRT_SHADER_PROGRAM; }
 };
 
+// one draw of a RenderQueue
+struct RenderItem
+{
+    SubMesh* Mesh;
+    // the sub-mesh's own vertex buffer or its pre-skinned one
+    IGPUResource* VertexBuffer;
+    glm::mat4 World;
+    int32_t BoneOffset;
+    float Animated;
+    // the shadow cascades the item is drawn to, see Game::_getCascadeMask()
+    uint32_t CascadeMask;
+};
+
+// the draws of a pass, sorted by a 64-bit key so the ones sharing state end up next to each other
+class RenderQueue
+{
+protected:
+    std::vector<RenderItem> mItems;
+    std::vector<uint64_t> mKeys;
+    std::vector<uint32_t> mOrder;
+    // radix sort scratch
+    std::vector<uint64_t> mTempKeys;
+    std::vector<uint32_t> mTempOrder;
+public:
+    // from the most significant bit: pass (3) | transparent (1) | shader (4) | material (16) | mesh (16) | depth (24)
+    // transparent draws put the depth (inverted, back to front) in front of material and mesh instead.
+    // depth is 0 to 1, everything else gets truncated to its field
+    static uint64_t makeKey(uint32_t pass, bool transparent, uint32_t shader, uint32_t material, uint32_t mesh, float depth);
+
+    void clear() {
+        mItems.clear();
+        mKeys.clear();
+    }
+    void submit(uint64_t key, const RenderItem& item) {
+        mKeys.push_back(key);
+        mItems.push_back(item);
+    }
+    // LSD radix sort, 8 bits at a time
+    void sort();
+    // first sorted draw whose key isn't less than key
+    uint32_t lowerBound(uint64_t key) const;
+
+    uint32_t size() const { return (uint32_t)mItems.size(); }
+    // i-th draw in sorted order, valid after sort()
+    const RenderItem& at(uint32_t i) const { return mItems[mOrder[i]]; }
+};
+
 
 
 
@@ -10,6 +10,14 @@
 #include <unordered_map>
 #include <random>
 #include <algorithm>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <thread>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
 
 #include <glad\glad.h>
 #include <GLFW\glfw3.h>
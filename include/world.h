@@ -5,9 +5,12 @@ class Mesh;
 class Light;
 class DirectionalLight;
 class PointLight;
+class Skeleton;
+class SkeletonMesh;
 
 class SceneEntity
 {
+    friend class World;
 protected:
     Entity_T mId;
     std::string mName;
@@ -21,6 +24,7 @@ public:
     Entity_T getId() const { return mId; }
 
     bool isRootEntity() const { return mParent == nullptr; }
+    SceneEntity* getParent() const { return mParent; }
 
     const std::vector<SceneEntity*>& getChildren() const {
         return mChildren;
@@ -32,6 +36,7 @@ public:
     virtual void update(float dt);
 protected:
     void addChild(SceneEntity* child);
+    void removeChild(SceneEntity* child);
 };
 
 struct TransformComponent
@@ -45,6 +50,8 @@ struct TransformComponent
 struct MeshComponent
 {
     Mesh* mMesh;
+    // merged into the renderer's static geometry, only its transparent parts are drawn on their own
+    bool mStaticBatched;
 };
 
 struct BillboardComponent
@@ -74,6 +81,18 @@ struct InteractComponent
     }
 };
 
+// one member of a crowd: no skeleton of its own, it's drawn instanced with the other members
+// sharing its mesh and animated on the GPU from the mesh's baked clips (SkeletonMesh::bakeAnimations)
+struct CrowdComponent
+{
+    SkeletonMesh* Mesh;
+    // index into Mesh->mBakedClips
+    uint32_t Clip;
+    // seconds, so the members of a crowd don't move in lockstep
+    float TimeOffset;
+    float Speed;
+};
+
 struct KeyFrame {
     glm::quat Rotation;
     float TimeStamp;
@@ -88,6 +107,8 @@ struct AnimationComponent
     bool Reverse;
     bool Play;
     std::vector<KeyFrame> KeyFrames;
+    // key frame found by the last GetKeyFrameIndex() call
+    uint32_t Cursor = 0;
 
     void createKeyFrame(const glm::quat& rot, float timeStamp) {
         KeyFrame frame;
@@ -98,13 +119,108 @@ struct AnimationComponent
 
     int GetKeyFrameIndex(float animationTime)
     {
-        for (size_t index = 0; index < KeyFrames.size() - 1; ++index)
-        {
-            if (animationTime < KeyFrames[index + 1].TimeStamp)
-                return index;
+        return findKeyFrame((uint32_t)KeyFrames.size(), animationTime, Cursor,
+            [this](uint32_t i) { return KeyFrames[i].TimeStamp; });
+    }
+};
+
+// Packed (sparse-set) component storage. Components of one type live
+// contiguously in mData, mSparse maps an entity slot to its index in the packed arrays.
+// NOTE: adding/removing may move components, so don't keep references across those
+template<typename T>
+class ComponentArray
+{
+public:
+    static constexpr uint32_t INVALID_INDEX = 0xffffffff;
+private:
+    std::vector<uint32_t> mSparse;
+    std::vector<Entity_T> mEntities;
+    std::vector<T> mData;
+public:
+    ComponentArray() { }
+
+    // adds the component, or overwrites the existing one
+    T& insert(Entity_T entity, const T& component) {
+        uint32_t slot = getEntityIndex(entity);
+        if (slot >= mSparse.size()) {
+            mSparse.resize(slot + 1, INVALID_INDEX);
         }
-        return 0;
+        uint32_t index = mSparse[slot];
+        if (index != INVALID_INDEX) {
+            mEntities[index] = entity;
+            mData[index] = component;
+            return mData[index];
+        }
+        mSparse[slot] = (uint32_t)mData.size();
+        mEntities.push_back(entity);
+        mData.push_back(component);
+        return mData.back();
+    }
+
+    // swaps the last component into the hole to keep the arrays packed
+    void remove(Entity_T entity) {
+        if (!has(entity)) {
+            return;
+        }
+        uint32_t index = mSparse[getEntityIndex(entity)];
+        uint32_t last = (uint32_t)mData.size() - 1;
+        if (index != last) {
+            mData[index] = std::move(mData[last]);
+            mEntities[index] = mEntities[last];
+            mSparse[getEntityIndex(mEntities[index])] = index;
+        }
+        mData.pop_back();
+        mEntities.pop_back();
+        mSparse[getEntityIndex(entity)] = INVALID_INDEX;
+    }
+
+    // also fails for stale ids (the slot got reused by a newer entity)
+    bool has(Entity_T entity) const {
+        uint32_t slot = getEntityIndex(entity);
+        return slot < mSparse.size() && mSparse[slot] != INVALID_INDEX && mEntities[mSparse[slot]] == entity;
+    }
+
+    // packed index of the entity's component, or INVALID_INDEX
+    uint32_t indexOf(Entity_T entity) const {
+        return has(entity) ? mSparse[getEntityIndex(entity)] : INVALID_INDEX;
     }
+
+    T* find(Entity_T entity) {
+        return has(entity) ? &mData[mSparse[getEntityIndex(entity)]] : nullptr;
+    }
+
+    const T* find(Entity_T entity) const {
+        return has(entity) ? &mData[mSparse[getEntityIndex(entity)]] : nullptr;
+    }
+
+    T& get(Entity_T entity) {
+        assert(has(entity));
+        return mData[mSparse[getEntityIndex(entity)]];
+    }
+
+    void clear() {
+        mSparse.clear();
+        mEntities.clear();
+        mData.clear();
+    }
+
+    void reserve(size_t count) {
+        mEntities.reserve(count);
+        mData.reserve(count);
+    }
+
+    size_t size() const { return mData.size(); }
+    bool empty() const { return mData.empty(); }
+
+    // packed access, index goes from 0 to size() - 1
+    Entity_T getEntity(size_t index) const { return mEntities[index]; }
+    T& at(size_t index) { return mData[index]; }
+    const T& at(size_t index) const { return mData[index]; }
+
+    typename std::vector<T>::iterator begin() { return mData.begin(); }
+    typename std::vector<T>::iterator end() { return mData.end(); }
+    typename std::vector<T>::const_iterator begin() const { return mData.begin(); }
+    typename std::vector<T>::const_iterator end() const { return mData.end(); }
 };
 
 class EntitySystem
@@ -114,22 +230,74 @@ public:
     virtual ~EntitySystem() { }
 };
 
+const int ANIMATION_LOD_COUNT = 4;
+
+// Where skinned meshes get skinned
+enum class SkinningMode {
+    // in the vertex shader of every pass that draws them
+    VertexShader,
+    // once per frame by a compute shader, the passes then draw plain vertices
+    Compute,
+    // once per frame on the job system, for when there is no compute
+    CPU
+};
+
+// World::runComponentBenchmark() timings, milliseconds per pass over all the transforms
+struct ComponentBenchmarkResult {
+    double PackedMs;
+    double MapMs;
+};
+
+// World::runHierarchyBenchmark() timings, milliseconds
+struct HierarchyBenchmarkResult {
+    uint32_t EntityCount;
+    // flattening the trees into slots, as _rebuildHierarchy() does
+    double RebuildMs;
+    // the linear update of _updateWorldTransforms() with everything dirty, then with 1% of the entities moved
+    double FullUpdateMs;
+    double PartialUpdateMs;
+    // everything through the old recursive walk over the children with hash map lookups
+    double RecursiveMs;
+};
+
 class World
 {
 private:
     static World* sWorld;
 public:
-    std::unordered_map<Entity_T, glm::mat4> mWorldTransforms;
+    // packed in breadth-first hierarchy order, parents always come before their children
+    ComponentArray<glm::mat4> mWorldTransforms;
+    // parent slot in mWorldTransforms for each slot (-1 for root entities)
+    std::vector<int32_t> mHierarchyParents;
+    std::vector<uint8_t> mHierarchyDirty;
+    uint32_t mFirstDirtySlot;
+    bool mHierarchyChanged;
 public:
-    std::unordered_map<Entity_T, SceneEntity*> mEntityList;
-    std::unordered_map<Entity_T, TransformComponent> mTransformComponents;
-    std::unordered_map<Entity_T, MeshComponent> mMeshComponents;
-    std::unordered_map<Entity_T, InteractComponent> mInteractComponents;
-    std::unordered_map<Entity_T, BillboardComponent> mBillboardComponents;
-    std::unordered_map<Entity_T, PointLight*> mPointLightComponents;
-    std::unordered_map<Entity_T, AnimationComponent> mAnimationComponents;
+    // indexed by entity slot, nullptr for free slots
+    std::vector<SceneEntity*> mEntityList;
+    // ids of destroyed entities, their slots get reused with the next generation
+    std::vector<Entity_T> mFreeEntityIds;
+    uint32_t mEntityCount;
+    ComponentArray<TransformComponent> mTransformComponents;
+    ComponentArray<MeshComponent> mMeshComponents;
+    ComponentArray<InteractComponent> mInteractComponents;
+    ComponentArray<BillboardComponent> mBillboardComponents;
+    ComponentArray<PointLight*> mPointLightComponents;
+    ComponentArray<AnimationComponent> mAnimationComponents;
+    ComponentArray<CrowdComponent> mCrowdComponents;
     CameraEntity* mViewTarget;
     DirectionalLight* mSunLight;
+    // time spent in the last update() (milliseconds)
+    float mUpdateTime;
+    // world transforms recomputed in the last update()
+    int mTransformUpdateCount;
+    // skinned meshes to update this frame (kept around to save the allocations)
+    std::vector<SkeletonMesh*> mSkeletonUpdateList;
+    // how much of the screen height each of them covers (biggest of the entities sharing it)
+    std::vector<float> mSkeletonScreenSizes;
+    // skeletons at each animation LOD in the last update()
+    int mAnimationLODCounts[ANIMATION_LOD_COUNT];
+    SkinningMode mSkinningMode;
 public:
     World();
     virtual ~World();
@@ -140,6 +308,13 @@ public:
     SceneEntity* createEntity(const std::string& name, SceneEntity* parent);
     CameraEntity* createCamera(const std::string& name);
 
+    // destroys the entity along with its children and all of their components
+    void destroyEntity(SceneEntity* entity);
+
+    // nullptr if the entity has been destroyed
+    SceneEntity* getEntity(Entity_T id);
+    uint32_t getEntityCount() const { return mEntityCount; }
+
     void setViewTarget(CameraEntity* entity) {
         mViewTarget = entity;
     }
@@ -152,6 +327,12 @@ public:
     TransformComponent& getTransformComponent(SceneEntity* entity);
     bool hasTransformComponent(SceneEntity* entity);
 
+    // use these to move things around, so the world knows which transforms to recompute
+    void setPosition(SceneEntity* entity, const glm::vec3& pos);
+    void setOrientation(SceneEntity* entity, const glm::quat& qt);
+    void setScale(SceneEntity* entity, const glm::vec3& scale);
+    void markTransformDirty(SceneEntity* entity);
+
     InteractComponent& addInteractComponent(SceneEntity* entity, float distance);
     InteractComponent& getInteractComponent(SceneEntity* entity);
     bool hasInteractComponent(SceneEntity* entity);
@@ -168,10 +349,28 @@ public:
     AnimationComponent& getAnimationComponent(SceneEntity* entity);
     bool hasAnimationComponent(SceneEntity* entity);
 
+    // the mesh must have been baked with SkeletonMesh::bakeAnimations()
+    CrowdComponent& addCrowdComponent(SceneEntity* entity, SkeletonMesh* mesh, uint32_t clip, float timeOffset);
+    CrowdComponent& getCrowdComponent(SceneEntity* entity);
+    bool hasCrowdComponent(SceneEntity* entity);
+
     DirectionalLight* createSunLight(bool castShadow);
     virtual void update(float dt);
+
+    // composes count transforms stored packed (like the world does) and in an unordered_map keyed by
+    // entity (like it used to), passes times each. Doesn't touch the world's own entities
+    ComponentBenchmarkResult runComponentBenchmark(uint32_t count, uint32_t passes);
+
+    // builds count detached entities with transforms, half in deep chains and half in wide trees, and
+    // times the hierarchy updates on them. Doesn't touch the world's own entities
+    HierarchyBenchmarkResult runHierarchyBenchmark(uint32_t count);
 protected:
-    void _updateEntityWorldTransform(SceneEntity* entity, SceneEntity* parent);
+    Entity_T _allocateEntityId();
+    float _getScreenSize(Entity_T entity, const Mesh* mesh, const glm::vec3& viewPosition, float tanHalfFOV);
+    void _updateSkeletons(float dt);
+    void _registerEntity(SceneEntity* entity);
+    void _rebuildHierarchy();
+    void _updateWorldTransforms();
 };
 
 
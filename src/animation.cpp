@@ -3,21 +3,477 @@
 #include "renderer.h"
 #include "mesh.h"
 
-void SkeletonAnimation::applyToSkeleton(Skeleton* ske, float timeStamp, float weight) {
+#if defined(__SSE__)
+#include <xmmintrin.h>
+#endif
+
+// Keys gathered for the batched sampling. Every channel is a separate float array
+// (one lane per track) so the interpolation can run on four bones at once
+enum PoseSampleChannel
+{
+    POSE_POSITION_FROM = 0,         // x, y, z
+    POSE_POSITION_TO = 3,
+    POSE_POSITION_FACTOR = 6,
+    POSE_SCALE_FROM = 7,
+    POSE_SCALE_TO = 10,
+    POSE_SCALE_FACTOR = 13,
+    POSE_ROTATION_FROM = 14,        // x, y, z, w
+    POSE_ROTATION_TO = 18,
+    POSE_ROTATION_FACTOR = 22,
+    POSE_CHANNEL_COUNT = 23
+};
+
+// skeletons get updated on the job system, so every thread has its own
+static thread_local std::vector<float> tPoseSampleScratch;
+
+// a = mix(a, b, t) for count lanes (count is a multiple of 4)
+static void lerpLanes(float* a, const float* b, const float* t, uint32_t count) {
+#if defined(__SSE__)
+    for (uint32_t i = 0; i < count; i += 4) {
+        __m128 va = _mm_loadu_ps(a + i);
+        __m128 vb = _mm_loadu_ps(b + i);
+        __m128 vt = _mm_loadu_ps(t + i);
+        _mm_storeu_ps(a + i, _mm_add_ps(va, _mm_mul_ps(_mm_sub_ps(vb, va), vt)));
+    }
+#else
+    for (uint32_t i = 0; i < count; i++) {
+        a[i] = a[i] + (b[i] - a[i]) * t[i];
+    }
+#endif
+}
+
+// a = normalize(mix(a, b, t)) for count quaternion lanes, takes the shortest path like slerp
+static void nlerpLanes(float* a[4], float* const b[4], const float* t, uint32_t count) {
+#if defined(__SSE__)
+    const __m128 signMask = _mm_set1_ps(-0.0f);
+    const __m128 one = _mm_set1_ps(1.0f);
+    for (uint32_t i = 0; i < count; i += 4) {
+        __m128 ax = _mm_loadu_ps(a[0] + i);
+        __m128 ay = _mm_loadu_ps(a[1] + i);
+        __m128 az = _mm_loadu_ps(a[2] + i);
+        __m128 aw = _mm_loadu_ps(a[3] + i);
+        __m128 bx = _mm_loadu_ps(b[0] + i);
+        __m128 by = _mm_loadu_ps(b[1] + i);
+        __m128 bz = _mm_loadu_ps(b[2] + i);
+        __m128 bw = _mm_loadu_ps(b[3] + i);
+        __m128 vt = _mm_loadu_ps(t + i);
+
+        // flip b when it's on the other hemisphere
+        __m128 dot = _mm_add_ps(_mm_add_ps(_mm_mul_ps(ax, bx), _mm_mul_ps(ay, by)),
+            _mm_add_ps(_mm_mul_ps(az, bz), _mm_mul_ps(aw, bw)));
+        __m128 sign = _mm_and_ps(dot, signMask);
+        bx = _mm_xor_ps(bx, sign);
+        by = _mm_xor_ps(by, sign);
+        bz = _mm_xor_ps(bz, sign);
+        bw = _mm_xor_ps(bw, sign);
+
+        __m128 rx = _mm_add_ps(ax, _mm_mul_ps(_mm_sub_ps(bx, ax), vt));
+        __m128 ry = _mm_add_ps(ay, _mm_mul_ps(_mm_sub_ps(by, ay), vt));
+        __m128 rz = _mm_add_ps(az, _mm_mul_ps(_mm_sub_ps(bz, az), vt));
+        __m128 rw = _mm_add_ps(aw, _mm_mul_ps(_mm_sub_ps(bw, aw), vt));
+
+        __m128 length2 = _mm_add_ps(_mm_add_ps(_mm_mul_ps(rx, rx), _mm_mul_ps(ry, ry)),
+            _mm_add_ps(_mm_mul_ps(rz, rz), _mm_mul_ps(rw, rw)));
+        __m128 invLength = _mm_div_ps(one, _mm_sqrt_ps(length2));
+
+        _mm_storeu_ps(a[0] + i, _mm_mul_ps(rx, invLength));
+        _mm_storeu_ps(a[1] + i, _mm_mul_ps(ry, invLength));
+        _mm_storeu_ps(a[2] + i, _mm_mul_ps(rz, invLength));
+        _mm_storeu_ps(a[3] + i, _mm_mul_ps(rw, invLength));
+    }
+#else
+    for (uint32_t i = 0; i < count; i++) {
+        float dot = a[0][i] * b[0][i] + a[1][i] * b[1][i] + a[2][i] * b[2][i] + a[3][i] * b[3][i];
+        float sign = dot < 0.0f ? -1.0f : 1.0f;
+        float r[4];
+        float length2 = 0.0f;
+        for (int c = 0; c < 4; c++) {
+            r[c] = a[c][i] + (b[c][i] * sign - a[c][i]) * t[i];
+            length2 += r[c] * r[c];
+        }
+        float invLength = 1.0f / sqrtf(length2);
+        for (int c = 0; c < 4; c++) {
+            a[c][i] = r[c] * invLength;
+        }
+    }
+#endif
+}
+
+static const float QUAT_COMPONENT_RANGE = 0.70710678f;   // 1 / sqrt(2)
+
+static PackedVec3 packVec3(const glm::vec3& v, const glm::vec3& min, const glm::vec3& extent) {
+    PackedVec3 packed;
+    for (int c = 0; c < 3; c++) {
+        float t = extent[c] > 0.0f ? (v[c] - min[c]) / extent[c] : 0.0f;
+        packed.Data[c] = (uint16_t)(glm::clamp(t, 0.0f, 1.0f) * 65535.0f + 0.5f);
+    }
+    return packed;
+}
+
+static glm::vec3 unpackVec3(const PackedVec3& packed, const glm::vec3& min, const glm::vec3& extent) {
+    return glm::vec3(min.x + packed.Data[0] * (1.0f / 65535.0f) * extent.x,
+        min.y + packed.Data[1] * (1.0f / 65535.0f) * extent.y,
+        min.z + packed.Data[2] * (1.0f / 65535.0f) * extent.z);
+}
+
+// bits 0-1: index of the dropped component, then 15 bits for each of the other three
+static PackedQuat packQuat(const glm::quat& q) {
+    float c[4] = { q.x, q.y, q.z, q.w };
+    int largest = 0;
+    for (int i = 1; i < 4; i++) {
+        if (fabsf(c[i]) > fabsf(c[largest])) {
+            largest = i;
+        }
+    }
+    // q and -q are the same rotation, keep the dropped one positive
+    float sign = c[largest] < 0.0f ? -1.0f : 1.0f;
+
+    uint64_t bits = (uint64_t)largest;
+    int shift = 2;
+    for (int i = 0; i < 4; i++) {
+        if (i == largest) {
+            continue;
+        }
+        float t = (c[i] * sign / QUAT_COMPONENT_RANGE) * 0.5f + 0.5f;
+        uint64_t value = (uint64_t)(glm::clamp(t, 0.0f, 1.0f) * 32767.0f + 0.5f);
+        bits |= value << shift;
+        shift += 15;
+    }
+
+    PackedQuat packed;
+    packed.Data[0] = (uint16_t)(bits & 0xffff);
+    packed.Data[1] = (uint16_t)((bits >> 16) & 0xffff);
+    packed.Data[2] = (uint16_t)((bits >> 32) & 0xffff);
+    return packed;
+}
+
+static glm::quat unpackQuat(const PackedQuat& packed) {
+    uint64_t bits = (uint64_t)packed.Data[0] | ((uint64_t)packed.Data[1] << 16) | ((uint64_t)packed.Data[2] << 32);
+    int largest = (int)(bits & 3);
+
+    float c[4];
+    float sum = 0.0f;
+    int shift = 2;
+    for (int i = 0; i < 4; i++) {
+        if (i == largest) {
+            continue;
+        }
+        float t = (float)((bits >> shift) & 0x7fff) * (1.0f / 32767.0f);
+        c[i] = (t * 2.0f - 1.0f) * QUAT_COMPONENT_RANGE;
+        sum += c[i] * c[i];
+        shift += 15;
+    }
+    c[largest] = sqrtf(std::max(0.0f, 1.0f - sum));
+    return glm::quat(c[3], c[0], c[1], c[2]);
+}
+
+// angle between two rotations (atan2 of the relative rotation, acos loses
+// too much precision for the tiny angles we care about here)
+static float rotationError(const glm::quat& a, const glm::quat& b) {
+    glm::quat delta = glm::conjugate(a) * b;
+    float sine = sqrtf(delta.x * delta.x + delta.y * delta.y + delta.z * delta.z);
+    return 2.0f * atan2f(sine, fabsf(delta.w));
+}
+
+static glm::quat nlerp(const glm::quat& a, const glm::quat& b, float t) {
+    glm::quat to = glm::dot(a, b) < 0.0f ? -b : b;
+    return glm::normalize(a * (1.0f - t) + to * t);
+}
+
+// Greedy key reduction, walks forward from the last kept key and keeps a key once
+// interpolating over it would miss one of the keys in between by more than tolerance.
+// getError(from, to, i) is the error at key i when interpolating from -> to
+template<typename GetError>
+static void reduceKeys(uint32_t keyCount, float tolerance, GetError getError, std::vector<uint32_t>& kept) {
+    kept.clear();
+    if (keyCount == 0) {
+        return;
+    }
+    kept.push_back(0);
+    uint32_t last = 0;
+    for (uint32_t next = 2; next < keyCount; next++) {
+        for (uint32_t i = last + 1; i < next; i++) {
+            if (getError(last, next, i) > tolerance) {
+                last = next - 1;
+                kept.push_back(last);
+                break;
+            }
+        }
+    }
+    if (keyCount > 1) {
+        kept.push_back(keyCount - 1);
+    }
+}
+
+static float segmentFactor(float from, float to, float time) {
+    return to > from ? (time - from) / (to - from) : 0.0f;
+}
+
+void BoneAnimationTrack::compress(AnimationCompressionStats& stats) {
+    std::vector<uint32_t> kept;
+
+    const uint32_t rawKeyCount = (uint32_t)(mRawPositions.size() + mRawRotations.size() + mRawScales.size());
+    stats.RawKeyCount += rawKeyCount;
+    stats.RawSize += mRawPositions.size() * sizeof(KeyPosition) + mRawRotations.size() * sizeof(KeyRotation)
+        + mRawScales.size() * sizeof(KeyScale);
+
+    // positions
+    {
+        const std::vector<KeyPosition>& raw = mRawPositions;
+        reduceKeys((uint32_t)raw.size(), ANIM_POSITION_TOLERANCE, [&raw](uint32_t from, uint32_t to, uint32_t i) {
+            float t = segmentFactor(raw[from].timeStamp, raw[to].timeStamp, raw[i].timeStamp);
+            return glm::distance(glm::mix(raw[from].position, raw[to].position, t), raw[i].position);
+        }, kept);
+        if (kept.size() == 2 && glm::distance(raw[kept[0]].position, raw[kept[1]].position) <= ANIM_POSITION_TOLERANCE) {
+            kept.pop_back();
+        }
+
+        glm::vec3 min(0.0f), max(0.0f);
+        for (size_t i = 0; i < kept.size(); i++) {
+            const glm::vec3& v = raw[kept[i]].position;
+            min = (i == 0) ? v : glm::min(min, v);
+            max = (i == 0) ? v : glm::max(max, v);
+        }
+        mPositionMin = min;
+        mPositionExtent = max - min;
+
+        mPositionTimes.resize(kept.size());
+        mPositions.resize(kept.size());
+        for (size_t i = 0; i < kept.size(); i++) {
+            mPositionTimes[i] = raw[kept[i]].timeStamp;
+            mPositions[i] = packVec3(raw[kept[i]].position, mPositionMin, mPositionExtent);
+        }
+    }
+
+    // rotations
+    {
+        const std::vector<KeyRotation>& raw = mRawRotations;
+        reduceKeys((uint32_t)raw.size(), ANIM_ROTATION_TOLERANCE, [&raw](uint32_t from, uint32_t to, uint32_t i) {
+            float t = segmentFactor(raw[from].timeStamp, raw[to].timeStamp, raw[i].timeStamp);
+            return rotationError(nlerp(raw[from].orientation, raw[to].orientation, t), raw[i].orientation);
+        }, kept);
+        if (kept.size() == 2 && rotationError(raw[kept[0]].orientation, raw[kept[1]].orientation) <= ANIM_ROTATION_TOLERANCE) {
+            kept.pop_back();
+        }
+
+        mRotationTimes.resize(kept.size());
+        mRotations.resize(kept.size());
+        for (size_t i = 0; i < kept.size(); i++) {
+            mRotationTimes[i] = raw[kept[i]].timeStamp;
+            mRotations[i] = packQuat(glm::normalize(raw[kept[i]].orientation));
+        }
+    }
+
+    // scales
+    {
+        const std::vector<KeyScale>& raw = mRawScales;
+        reduceKeys((uint32_t)raw.size(), ANIM_SCALE_TOLERANCE, [&raw](uint32_t from, uint32_t to, uint32_t i) {
+            float t = segmentFactor(raw[from].timeStamp, raw[to].timeStamp, raw[i].timeStamp);
+            return glm::distance(glm::mix(raw[from].scale, raw[to].scale, t), raw[i].scale);
+        }, kept);
+        if (kept.size() == 2 && glm::distance(raw[kept[0]].scale, raw[kept[1]].scale) <= ANIM_SCALE_TOLERANCE) {
+            kept.pop_back();
+        }
+
+        glm::vec3 min(0.0f), max(0.0f);
+        for (size_t i = 0; i < kept.size(); i++) {
+            const glm::vec3& v = raw[kept[i]].scale;
+            min = (i == 0) ? v : glm::min(min, v);
+            max = (i == 0) ? v : glm::max(max, v);
+        }
+        mScaleMin = min;
+        mScaleExtent = max - min;
+
+        mScaleTimes.resize(kept.size());
+        mScales.resize(kept.size());
+        for (size_t i = 0; i < kept.size(); i++) {
+            mScaleTimes[i] = raw[kept[i]].timeStamp;
+            mScales[i] = packVec3(raw[kept[i]].scale, mScaleMin, mScaleExtent);
+        }
+    }
+
+    stats.KeyCount += (uint32_t)(mPositions.size() + mRotations.size() + mScales.size());
+    stats.CompressedSize += (mPositionTimes.size() + mRotationTimes.size() + mScaleTimes.size()) * sizeof(float)
+        + (mPositions.size() + mScales.size()) * sizeof(PackedVec3) + mRotations.size() * sizeof(PackedQuat)
+        + 4 * sizeof(glm::vec3);
+
+    // measure what we lost by sampling the compressed track at every original key
+    TrackCursor cursor;
+    for(auto it = mRawPositions.begin();it != mRawPositions.end();++it) {
+        glm::vec3 value = getPosition(0);
+        if (mPositions.size() > 1) {
+            int p0Index = GetPositionIndex(it->timeStamp, cursor.Position);
+            float t = GetScaleFactor(mPositionTimes[p0Index], mPositionTimes[p0Index + 1], it->timeStamp);
+            value = glm::mix(getPosition(p0Index), getPosition(p0Index + 1), t);
+        }
+        stats.MaxPositionError = std::max(stats.MaxPositionError, glm::distance(value, it->position));
+    }
+    for(auto it = mRawRotations.begin();it != mRawRotations.end();++it) {
+        glm::quat value = getRotation(0);
+        if (mRotations.size() > 1) {
+            int p0Index = GetRotationIndex(it->timeStamp, cursor.Rotation);
+            float t = GetScaleFactor(mRotationTimes[p0Index], mRotationTimes[p0Index + 1], it->timeStamp);
+            value = nlerp(getRotation(p0Index), getRotation(p0Index + 1), t);
+        }
+        stats.MaxRotationError = std::max(stats.MaxRotationError, rotationError(value, glm::normalize(it->orientation)));
+    }
+    for(auto it = mRawScales.begin();it != mRawScales.end();++it) {
+        glm::vec3 value = getScale(0);
+        if (mScales.size() > 1) {
+            int p0Index = GetScaleIndex(it->timeStamp, cursor.Scale);
+            float t = GetScaleFactor(mScaleTimes[p0Index], mScaleTimes[p0Index + 1], it->timeStamp);
+            value = glm::mix(getScale(p0Index), getScale(p0Index + 1), t);
+        }
+        stats.MaxScaleError = std::max(stats.MaxScaleError, glm::distance(value, it->scale));
+    }
+
+    std::vector<KeyPosition>().swap(mRawPositions);
+    std::vector<KeyRotation>().swap(mRawRotations);
+    std::vector<KeyScale>().swap(mRawScales);
+}
+
+glm::vec3 BoneAnimationTrack::getPosition(uint32_t index) const {
+    return unpackVec3(mPositions[index], mPositionMin, mPositionExtent);
+}
+
+glm::quat BoneAnimationTrack::getRotation(uint32_t index) const {
+    return unpackQuat(mRotations[index]);
+}
+
+glm::vec3 BoneAnimationTrack::getScale(uint32_t index) const {
+    return unpackVec3(mScales[index], mScaleMin, mScaleExtent);
+}
+
+void SkeletonAnimation::bindTracks() {
+    mTracks.clear();
+    mTrackBones.clear();
     for(auto it = mAnimationTrackList.begin();it != mAnimationTrackList.end();++it) {
-        Bone* bone = it->first;
-        BoneAnimationTrack* track = it->second;
+        mTracks.push_back(it->second);
+    }
+    std::sort(mTracks.begin(), mTracks.end(), [](const BoneAnimationTrack* a, const BoneAnimationTrack* b) {
+        return a->mBone->mIndex < b->mBone->mIndex;
+    });
+    for(auto it = mTracks.begin();it != mTracks.end();++it) {
+        mTrackBones.push_back((*it)->mBone->mIndex);
+    }
+}
+
+void SkeletonAnimation::samplePose(float timeStamp, std::vector<TrackCursor>& cursors, BonePose* pose, uint32_t boneCount) {
+    assert(mTracks.size() == mAnimationTrackList.size());
+    cursors.resize(mTracks.size());
+
+    // in bone order, so the tracks the LOD skips are all at the end
+    const uint32_t trackCount = (uint32_t)(std::lower_bound(mTrackBones.begin(), mTrackBones.end(), boneCount) - mTrackBones.begin());
+    if (trackCount == 0) {
+        return;
+    }
+
+    // round up to whole SIMD lanes, the padding gets interpolated too but never read back
+    const uint32_t laneCount = (trackCount + 3) & ~3u;
+    std::vector<float>& scratch = tPoseSampleScratch;
+    if (scratch.size() < laneCount * POSE_CHANNEL_COUNT) {
+        scratch.resize(laneCount * POSE_CHANNEL_COUNT);
+    }
+    float* channel[POSE_CHANNEL_COUNT];
+    for (int c = 0; c < POSE_CHANNEL_COUNT; c++) {
+        channel[c] = &scratch[c * laneCount];
+    }
+
+    // gather the two keys around timeStamp for every track
+    for (uint32_t lane = 0; lane < trackCount; lane++) {
+        BoneAnimationTrack* track = mTracks[lane];
+        TrackCursor& cursor = cursors[lane];
+        const BonePose& current = pose[mTrackBones[lane]];
 
-        glm::mat4 translation = track->InterpolatePosition(timeStamp);
-        glm::mat4 rotation = track->InterpolateRotation(timeStamp);
-        glm::mat4 scale = track->InterpolateScaling(timeStamp);
+        glm::vec3 positionFrom = current.Position;
+        glm::vec3 positionTo = current.Position;
+        float positionFactor = 0.0f;
+        if (track->mPositions.size() > 1) {
+            int p0Index = track->GetPositionIndex(timeStamp, cursor.Position);
+            positionFrom = track->getPosition(p0Index);
+            positionTo = track->getPosition(p0Index + 1);
+            positionFactor = track->GetScaleFactor(track->mPositionTimes[p0Index],
+                track->mPositionTimes[p0Index + 1], timeStamp);
+        } else if (track->mPositions.size() == 1) {
+            positionFrom = positionTo = track->getPosition(0);
+        }
+
+        glm::vec3 scaleFrom = current.Scale;
+        glm::vec3 scaleTo = current.Scale;
+        float scaleFactor = 0.0f;
+        if (track->mScales.size() > 1) {
+            int p0Index = track->GetScaleIndex(timeStamp, cursor.Scale);
+            scaleFrom = track->getScale(p0Index);
+            scaleTo = track->getScale(p0Index + 1);
+            scaleFactor = track->GetScaleFactor(track->mScaleTimes[p0Index],
+                track->mScaleTimes[p0Index + 1], timeStamp);
+        } else if (track->mScales.size() == 1) {
+            scaleFrom = scaleTo = track->getScale(0);
+        }
+
+        glm::quat rotationFrom = current.Rotation;
+        glm::quat rotationTo = current.Rotation;
+        float rotationFactor = 0.0f;
+        if (track->mRotations.size() > 1) {
+            int p0Index = track->GetRotationIndex(timeStamp, cursor.Rotation);
+            rotationFrom = track->getRotation(p0Index);
+            rotationTo = track->getRotation(p0Index + 1);
+            rotationFactor = track->GetScaleFactor(track->mRotationTimes[p0Index],
+                track->mRotationTimes[p0Index + 1], timeStamp);
+        } else if (track->mRotations.size() == 1) {
+            rotationFrom = rotationTo = track->getRotation(0);
+        }
+
+        for (int c = 0; c < 3; c++) {
+            channel[POSE_POSITION_FROM + c][lane] = positionFrom[c];
+            channel[POSE_POSITION_TO + c][lane] = positionTo[c];
+            channel[POSE_SCALE_FROM + c][lane] = scaleFrom[c];
+            channel[POSE_SCALE_TO + c][lane] = scaleTo[c];
+        }
+        channel[POSE_POSITION_FACTOR][lane] = positionFactor;
+        channel[POSE_SCALE_FACTOR][lane] = scaleFactor;
+
+        channel[POSE_ROTATION_FROM + 0][lane] = rotationFrom.x;
+        channel[POSE_ROTATION_FROM + 1][lane] = rotationFrom.y;
+        channel[POSE_ROTATION_FROM + 2][lane] = rotationFrom.z;
+        channel[POSE_ROTATION_FROM + 3][lane] = rotationFrom.w;
+        channel[POSE_ROTATION_TO + 0][lane] = rotationTo.x;
+        channel[POSE_ROTATION_TO + 1][lane] = rotationTo.y;
+        channel[POSE_ROTATION_TO + 2][lane] = rotationTo.z;
+        channel[POSE_ROTATION_TO + 3][lane] = rotationTo.w;
+        channel[POSE_ROTATION_FACTOR][lane] = rotationFactor;
+    }
+    // identity in the padding lanes so the normalize doesn't divide by zero
+    for (uint32_t lane = trackCount; lane < laneCount; lane++) {
+        for (int c = 0; c < POSE_CHANNEL_COUNT; c++) {
+            channel[c][lane] = 0.0f;
+        }
+        channel[POSE_ROTATION_FROM + 3][lane] = 1.0f;
+        channel[POSE_ROTATION_TO + 3][lane] = 1.0f;
+    }
+
+    // interpolate all the tracks at once, results end up in the FROM channels
+    for (int c = 0; c < 3; c++) {
+        lerpLanes(channel[POSE_POSITION_FROM + c], channel[POSE_POSITION_TO + c], channel[POSE_POSITION_FACTOR], laneCount);
+        lerpLanes(channel[POSE_SCALE_FROM + c], channel[POSE_SCALE_TO + c], channel[POSE_SCALE_FACTOR], laneCount);
+    }
+    nlerpLanes(&channel[POSE_ROTATION_FROM], &channel[POSE_ROTATION_TO], channel[POSE_ROTATION_FACTOR], laneCount);
 
-        bone->setLocalTransform(translation * rotation * scale);
+    // scatter back into the pose
+    for (uint32_t lane = 0; lane < trackCount; lane++) {
+        BonePose& bonePose = pose[mTrackBones[lane]];
+        bonePose.Position = glm::vec3(channel[POSE_POSITION_FROM + 0][lane],
+            channel[POSE_POSITION_FROM + 1][lane], channel[POSE_POSITION_FROM + 2][lane]);
+        bonePose.Scale = glm::vec3(channel[POSE_SCALE_FROM + 0][lane],
+            channel[POSE_SCALE_FROM + 1][lane], channel[POSE_SCALE_FROM + 2][lane]);
+        bonePose.Rotation = glm::quat(channel[POSE_ROTATION_FROM + 3][lane], channel[POSE_ROTATION_FROM + 0][lane],
+            channel[POSE_ROTATION_FROM + 1][lane], channel[POSE_ROTATION_FROM + 2][lane]);
     }
 }
 
 AnimationState::AnimationState(const std::string& name, float length)
-    : mName(name), mLength(length), mSpeed(1000), mTime(0), mLoop(false) {
+    : mName(name), mLength(length), mSpeed(1000), mTime(0), mLoop(false), mAnimation(nullptr),
+    mWeight(0), mTargetWeight(0), mFadeSpeed(0) {
 
 }
 
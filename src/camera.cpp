@@ -10,6 +10,10 @@ CameraEntity::CameraEntity(const std::string& name, Entity_T id, const glm::vec3
     mShakeOffset(0), mNear(1.0f), mFar(5000.0f), mFOV(60.0f) {
 }
 
+TransformComponent& CameraEntity::getTransform() {
+    return World::get()->getTransformComponent(this);
+}
+
 void CameraEntity::updateProjection(float width, float height) {
     mAspect = float(width) / float(height);
     mProjection = glm::perspective(glm::radians(mFOV), mAspect, mNear, mFar);
@@ -27,7 +31,7 @@ void CameraEntity::update(float dt) {
     mRight = glm::normalize(glm::cross(mDirection, mWorldUp));  // normalize the vectors, because their length gets closer to 0 the more you look up or down which results in slower movement.
     mUp    = glm::normalize(glm::cross(mRight, mDirection));
 
-    mTransform->Orientation = glm::normalize(glm::quatLookAt(mDirection, mUp));
+    World::get()->setOrientation(this, glm::normalize(glm::quatLookAt(mDirection, mUp)));
     //mView = glm::lookAt(mPosition, mPosition + mDirection, mUp);
 }
 
@@ -3,11 +3,12 @@
 #include "renderer.h"
 #include "glsystem.h"
 #include "world.h"
+#include "jobsystem.h"
 
 Engine* Engine::sEngine = nullptr;
 
 Engine::Engine(GLFWwindow* windowHandle)
-    : mWindowHandle(windowHandle), mRenderer(nullptr), mResourceManager(nullptr), mWorld(nullptr) {
+    : mWindowHandle(windowHandle), mRenderer(nullptr), mResourceManager(nullptr), mWorld(nullptr), mJobSystem(nullptr) {
     if (Engine::sEngine != nullptr) {
         assert(0);
     }
@@ -22,6 +23,8 @@ Engine::~Engine() {
         delete mResourceManager;
     if (mRenderer)
         delete mRenderer;
+    if (mJobSystem)
+        delete mJobSystem;
 }
 
 bool Engine::init(enum RenderingSystem system) {
@@ -35,6 +38,7 @@ bool Engine::init(enum RenderingSystem system) {
         printf("Error: Failed to initialize Rendering System (%d)\n", system);
         return false;
     }
+    mJobSystem = new JobSystem();
     mResourceManager = new ResourceManager();
     mWorld = new World();
     return true;
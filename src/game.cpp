@@ -32,6 +32,31 @@ Game::Game(GLFWwindow* window)
     Game::sStatic = this;
 
     mMissionComplete = false;
+    mPreSkinnedVertexCount = 0;
+    mRenderQueueDraws = 0;
+    mRenderQueueBinds = 0;
+    mRenderQueueBindsSaved = 0;
+    mStaticGeometry = nullptr;
+    mUseIndirectDraws = true;
+    mIndirectDraws = 0;
+    mIndirectCalls = 0;
+    mLightsKept = 0;
+    mLightsCulled = 0;
+    mPointShadowBudget = 2;
+    mPointShadowsStale = 0;
+    mPointShadowsRedrawn = 0;
+    mPointShadowsCached = 0;
+    mFrameIndex = 0;
+    mAnimationTime = 0.0;
+    mActiveCascadeMask = ALL_CASCADES_MASK;
+    mCacheStaticShadows = true;
+    for (int c = 0; c < MAX_CSSM_SPLITS; c++) {
+        mStaticShadowValid[c] = false;
+    }
+    mShadowSunDirection = glm::vec3(0, 0, 0);
+    mShadowTexelsRedrawn = 0;
+    mShadowFullMs = 0;
+    mShadowCachedMs = 0;
 }
 
 Game::~Game() {
@@ -41,6 +66,7 @@ Game::~Game() {
     delete mPlayerCharacter;
 
     delete mCollisionMgr;
+    delete mStaticGeometry;
 
     if (mEngine)
         delete mEngine;
@@ -49,7 +75,7 @@ Game::~Game() {
 bool Game::loadResources() {
     std::cout << "Loading shaders..." << std::endl;
     depthProgram = mResourceMgr->loadShaders("shaders/glsl/depth.vert", "shaders/glsl/depth.frag");
-    shadowDepthProgram = mResourceMgr->loadShaders("shaders/glsl/shadow_depth.vert", "shaders/glsl/shadow_depth.frag");
+    shadowDepthProgram = mResourceMgr->loadShaders("shaders/glsl/shadow_depth.vert", "shaders/glsl/shadow_depth.frag", "shaders/glsl/shadow_depth.geom");
     shadowCubeDepthProgram = mResourceMgr->loadShaders("shaders/glsl/depth_cube.vert", "shaders/glsl/depth_cube.frag", "shaders/glsl/depth_cube.geom");
     lightProgram = mResourceMgr->loadShaders("shaders/glsl/lighting.vert", "shaders/glsl/lighting.frag");
     blurProgram = mResourceMgr->loadShaders("shaders/glsl/blurpass.vert", "shaders/glsl/blurpass.frag");
@@ -59,6 +85,7 @@ bool Game::loadResources() {
     projectileProgram = mResourceMgr->loadShaders("shaders/glsl/projectile.vert", "shaders/glsl/projectile.frag");
     fxProgram = mResourceMgr->loadShaders("shaders/glsl/fx.vert", "shaders/glsl/fx.frag");
     skyProgram = mResourceMgr->loadShaders("shaders/glsl/skybox.vert", "shaders/glsl/skybox.frag");
+    skinningProgram = mResourceMgr->loadComputeShader("shaders/glsl/skinning.comp");
     //sunProgram = mResourceMgr->loadShaders("shaders/glsl/sun.vert", "shaders/glsl/sun.frag", "shaders/glsl/sun.geom");
 
     std::cout << "Loading level..." << std::endl;
@@ -67,8 +94,10 @@ bool Game::loadResources() {
     mDumpsterMesh = mResourceMgr->loadMesh("dumpster.obj", "dumpster", true);
     mDumpsterLidMesh = mResourceMgr->loadMesh("dumpster_lid.obj", "dumpster_lid", true);
 */
-    mLevelMesh = mResourceMgr->loadMesh("plane.obj", "area_02", true);
-    mPlayerMesh = mResourceMgr->loadSkeletonMesh("fps_animations_fn_502_tactical/scene.gltf", "fps_hand");
+    // the level goes into the static geometry, keep its vertices around for that
+    mLevelMesh = mResourceMgr->loadMesh("plane.obj", "area_02", true, true);
+    // the hands are the only skinned asset, the crowds of the map reuse them
+    mPlayerMesh = mResourceMgr->loadSkeletonMesh("fps_animations_fn_502_tactical/scene.gltf", "fps_hand", true, CROWD_BAKE_FRAME_RATE);
     //mDemonMesh = mResourceMgr->loadMesh("crate.obj", "demon");
 /*
     mDoorInteractTex = mResourceMgr->loadTexture("textures/interact_door.png", true);
@@ -113,8 +142,7 @@ bool Game::init() {
 
     mCamera = mWorld->createCamera("PrimaryCamera");
     glm::quat qt = glm::quat(glm::vec3(0, 0, 0));
-    mCameraTransform = &mWorld->addTransformComponent(mCamera, {0, 30, 0}, qt, {1, 1, 1});
-    mCamera->mTransform = mCameraTransform;
+    mWorld->addTransformComponent(mCamera, {0, 30, 0}, qt, {1, 1, 1});
 
     mWorld->setViewTarget(mCamera);
 
@@ -136,6 +164,8 @@ bool Game::init() {
     // load the map
     loadMap("plane.map");
 
+    _buildStaticGeometry();
+
     // buffers for screen quad
     mScreenQuad = mRend->createQuadBufferIndexed();
     mHUDQuad = mRend->createQuadBufferIndexed();
@@ -259,12 +289,20 @@ bool Game::init() {
     }
 
     mCBPerFrame = mRend->createGPUConstantBuffer(sizeof(cbPerFrame));
-    mCBPerObject = mRend->createGPUConstantBuffer(sizeof(cbPerObject));
-    mCBPerAnimatedObject = mRend->createGPUConstantBuffer(sizeof(cbPerAnimatedObject));
-    mCBLightArray = mRend->createGPUConstantBuffer(sizeof(cbLightArray));
+    // one block per draw, a frame rarely goes over a few thousand
+    mCBPerObject = mRend->createGPUConstantRingBuffer(sizeof(cbPerObject), 8192);
+    mBonePaletteBuffer = mRend->createGPUStorageBuffer(sizeof(glm::mat4) * MAX_BONES * 4);
+    mCBSkinning = mRend->createGPUConstantBuffer(sizeof(cbSkinning));
+    // crowd buffers grow on their first upload
+    mBakedFrameBuffer = mRend->createGPUStorageBuffer(sizeof(glm::mat4));
+    mBakedClipBuffer = mRend->createGPUStorageBuffer(sizeof(sbBakedClip));
+    mCrowdInstanceBuffer = mRend->createGPUStorageBuffer(sizeof(sbCrowdInstance) * 64);
+    mShadowTimer = mRend->createGPUTimer();
+    mLightBuffer = mRend->createGPUStorageBuffer(sizeof(cbPointLight) * 64);
+    mClusterBuffer = mRend->createGPUStorageBuffer(sizeof(sbLightCluster) * CLUSTER_COUNT);
+    mClusterLightIndexBuffer = mRend->createGPUStorageBuffer(sizeof(uint32_t) * CLUSTER_COUNT);
     mCBPostProcess = mRend->createGPUConstantBuffer(sizeof(cbPostProcess));
     mCBCascadedShadow = mRend->createGPUConstantBuffer(sizeof(cbCascadedShadow));
-    mCBCascadedShadowProj = mRend->createGPUConstantBuffer(sizeof(cbCascadedShadowProj));
     mCBShadowCube = mRend->createGPUConstantBuffer(sizeof(cbShadowCube));
 
     mPerFrameData.enableSSAO = 1;
@@ -287,6 +325,7 @@ bool Game::init() {
     mPerFrameData.fogDensity = 0.001f;
     mPerFrameData.metallic = 0.0f;
     mPerFrameData.roughness = 0.0f;
+    mPerFrameData.animationTime = 0.0f;
 
     const uint32_t numSamples = 32;
 
@@ -356,22 +395,16 @@ void Game::initFrameBuffers() {
 
     depthFBO = mRend->createFrameBufferObject(smDesc);
 
-    // Shadow Map/Depth Buffer
-    smDesc.Flags = FRAME_BUFFER_FLAG_SHADOW;
+    // Shadow Map/Depth Buffer, the layers of an array share one size
+    smDesc.Flags = FRAME_BUFFER_FLAG_SHADOW_ARRAY;
     smDesc.FilterType = TextureFilterType::LinearFilter;
     smDesc.NumRenderTarget = 0;
+    smDesc.Layers = MAX_CSSM_SPLITS;
 
-    smDesc.Width = 4096;
-    smDesc.Height = 4096;
-    mCascadedFBOSplit1 = mRend->createFrameBufferObject(smDesc);
-
-    smDesc.Width = 3048;
-    smDesc.Height = 3048;
-    mCascadedFBOSplit2 = mRend->createFrameBufferObject(smDesc);
-
-    smDesc.Width = 4096;
-    smDesc.Height = 4096;
-    mCascadedFBOSplit3 = mRend->createFrameBufferObject(smDesc);
+    smDesc.Width = CASCADE_SHADOW_MAP_SIZE;
+    smDesc.Height = CASCADE_SHADOW_MAP_SIZE;
+    mCascadedShadowFBO = mRend->createFrameBufferObject(smDesc);
+    mStaticShadowCacheFBO = mRend->createFrameBufferObject(smDesc);
 
     // Primary Buffer
     FrameBufferDesc pDesc;
@@ -429,6 +462,20 @@ void Game::initPhysicsEngine() {
     mCollisionMgr = new CollisionManager();
 }
 
+void Game::_buildStaticGeometry() {
+    mStaticGeometry = new StaticGeometry();
+
+    // the level never moves and has no transform of its own
+    mStaticGeometry->addMesh(mLevelMesh, glm::mat4(1.0f));
+    mStaticGeometry->build(mRend);
+
+    // worst case every draw survives culling
+    const uint32_t maxCommands = std::max((uint32_t)mStaticGeometry->mDraws.size(), 1u);
+    mIndirectBuffer = mRend->createGPUStorageBuffer(sizeof(DrawIndirectCommand) * maxCommands);
+
+    mWorld->getMeshComponent(mLevelEntity).mStaticBatched = true;
+}
+
 void Game::initDynamicObjects() {
     // Setup entities
 
@@ -453,6 +500,31 @@ void Game::initDynamicObjects() {
     //mEnemyCharacterList.push_back(demon);
 }
 
+// count members on a square grid around center, each one playing a baked clip of the player mesh
+void Game::spawnCrowd(const glm::vec3& center, int count) {
+    const uint32_t clipCount = (uint32_t)mPlayerMesh->mBakedClips.size();
+    if (clipCount == 0) {
+        printf("Crowd mesh %s has no baked animations\n", mPlayerMesh->getName().c_str());
+        return;
+    }
+
+    const int side = (int)std::ceil(std::sqrt((float)count));
+    const float spacing = 40.0f;
+    const glm::quat qt = glm::quat(glm::vec3(0, glm::radians(180.0f), 0));
+
+    for (int i = 0; i < count; i++) {
+        SceneEntity* member = mWorld->createEntity("crowd_" + std::to_string(i));
+
+        glm::vec3 pos = center;
+        pos.x += (i % side - (side - 1) * 0.5f) * spacing;
+        pos.z += (i / side - (side - 1) * 0.5f) * spacing;
+        mWorld->addTransformComponent(member, pos, qt, {30, 30, 30});
+
+        // spread the clips and phases so the members don't move in lockstep
+        mWorld->addCrowdComponent(member, mPlayerMesh, i % clipCount, i * 0.37f);
+    }
+}
+
 float cameraTime = 0;
 
 void Game::update(float dt) {
@@ -466,6 +538,8 @@ void Game::update(float dt) {
     mSunLight->update(dt);
     mWorld->update(dt);
 
+    mAnimationTime = fmod(mAnimationTime + dt, ANIMATION_TIME_WRAP);
+
     btTransform trans = mPlayerCharacter->getGhostObject()->getWorldTransform();
 
     btVector3 vel = mPlayerCharacter->getController()->getLinearVelocity();
@@ -477,7 +551,7 @@ void Game::update(float dt) {
 
     glm::vec3 playerPos(float(trans.getOrigin().getX()), float(trans.getOrigin().getY()) + 35 + offset_factor, float(trans.getOrigin().getZ()));
 
-    mCameraTransform->Position = playerPos;
+    mWorld->setPosition(mCamera, playerPos);
 
     // do bobbing math
     cameraTime += dt * 15 * velocity;
@@ -25,7 +25,7 @@ void Game::renderHUD() {
     matHud = glm::translate(matHud, glm::vec3( float(SCR_WIDTH) / 2, float(SCR_HEIGHT) / 2, 0) );
     matHud = glm::scale(matHud, glm::vec3( 27.0f, 27, 0) );
     mPerObjectData.world = matHud;
-    mCBPerObject->updateData(&mPerObjectData);
+    mRend->pushConstantData(mCBPerObject, &mPerObjectData, 1);
 
     mRend->bindGPUTexture(mCrosshairTexture, 3);
     mRend->draw(mHUDQuad->getIndexCount());
@@ -39,7 +39,7 @@ void Game::renderHUD() {
     matHud = glm::translate(matHud, glm::vec3( healthHudX, float(SCR_HEIGHT) - 100, 0) );
     matHud = glm::scale(matHud, glm::vec3( 80.0f, 90, 0) );
     mPerObjectData.world = matHud;
-    mCBPerObject->updateData(&mPerObjectData);
+    mRend->pushConstantData(mCBPerObject, &mPerObjectData, 1);
 
     mRend->bindGPUTexture(mHudHealthTexture, 3);
     mRend->draw(mHUDQuad->getIndexCount());
@@ -49,7 +49,7 @@ void Game::renderHUD() {
     matHud = glm::translate(matHud, glm::vec3( bulletHudX, bulletHudY, 0) );
     matHud = glm::scale(matHud, glm::vec3( 90.0f, 75, 0) );
     mPerObjectData.world = matHud;
-    mCBPerObject->updateData(&mPerObjectData);
+    mRend->pushConstantData(mCBPerObject, &mPerObjectData, 1);
 
     mRend->bindGPUTexture(mHudBulletTexture, 3);
     mRend->draw(mHUDQuad->getIndexCount());
@@ -65,7 +65,7 @@ void Game::renderHUD() {
             matHud = glm::scale(matHud, glm::vec3( 30, 30, 0) );
             mPerObjectData.world = matHud;
             mPerObjectData.opacity = mInteractionMgr.mAnimationTime;
-            mCBPerObject->updateData(&mPerObjectData);
+            mRend->pushConstantData(mCBPerObject, &mPerObjectData, 1);
 
             mRend->bindGPUTexture(interact.Icon->getGPUResource(), 3);
             mRend->draw(mHUDQuad->getIndexCount());
@@ -77,7 +77,7 @@ void Game::renderHUD() {
     // Draw Texts
     matHud = glm::mat4(1.0f);
     mPerObjectData.world = matHud;
-    mCBPerObject->updateData(&mPerObjectData);
+    mRend->pushConstantData(mCBPerObject, &mPerObjectData, 1);
 
     mRend->bindGPUTexture(mHudFontTexture, 3);
 
@@ -112,7 +112,7 @@ void Game::renderHUD() {
             //matHud = glm::mat4(1.0f);
             //matHud = glm::scale(matHud, glm::vec3( 1, 1, 1) );
             //mPerObjectData.world = matHud;
-            //mCBPerObject->updateData(&mPerObjectData);
+            //mRend->pushConstantData(mCBPerObject, &mPerObjectData, 1);
 
             prepareText(interact.Text, {(float(SCR_WIDTH) / 2) - 120, float(SCR_HEIGHT) - 150}, 20, vertices);
             mRend->bindResource(mHUDMsgTextVB);
@@ -22,8 +22,8 @@ void Game::keyboardEvent(int key, int scancode, int action, int mods) {
                 anim.Reverse = true;
             }
         }
-        if (iobj && mInteractionMgr.mComponent->Handler) {
-            mInteractionMgr.mComponent->Handler->interaction();
+        if (iobj && mWorld->getInteractComponent(iobj).Handler) {
+            mWorld->getInteractComponent(iobj).Handler->interaction();
 
             //TransformComponent& trans = mWorld->getTransformComponent(iobj);
             //trans.Orientation = glm::quat(glm::vec3(glm::radians(0.0f), glm::radians(-90.0f), 0.0f));
@@ -101,7 +101,7 @@ void Game::mouseButtonEvent(int button, int action) {
             World* world = World::get();
             CameraEntity* cam = world->getViewTarget();
 
-            glm::vec3 camPos = cam->mTransform->Position;
+            glm::vec3 camPos = cam->getTransform().Position;
             glm::vec3 camDir = cam->getDirection();
 
             btVector3 from(camPos.x, camPos.y, camPos.z);
@@ -53,6 +53,13 @@ bool Game::loadMap(const std::string& filename) {
             mEnemyCharacterList.push_back(demon);
         }
 
+        if (obj_firstToken(curline) == "crowd") {
+            std::vector<std::string> props;
+            obj_split(obj_tail(curline), props, ",");
+            glm::vec3 pos = {std::stof(props[0]), std::stof(props[1]), std::stof(props[2])};
+            spawnCrowd(pos, std::stoi(props[3]));
+        }
+
         if (obj_firstToken(curline) == "sun") {
             std::vector<std::string> props;
             obj_split(obj_tail(curline), props, ",");
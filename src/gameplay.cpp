@@ -38,7 +38,6 @@ InteractionManager::InteractionManager() {
     InteractionManager::sStatic = this;
     mLastObject = nullptr;
     mActiveObject = nullptr;
-    mComponent = nullptr;
     mAnimationTime = 1.0f;
 }
 
@@ -134,7 +133,6 @@ void CollisionManager::update(float dt) {
     CameraEntity* cam = world->getViewTarget();
 
     InteractionManager::get()->mActiveObject = nullptr;
-    InteractionManager::get()->mComponent = nullptr;
 
     for(auto& o : mCollisionObjects) {
         SceneEntity* entity = o.first;
@@ -165,7 +163,7 @@ void CollisionManager::update(float dt) {
         if (world->hasInteractComponent(entity)) {
             InteractComponent& interact = world->getInteractComponent(entity);
 
-            const glm::vec3& camPos = cam->mTransform->Position;
+            const glm::vec3& camPos = cam->getTransform().Position;
             const glm::vec3& camDir = cam->getDirection();
 
             btVector3 from(camPos.x, camPos.y, camPos.z);
@@ -189,7 +187,6 @@ void CollisionManager::update(float dt) {
 
 			if (closestResults.hasHit()) {
                 InteractionManager::get()->mActiveObject = entity;
-                InteractionManager::get()->mComponent = &interact;
                 break;
             }
         }
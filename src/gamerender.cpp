@@ -5,6 +5,7 @@
 #include "camera.h"
 #include "mesh.h"
 #include "light.h"
+#include "jobsystem.h"
 
 #include "game.h"
 
@@ -12,7 +13,7 @@
 void Game::_preparePerFrameData() {
     CameraEntity* cam = mWorld->getViewTarget();
 
-    const TransformComponent& camTransform = mWorld->mTransformComponents[cam->getId()];
+    const TransformComponent& camTransform = mWorld->getTransformComponent(cam);
     const glm::mat4& camView = glm::inverse(camTransform.Transform);//mCamera->getViewMatrix();
     const glm::mat4& camProj = cam->getProjectionMatrix();
 
@@ -30,17 +31,93 @@ void Game::_preparePerFrameData() {
     mPerFrameData.screenHeight = SCR_HEIGHT;
 
     mPerFrameData.sunDirection = lightPos;
+    mPerFrameData.animationTime = (float)mAnimationTime;
+
+    // exponential depth slices, each one is the same fraction deeper than the last
+    const float depthRatio = logf(mPerFrameData.cameraFar / mPerFrameData.cameraNear);
+    mPerFrameData.clusterScale = (float)CLUSTER_Z / depthRatio;
+    mPerFrameData.clusterBias = (float)CLUSTER_Z * logf(mPerFrameData.cameraNear) / depthRatio;
 
     mCBPerFrame->updateData(&mPerFrameData);
 }
 
-void Game::_prepareLightData() {
+static uint32_t clampCluster(float value, uint32_t count) {
+    if (value <= 0) {
+        return 0;
+    }
+    return std::min((uint32_t)value, count - 1);
+}
+
+uint32_t Game::_getCascadeMask(const AABB& bb) const {
+    uint32_t mask = 0;
+    for (int c = 0; c < MAX_CSSM_SPLITS; c++) {
+        if ((mActiveCascadeMask & (1 << c)) && mCascadeFrustums[c].IsBoxVisible(bb.getMin(), bb.getMax())) {
+            mask |= 1 << c;
+        }
+    }
+    return mask;
+}
+
+bool Game::_getLightClusterRange(const glm::vec3& viewPosition, float range, LightClusterRange& clusters) {
+    const float nearPlane = mPerFrameData.cameraNear;
+    const float farPlane = mPerFrameData.cameraFar;
+
+    // the camera looks down -z
+    const float minDepth = -viewPosition.z - range;
+    const float maxDepth = -viewPosition.z + range;
+    if (maxDepth < nearPlane || minDepth > farPlane) {
+        return false;
+    }
+
+    const float clusterScale = mPerFrameData.clusterScale;
+    const float clusterBias = mPerFrameData.clusterBias;
+    clusters.MinZ = clampCluster(logf(std::max(minDepth, nearPlane)) * clusterScale - clusterBias, CLUSTER_Z);
+    clusters.MaxZ = clampCluster(logf(std::min(maxDepth, farPlane)) * clusterScale - clusterBias, CLUSTER_Z);
+
+    clusters.MinX = 0;
+    clusters.MaxX = CLUSTER_X - 1;
+    clusters.MinY = 0;
+    clusters.MaxY = CLUSTER_Y - 1;
+
+    // a light around the camera covers the whole screen, otherwise its box projects to a rectangle
+    if (minDepth <= nearPlane) {
+        return true;
+    }
+
+    glm::vec2 minNDC = glm::vec2(1.0f, 1.0f);
+    glm::vec2 maxNDC = glm::vec2(-1.0f, -1.0f);
+    for (int c = 0; c < 8; c++) {
+        const glm::vec4 corner = glm::vec4(
+            viewPosition.x + ((c & 1) ? range : -range),
+            viewPosition.y + ((c & 2) ? range : -range),
+            viewPosition.z + ((c & 4) ? range : -range),
+            1.0f);
+        const glm::vec4 clip = mPerFrameData.proj * corner;
+        const glm::vec2 ndc = glm::vec2(clip.x, clip.y) / clip.w;
+        minNDC = glm::min(minNDC, ndc);
+        maxNDC = glm::max(maxNDC, ndc);
+    }
+    if (minNDC.x > 1.0f || minNDC.y > 1.0f || maxNDC.x < -1.0f || maxNDC.y < -1.0f) {
+        return false;
+    }
+
+    // same tiles as gl_FragCoord, y goes up
+    clusters.MinX = clampCluster((minNDC.x * 0.5f + 0.5f) * CLUSTER_X, CLUSTER_X);
+    clusters.MaxX = clampCluster((maxNDC.x * 0.5f + 0.5f) * CLUSTER_X, CLUSTER_X);
+    clusters.MinY = clampCluster((minNDC.y * 0.5f + 0.5f) * CLUSTER_Y, CLUSTER_Y);
+    clusters.MaxY = clampCluster((maxNDC.y * 0.5f + 0.5f) * CLUSTER_Y, CLUSTER_Y);
+    return true;
+}
+
+void Game::_cullLights(const Frustum& frustum) {
     const auto& lightList = mWorld->mPointLightComponents;
-    int lightIndex = 0;
-    mLightArrayData.lightCount = {0, 0, 0, 0};
-    for(auto it = lightList.begin();it != lightList.end();it++) {
-        Entity_T entityID = it->first;
-        PointLight* pointLight = it->second;
+
+    mVisibleLights.clear();
+    mLightSpheres.clear();
+
+    for(size_t i = 0;i < lightList.size();i++) {
+        Entity_T entityID = lightList.getEntity(i);
+        PointLight* pointLight = lightList.at(i);
 
         if (!pointLight->isEnabled()) {
             continue;
@@ -49,35 +126,288 @@ void Game::_prepareLightData() {
         glm::vec3 lightPos = pointLight->getPosition();
 
         // Also apply transformation to the position if the entity has one
-        auto itTrans = mWorld->mWorldTransforms.find(entityID);
-        if (itTrans != mWorld->mWorldTransforms.end()) {
+        const glm::mat4* worldTrans = mWorld->mWorldTransforms.find(entityID);
+        if (worldTrans) {
             glm::vec4 pos4 = {lightPos.x, lightPos.y, lightPos.z, 1};
-            pos4 = itTrans->second * pos4;
+            pos4 = (*worldTrans) * pos4;
             lightPos = {pos4.x, pos4.y, pos4.z};
         }
 
+        VisibleLight light;
+        light.Light = pointLight;
+        light.Position = lightPos;
+        // the lighting shader fades a light out at its far plane
+        light.Range = pointLight->getFarPlane();
+        light.Contribution = 0;
+        light.ShadowCubeMap = -1;
+        light.UpdateShadow = false;
+        light.ShadowSignature = 0;
+        mVisibleLights.push_back(light);
+        mLightSpheres.push_back(glm::vec4(lightPos, light.Range));
+    }
+
+    const uint32_t enabledCount = (uint32_t)mLightSpheres.size();
+    mLightSphereVisible.resize(enabledCount);
+    if (enabledCount > 0) {
+        frustum.CullSpheres(&mLightSpheres[0], enabledCount, &mLightSphereVisible[0]);
+    }
+
+    const glm::vec3 cameraPosition = glm::vec3(mPerFrameData.cameraPosition);
+    uint32_t kept = 0;
+    for (uint32_t i = 0; i < enabledCount; i++) {
+        if (!mLightSphereVisible[i]) {
+            continue;
+        }
+        VisibleLight& light = mVisibleLights[kept];
+        light = mVisibleLights[i];
+
+        // solid angle of the light's sphere, all of the screen once the camera is inside it
+        const glm::vec3 color = light.Light->getColor();
+        const float brightness = light.Light->getIntensity() * std::max(color.x, std::max(color.y, color.z));
+        const float distance = std::max(glm::length(light.Position - cameraPosition), mPerFrameData.cameraNear);
+        const float coverage = std::min((light.Range * light.Range) / (distance * distance), 1.0f);
+        light.Contribution = brightness * coverage;
+        kept++;
+    }
+    mVisibleLights.resize(kept);
+
+    mLightsKept = kept;
+    mLightsCulled = enabledCount - kept;
+
+    std::sort(mVisibleLights.begin(), mVisibleLights.end(), [](const VisibleLight& a, const VisibleLight& b) {
+        return a.Contribution > b.Contribution;
+    });
+
+    // the brightest shadow casters get the shadow cube maps
+    int shadowCubeMapIndex = 0;
+    for(auto it = mVisibleLights.begin();it != mVisibleLights.end();++it) {
+        if (it->Light->isCastingShadow() && shadowCubeMapIndex < MAX_SHADOW_CUBE_MAPS) {
+            it->ShadowCubeMap = shadowCubeMapIndex;
+            shadowCubeMapIndex++;
+        }
+    }
+}
+
+// the local bounds a sub-mesh gets culled with, skinned ones can't use their bind pose bounds
+static const AABB& getCullingBounds(Mesh* mesh, SubMesh* sm) {
+    SkeletonMesh* skeMesh = mesh->isSkeletonMesh();
+    return skeMesh ? skeMesh->mAnimatedBoundingBox : sm->getLocalBoundingBox();
+}
+
+// FNV-1a, good enough to notice a caster moved
+static uint64_t hashBytes(uint64_t hash, const void* data, size_t size) {
+    const uint8_t* bytes = (const uint8_t*)data;
+    for (size_t i = 0; i < size; i++) {
+        hash ^= bytes[i];
+        hash *= 1099511628211ull;
+    }
+    return hash;
+}
+
+// true if any sub-mesh of mesh (moved by world) touches bounds
+static bool isMeshInBounds(Mesh* mesh, const glm::mat4& world, const AABB& bounds) {
+    const auto& sml = mesh->getSubMeshList();
+    for (auto it = sml.begin(); it != sml.end();++it) {
+        AABB bb = getCullingBounds(mesh, *it);
+        bb.transform(world);
+        if (bb.intersect(bounds) != INTERSECTION_TYPE::OUTSIDE) {
+            return true;
+        }
+    }
+    return false;
+}
+
+uint64_t Game::_getShadowCasterSignature(const VisibleLight& light) {
+    // world space, like the cube pass draws it
+    const glm::vec3 lightPos = light.Position;
+    const float farPlane = light.Light->getFarPlane();
+    const AABB lightBB(lightPos, farPlane);
+
+    uint64_t signature = 14695981039346656037ull;
+    signature = hashBytes(signature, &lightPos, sizeof(lightPos));
+    signature = hashBytes(signature, &farPlane, sizeof(farPlane));
+
+    const auto& meshCompList = mWorld->mMeshComponents;
+    for(size_t i = 0; i < meshCompList.size();++i) {
+        const MeshComponent& comp = meshCompList.at(i);
+        // the merged level never moves
+        if (comp.mStaticBatched) {
+            continue;
+        }
+        Mesh* mesh = comp.mMesh;
+        Entity_T entityID = meshCompList.getEntity(i);
+
+        glm::mat4 entityWorld = MatIdent;
+        const glm::mat4* worldTrans = mWorld->mWorldTransforms.find(entityID);
+        if (worldTrans) {
+            entityWorld = (*worldTrans);
+        }
+
+        // skinned meshes are tested with their padded bounds (see SkeletonMesh::mAnimatedBoundingBox)
+        if (!isMeshInBounds(mesh, entityWorld, lightBB)) {
+            continue;
+        }
+
+        signature = hashBytes(signature, &entityID, sizeof(entityID));
+        signature = hashBytes(signature, &mesh, sizeof(mesh));
+        signature = hashBytes(signature, &entityWorld, sizeof(entityWorld));
+
+        // only a new pose changes the shadow, idle or sparsely updated skeletons keep it
+        SkeletonMesh* skeMesh = mesh->isSkeletonMesh();
+        if (skeMesh) {
+            const uint32_t poseVersion = skeMesh->getSkeleton()->getPoseVersion();
+            signature = hashBytes(signature, &poseVersion, sizeof(poseVersion));
+        }
+    }
+
+    // crowd members play their clips on the game clock, which stands still while the game does
+    const auto& crowdList = mWorld->mCrowdComponents;
+    bool crowdInRange = false;
+    for(size_t i = 0; i < crowdList.size();++i) {
+        const CrowdComponent& comp = crowdList.at(i);
+        Entity_T entityID = crowdList.getEntity(i);
+
+        const glm::mat4* worldTrans = mWorld->mWorldTransforms.find(entityID);
+        const glm::mat4 entityWorld = worldTrans ? (*worldTrans) : MatIdent;
+        if (!isMeshInBounds(comp.Mesh, entityWorld, lightBB)) {
+            continue;
+        }
+
+        signature = hashBytes(signature, &entityID, sizeof(entityID));
+        signature = hashBytes(signature, &comp.Mesh, sizeof(comp.Mesh));
+        signature = hashBytes(signature, &comp.Clip, sizeof(comp.Clip));
+        signature = hashBytes(signature, &comp.TimeOffset, sizeof(comp.TimeOffset));
+        signature = hashBytes(signature, &comp.Speed, sizeof(comp.Speed));
+        signature = hashBytes(signature, &entityWorld, sizeof(entityWorld));
+        crowdInRange = true;
+    }
+    if (crowdInRange) {
+        signature = hashBytes(signature, &mAnimationTime, sizeof(mAnimationTime));
+    }
+    return signature;
+}
+
+void Game::_scheduleShadowUpdates() {
+    mStaleShadowLights.clear();
+    mPointShadowsCached = 0;
+
+    for(auto it = mVisibleLights.begin();it != mVisibleLights.end();++it) {
+        if (it->ShadowCubeMap < 0) {
+            continue;
+        }
+        PointLight* pointLight = it->Light;
+        it->ShadowSignature = _getShadowCasterSignature(*it);
+        if (pointLight->isShadowMapValid() && pointLight->getShadowSignature() == it->ShadowSignature) {
+            mPointShadowsCached++;
+        } else {
+            mStaleShadowLights.push_back(&(*it));
+        }
+    }
+
+    // lights that never had a shadow map go first, then the ones that waited the longest
+    // (stable, so the brighter one wins a tie)
+    std::stable_sort(mStaleShadowLights.begin(), mStaleShadowLights.end(), [](const VisibleLight* a, const VisibleLight* b) {
+        if (a->Light->isShadowMapValid() != b->Light->isShadowMapValid()) {
+            return !a->Light->isShadowMapValid();
+        }
+        return a->Light->getShadowUpdateFrame() < b->Light->getShadowUpdateFrame();
+    });
+
+    const uint32_t staleCount = (uint32_t)mStaleShadowLights.size();
+    const uint32_t budget = std::min(staleCount, (uint32_t)std::max(mPointShadowBudget, 1));
+    for (uint32_t i = 0; i < staleCount; i++) {
+        VisibleLight* light = mStaleShadowLights[i];
+        if (i < budget) {
+            light->UpdateShadow = true;
+        } else if (!light->Light->isShadowMapValid()) {
+            // nothing to show yet, lit without a shadow until its turn
+            light->ShadowCubeMap = -1;
+        }
+        // the others keep their old shadow for a few frames
+    }
+
+    mPointShadowsStale = staleCount;
+    mPointShadowsRedrawn = budget;
+}
+
+void Game::_prepareLightData() {
+    Frustum cameraFrustum(mPerFrameData.proj * mPerFrameData.view);
+    _cullLights(cameraFrustum);
+    _scheduleShadowUpdates();
+
+    mLightData.clear();
+    mLightClusterRanges.clear();
+
+    for(auto it = mVisibleLights.begin();it != mVisibleLights.end();++it) {
+        const VisibleLight& visibleLight = *it;
+        PointLight* pointLight = visibleLight.Light;
+
+        LightClusterRange clusters;
+        const glm::vec4 viewPos4 = mPerFrameData.view * glm::vec4(visibleLight.Position, 1.0f);
+        if (!_getLightClusterRange(glm::vec3(viewPos4), visibleLight.Range, clusters)) {
+            continue;
+        }
+
         // for lighting
         cbPointLight light;
-        light.position = glm::vec4(lightPos, pointLight->getFarPlane());
+        light.position = glm::vec4(visibleLight.Position, visibleLight.Range);
         light.color = glm::vec4(pointLight->getColor(), pointLight->getIntensity());
-
-        if (pointLight->isCastingShadow()) {
-            light.direction.x = 1;
+        if (visibleLight.ShadowCubeMap >= 0) {
+            light.direction = glm::vec4(1, (float)visibleLight.ShadowCubeMap, 0, 0);
         } else {
-            light.direction.x = 0;
+            light.direction = glm::vec4(0, 0, 0, 0);
         }
 
-        mLightArrayData.lights[lightIndex] = light;
-        lightIndex++;
+        mLightData.push_back(light);
+        mLightClusterRanges.push_back(clusters);
     }
 
-    int lightCount = lightIndex;
-    mLightArrayData.lightCount = {lightCount, lightCount, lightCount, lightCount};
 
-    mCBLightArray->updateData(&mLightArrayData);
+    // count the lights of every cluster, then give each cluster its slice of the index buffer
+    mClusterData.assign(CLUSTER_COUNT, {0, 0});
+    for(auto it = mLightClusterRanges.begin();it != mLightClusterRanges.end();++it) {
+        const LightClusterRange& r = *it;
+        for (uint32_t z = r.MinZ; z <= r.MaxZ; z++) {
+            for (uint32_t y = r.MinY; y <= r.MaxY; y++) {
+                sbLightCluster* row = &mClusterData[(z * CLUSTER_Y + y) * CLUSTER_X];
+                for (uint32_t x = r.MinX; x <= r.MaxX; x++) {
+                    row[x].count++;
+                }
+            }
+        }
+    }
+
+    uint32_t indexCount = 0;
+    for (uint32_t c = 0; c < CLUSTER_COUNT; c++) {
+        mClusterData[c].offset = indexCount;
+        indexCount += mClusterData[c].count;
+        mClusterData[c].count = 0;
+    }
+
+    mClusterLightIndices.resize(indexCount);
+    for (uint32_t l = 0; l < mLightClusterRanges.size(); l++) {
+        const LightClusterRange& r = mLightClusterRanges[l];
+        for (uint32_t z = r.MinZ; z <= r.MaxZ; z++) {
+            for (uint32_t y = r.MinY; y <= r.MaxY; y++) {
+                sbLightCluster* row = &mClusterData[(z * CLUSTER_Y + y) * CLUSTER_X];
+                for (uint32_t x = r.MinX; x <= r.MaxX; x++) {
+                    mClusterLightIndices[row[x].offset + row[x].count] = l;
+                    row[x].count++;
+                }
+            }
+        }
+    }
+
+    if (!mLightData.empty()) {
+        mLightBuffer->updateData(&mLightData[0], (uint32_t)(mLightData.size() * sizeof(cbPointLight)));
+    }
+    if (!mClusterLightIndices.empty()) {
+        mClusterLightIndexBuffer->updateData(&mClusterLightIndices[0], (uint32_t)(mClusterLightIndices.size() * sizeof(uint32_t)));
+    }
+    mClusterBuffer->updateData(&mClusterData[0], (uint32_t)(mClusterData.size() * sizeof(sbLightCluster)));
 }
 
-glm::mat4 getLightSpaceMatrix(float mShadowMapSize, const glm::mat4& view, float fov, const float nearPlane, const float farPlane)
+ShadowCascade getShadowCascade(const glm::vec3& lightDir, const glm::mat4& view, float fov, const float nearPlane, const float farPlane)
 {
     const auto proj = glm::perspective(
         glm::radians(fov), float(SCR_WIDTH) / float(SCR_HEIGHT), nearPlane, farPlane);
@@ -109,176 +439,697 @@ glm::mat4 getLightSpaceMatrix(float mShadowMapSize, const glm::mat4& view, float
     }
     center /= 8.0f;
 
-    //glm::vec3 lightDir = glm::normalize(mRenderer->GetLightDirection());
-   /// glm::vec3 lightPos = center + lightDir * (farPlane - nearPlane);
-    //glm::mat4 lightView = glm::lookAt(lightPos, center, glm::vec3(0.0f, 1.0f, 0.0f));
-
-    const glm::vec3 lightDir = glm::normalize(World::get()->mSunLight->getDirection());
-
-    const auto lightView = glm::lookAt(center, center + lightDir, glm::vec3(0.0f, 1.0f, 0.0f));
-
-    float minX = std::numeric_limits<float>::max();
-    float maxX = std::numeric_limits<float>::lowest();
-    float minY = std::numeric_limits<float>::max();
-    float maxY = std::numeric_limits<float>::lowest();
-    float minZ = std::numeric_limits<float>::max();
-    float maxZ = std::numeric_limits<float>::lowest();
+    // a sphere around the slice doesn't change size when the camera turns,
+    // rounded up so the float noise doesn't change it either
+    float radius = 0;
     for (const auto& v : frustumCorners)
     {
-        const auto trf = lightView * v;
-        minX = std::min(minX, trf.x);
-        maxX = std::max(maxX, trf.x);
-        minY = std::min(minY, trf.y);
-        maxY = std::max(maxY, trf.y);
-        minZ = std::min(minZ, trf.z);
-        maxZ = std::max(maxZ, trf.z);
+        radius = std::max(radius, glm::length(glm::vec3(v) - center));
     }
+    radius = ceilf(radius * 16.0f) / 16.0f;
+
+    // the light space is fixed to the world, only the cascade moves in it
+    const auto lightView = glm::lookAt(glm::vec3(0.0f, 0.0f, 0.0f), lightDir, glm::vec3(0.0f, 1.0f, 0.0f));
+    const glm::vec4 lightCenter = lightView * glm::vec4(center, 1.0f);
+
+    // snap to whole texels so the shadows don't swim and the cached depth can be scrolled
+    const float texelSize = 2.0f * radius / CASCADE_SHADOW_MAP_SIZE;
+
+    ShadowCascade cascade;
+    cascade.TexelX = (int32_t)floorf(lightCenter.x / texelSize);
+    cascade.TexelY = (int32_t)floorf(lightCenter.y / texelSize);
+    cascade.Radius = radius;
+    cascade.DepthCenter = floorf(lightCenter.z / radius) * radius;
+
+    const float x = cascade.TexelX * texelSize;
+    const float y = cascade.TexelY * texelSize;
 
-    // Tune this parameter according to the scene
+    // Tune this parameter according to the scene, the casters between the sun and the slice need to be in
     constexpr float zMult = 10.0f;
-    if (minZ < 0)
-    {
-        minZ *= zMult;
-    }
-    else
-    {
-        minZ /= zMult;
+    const float depthExtent = radius * zMult;
+
+    // the light looks down -z
+    glm::mat4 lightProjection = glm::ortho(x - radius, x + radius, y - radius, y + radius,
+        -(cascade.DepthCenter + depthExtent), -(cascade.DepthCenter - depthExtent));
+
+    cascade.ViewProj = lightProjection * lightView;
+    return cascade;
+}
+
+int totalDraw = 0;
+
+bool show_another_window = true;
+double jobStressTestResult = 0;
+ComponentBenchmarkResult componentBenchmarkResult = {0, 0};
+HierarchyBenchmarkResult hierarchyBenchmarkResult = {0, 0, 0, 0, 0};
+
+void Game::_prepareBonePalettes() {
+    mBonePaletteData.clear();
+
+    // the world already has the list of (unique) skinned meshes updated this frame
+    const auto& skinnedMeshList = mWorld->mSkeletonUpdateList;
+    for(auto it = skinnedMeshList.begin(); it != skinnedMeshList.end();++it) {
+        SkeletonMesh* skeMesh = *it;
+        const std::vector<glm::mat4>& palette = skeMesh->getBonePalette();
+
+        skeMesh->mBonePaletteOffset = (uint32_t)mBonePaletteData.size();
+        mBonePaletteData.insert(mBonePaletteData.end(), palette.begin(), palette.end());
     }
-    if (maxZ < 0)
-    {
-        maxZ /= zMult;
+
+    if (!mBonePaletteData.empty()) {
+        mBonePaletteBuffer->updateData(&mBonePaletteData[0], (uint32_t)(mBonePaletteData.size() * sizeof(glm::mat4)));
     }
-    else
-    {
-        maxZ *= zMult;
+}
+
+void Game::_preSkinMeshes() {
+    const SkinningMode mode = mWorld->mSkinningMode;
+    bool dispatched = false;
+
+    mPreSkinnedVertexCount = 0;
+
+    const auto& skinnedMeshList = mWorld->mSkeletonUpdateList;
+    for(auto it = skinnedMeshList.begin(); it != skinnedMeshList.end();++it) {
+        SkeletonMesh* skeMesh = *it;
+
+        skeMesh->mPreSkinned = (mode != SkinningMode::VertexShader);
+        if (!skeMesh->mPreSkinned) {
+            continue;
+        }
+
+        const auto& sml = skeMesh->getSubMeshList();
+        for (auto itSub = sml.begin(); itSub != sml.end();++itSub) {
+            SubMesh* sm = *itSub;
+            const uint32_t vertexCount = static_cast<IGPUVertexBuffer*>(sm->getVertexBuffer())->getVertexCount();
+
+            if (sm->mSkinnedVertexBuffer == nullptr) {
+                // starts out in the bind pose with CPU skinning, the compute pass fills it before any draw
+                std::vector<Vertex> bindPose(vertexCount);
+                for (size_t v = 0; v < sm->mBindVertices.size(); v++) {
+                    const AnimatedVertex& src = sm->mBindVertices[v];
+                    bindPose[v].position = src.position;
+                    bindPose[v].normal = src.normal;
+                    bindPose[v].tangent = src.tangent;
+                    bindPose[v].texCoord = src.texCoord;
+                }
+                sm->mSkinnedVertexBuffer = mRend->createGPUVertexBuffer(&bindPose[0], vertexCount);
+            }
+
+            if (mode == SkinningMode::CPU) {
+                // skinned by the skeleton job, empty if we just switched to CPU skinning
+                if (sm->mSkinnedVertices.size() == vertexCount) {
+                    sm->mSkinnedVertexBuffer->updateData(&sm->mSkinnedVertices[0], vertexCount);
+                }
+            } else {
+                if (!dispatched) {
+                    mRend->bindResource(skinningProgram);
+                    dispatched = true;
+                }
+                cbSkinning data;
+                data.vertexCount = (int32_t)vertexCount;
+                data.boneOffset = (int32_t)skeMesh->mBonePaletteOffset;
+                data.sourceStride = skeMesh->mCompactVertices ? sizeof(CompactAnimatedVertex) / 4 : sizeof(AnimatedVertex) / 4;
+                data.compact = skeMesh->mCompactVertices ? 1 : 0;
+                mCBSkinning->updateData(&data);
+
+                mRend->bindStorageBuffer(sm->getVertexBuffer(), 1);
+                mRend->bindStorageBuffer(sm->mSkinnedVertexBuffer, 2);
+                mRend->dispatchCompute((vertexCount + 63) / 64, 1, 1);
+            }
+            mPreSkinnedVertexCount += vertexCount;
+        }
     }
 
-    glm::mat4 lightProjection = glm::ortho(minX, maxX, minY, maxY, minZ, maxZ);
-/*
-    glm::mat4 shadowMatrix = lightProjection * lightView;
-    glm::vec4 shadowOrigin = glm::vec4(0.0f, 0.0f, 0.0f, 1.0f);
-    shadowOrigin = shadowMatrix * shadowOrigin;
-    shadowOrigin = shadowOrigin * mShadowMapSize / 2.0f;
-
-    glm::vec4 roundedOrigin = glm::round(shadowOrigin);
-    glm::vec4 roundOffset = roundedOrigin - shadowOrigin;
-    roundOffset = roundOffset * 2.0f / mShadowMapSize;
-    roundOffset.z = 0.0f;
-    roundOffset.w = 0.0f;
-
-    glm::mat4 shadowProj = lightProjection;
-    shadowProj[3] += roundOffset;
-    lightProjection = shadowProj;
-*/
-    return lightProjection * lightView;
+    if (dispatched) {
+        mRend->memoryBarrier();
+    }
 }
 
-std::vector<glm::mat4> getLightSpaceMatrices(CameraEntity* camera, const std::vector<float>& shadowCascadeLevels, const glm::mat4& view)
-{
-    const float cameraNearPlane = camera->getNear();
-    const float cameraFarPlane = camera->getFar();
-    const float fov = camera->getFOV();
+void Game::_prepareCrowds() {
+    mCrowdBatches.clear();
+    mCrowdInstanceData.clear();
 
-    std::vector<glm::mat4> ret;
-    for (size_t i = 0; i < shadowCascadeLevels.size() + 1; ++i)
-    {
-        if (i == 0)
-        {
-            ret.push_back(getLightSpaceMatrix(4096.0f, view, fov, cameraNearPlane, shadowCascadeLevels[i]));
+    const auto& crowdList = mWorld->mCrowdComponents;
+    if (crowdList.size() == 0) {
+        return;
+    }
+
+    // group the members by mesh, each group becomes one instanced draw per sub-mesh
+    std::vector<uint32_t> order(crowdList.size());
+    for (uint32_t i = 0; i < order.size(); i++) {
+        order[i] = i;
+    }
+    std::sort(order.begin(), order.end(), [&crowdList](uint32_t a, uint32_t b) {
+        return crowdList.at(a).Mesh < crowdList.at(b).Mesh;
+    });
+
+    // the baked clips only get uploaded again when a new mesh shows up
+    bool bakedDirty = false;
+    for (uint32_t i = 0; i < order.size(); i++) {
+        SkeletonMesh* mesh = crowdList.at(order[i]).Mesh;
+        if (!mCrowdBatches.empty() && mCrowdBatches.back().Mesh == mesh) {
+            continue;
         }
-        else if (i < shadowCascadeLevels.size())
-        {
-            ret.push_back(getLightSpaceMatrix(3048.0f, view, fov, shadowCascadeLevels[i - 1], shadowCascadeLevels[i]));
+        CrowdBatch batch;
+        batch.Mesh = mesh;
+        batch.FirstInstance = i;
+        batch.InstanceCount = 0;
+        mCrowdBatches.push_back(batch);
+
+        if (std::find(mBakedMeshes.begin(), mBakedMeshes.end(), mesh) == mBakedMeshes.end()) {
+            mBakedMeshes.push_back(mesh);
+            bakedDirty = true;
         }
-        else
-        {
-            ret.push_back(getLightSpaceMatrix(4096.0f, view, fov, shadowCascadeLevels[i - 1], cameraFarPlane));
+    }
+
+    if (bakedDirty) {
+        std::vector<glm::mat4> frames;
+        std::vector<sbBakedClip> clips;
+        for(auto it = mBakedMeshes.begin();it != mBakedMeshes.end();++it) {
+            SkeletonMesh* mesh = *it;
+            const uint32_t firstMatrix = (uint32_t)frames.size();
+            mesh->mBakedClipOffset = (uint32_t)clips.size();
+            frames.insert(frames.end(), mesh->mBakedFrames.begin(), mesh->mBakedFrames.end());
+
+            for(auto itClip = mesh->mBakedClips.begin();itClip != mesh->mBakedClips.end();++itClip) {
+                sbBakedClip clip;
+                clip.firstMatrix = (int32_t)(firstMatrix + itClip->FirstFrame * mesh->mBoneCounter);
+                clip.frameCount = (int32_t)itClip->FrameCount;
+                clip.boneCount = mesh->mBoneCounter;
+                clip.frameRate = itClip->FrameRate;
+                clips.push_back(clip);
+            }
+        }
+        if (!frames.empty()) {
+            mBakedFrameBuffer->updateData(&frames[0], (uint32_t)(frames.size() * sizeof(glm::mat4)));
+        }
+        if (!clips.empty()) {
+            mBakedClipBuffer->updateData(&clips[0], (uint32_t)(clips.size() * sizeof(sbBakedClip)));
         }
     }
-    return ret;
+
+    CrowdBatch* batch = &mCrowdBatches[0];
+    for (uint32_t i = 0; i < order.size(); i++) {
+        const CrowdComponent& comp = crowdList.at(order[i]);
+        if (comp.Mesh != batch->Mesh) {
+            batch++;
+        }
+        batch->InstanceCount++;
+
+        sbCrowdInstance instance;
+        const glm::mat4* worldTrans = mWorld->mWorldTransforms.find(crowdList.getEntity(order[i]));
+        instance.world = worldTrans ? (*worldTrans) : MatIdent;
+        instance.clip = (int32_t)(comp.Mesh->mBakedClipOffset + comp.Clip);
+        instance.timeOffset = comp.TimeOffset;
+        instance.speed = comp.Speed;
+        instance.pad = 0;
+        mCrowdInstanceData.push_back(instance);
+    }
+
+    mCrowdInstanceBuffer->updateData(&mCrowdInstanceData[0], (uint32_t)(mCrowdInstanceData.size() * sizeof(sbCrowdInstance)));
 }
 
-int totalDraw = 0;
+void Game::_drawCrowds(bool lightingPass, bool transparent) {
+    for(auto it = mCrowdBatches.begin();it != mCrowdBatches.end();++it) {
+        const CrowdBatch& batch = *it;
+        SkeletonMesh* mesh = batch.Mesh;
 
-bool show_another_window = true;
+        mPerObjectData.crowd = 1;
+        mPerObjectData.boneOffset = batch.FirstInstance;
+        mPerObjectData.animated = mesh->mCompactVertices ? 2 : 1;
 
-void Game::renderScene(enum RenderPassType pass, Frustum* frustum) {
+        const auto& sml = mesh->getSubMeshList();
 
-    const auto& meshCompList = mWorld->mMeshComponents;
+        for (auto itSub = sml.begin(); itSub != sml.end();++itSub) {
+            SubMesh* sm = *itSub;
+            Material* mat = sm->getMaterial();
 
-    for(auto itEnt = meshCompList.begin(); itEnt != meshCompList.end();++itEnt) {
-        const MeshComponent& comp = itEnt->second;
-        Mesh* mesh = comp.mMesh;
-        Entity_T entityID = itEnt->first;
+            // the lighting pass draws the solid and the transparent sub-meshes separately
+            if (lightingPass && mat->isTwoSided() != transparent) {
+                continue;
+            }
 
-        SkeletonMesh* skeMesh = mesh->isSkeletonMesh();
-        if (skeMesh) {
-            Skeleton* skeleton = skeMesh->getSkeleton();
+            Texture* dmap = mat->getDiffuseMap();
+            if (dmap) {
+                mRend->bindGPUTexture(dmap->getGPUResource(), 1);
+            }
 
-            for(auto it = skeMesh->mBoneInfoMap.begin(); it != skeMesh->mBoneInfoMap.end();++it){
-                const BoneInfo& boneInfo = it->second;
+            if (lightingPass) {
+                // same sub-mesh correction as the other skinned draws, the instance world goes in front of it
+                mPerObjectData.world = sm->tempMatInverse;
+                mPerObjectData.hasNormalMap = 0;
+                mPerObjectData.hasEmissionMap = 0;
+                mPerObjectData.specularIntensity = mat->getSpecularColor().red;
 
-                Bone* bone = skeleton->getBone(it->first);
-                assert(boneInfo.id < MAX_BONES);
-                mPerAnimatedObjectData.gBones[boneInfo.id] = bone->mWorldTransform * boneInfo.offset;
+                Texture* nmap = mat->getNormalMap();
+                if (nmap) {
+                    mRend->bindGPUTexture(nmap->getGPUResource(), 2);
+                    mPerObjectData.hasNormalMap = 1;
+                }
+                Texture* emap = mat->getEmissionMap();
+                if (emap) {
+                    mRend->bindGPUTexture(emap->getGPUResource(), 3);
+                    mPerObjectData.hasEmissionMap = 1;
+                }
+            } else {
+                mPerObjectData.world = MatIdent;
             }
-            mCBPerAnimatedObject->updateData(&mPerAnimatedObjectData);
+            mRend->pushConstantData(mCBPerObject, &mPerObjectData, 1);
 
-            mPerObjectData.animated = 1;
-        } else {
-            mPerObjectData.animated = 0;
+            IGPUIndexBuffer* ib = sm->getIndexBuffer();
+            mRend->bindResource(sm->getVertexBuffer());
+            mRend->bindResource(ib);
+            mRend->drawInstanced(ib->getIndexCount(), batch.InstanceCount);
+            totalDraw++;
         }
-        auto itTrans = mWorld->mWorldTransforms.find(entityID);
-        if (itTrans != mWorld->mWorldTransforms.end()) {
-            mPerObjectData.world = itTrans->second;
-        } else {
-            mPerObjectData.world = MatIdent;
+    }
+    mPerObjectData.crowd = 0;
+}
+
+const int MATERIAL_TEXTURE_COUNT = 5;
+
+// the textures of mat a pass samples, by texture unit - 1. The depth passes only need the diffuse map
+static void getPassTextures(enum RenderPassType pass, Material* mat, Texture* textures[MATERIAL_TEXTURE_COUNT]) {
+    textures[0] = mat->getDiffuseMap();
+    textures[1] = nullptr;
+    textures[2] = nullptr;
+    textures[3] = nullptr;
+    textures[4] = nullptr;
+    if (pass == RenderPassType::LightingPass) {
+        textures[1] = mat->getNormalMap();
+        textures[2] = mat->getEmissionMap();
+        textures[3] = mat->mMetalnessMap;
+        textures[4] = mat->mRoughnessMap;
+    }
+}
+
+void Game::_queueMeshes(enum RenderPassType pass, Frustum* frustum, const AABB* bounds, const glm::vec3& viewPosition, float viewDistance) {
+    const auto& meshCompList = mWorld->mMeshComponents;
+
+    for(size_t i = 0; i < meshCompList.size();++i) {
+        const MeshComponent& comp = meshCompList.at(i);
+        Mesh* mesh = comp.mMesh;
+        Entity_T entityID = meshCompList.getEntity(i);
+
+        SkeletonMesh* skeMesh = mesh->isSkeletonMesh();
+        const bool preSkinned = skeMesh && skeMesh->mPreSkinned;
+        glm::mat4 entityWorld = MatIdent;
+        const glm::mat4* worldTrans = mWorld->mWorldTransforms.find(entityID);
+        if (worldTrans) {
+            entityWorld = (*worldTrans);
         }
-        mCBPerObject->updateData(&mPerObjectData);
 
         const auto& sml = mesh->getSubMeshList();
 
         for (auto it = sml.begin(); it != sml.end();++it) {
             SubMesh* sm = *it;
-            IGPUIndexBuffer* ib = sm->getIndexBuffer();
             Material* mat = sm->getMaterial();
 
-            if (pass == RenderPassType::DepthPass) {
-                if (mat->isTwoSided()) {
-                    //continue;
+            // only the lighting pass blends, the depth passes draw the two sided stuff as solid
+            const bool transparent = pass == RenderPassType::LightingPass && mat->isTwoSided();
+
+            // _drawStaticGeometry() has the solid parts
+            if (comp.mStaticBatched && mUseIndirectDraws && !transparent) {
+                continue;
+            }
+
+            AABB bb = getCullingBounds(mesh, sm);
+            bb.transform(entityWorld);
+
+            uint32_t cascadeMask = ALL_CASCADES_MASK;
+            if (pass == RenderPassType::SunShadowPass) {
+                cascadeMask = _getCascadeMask(bb);
+                if (cascadeMask == 0) {
+                    continue;
+                }
+            } else if (bounds) {
+                if (bb.intersect(*bounds) == INTERSECTION_TYPE::OUTSIDE) {
+                    continue;
                 }
+            } else if (!frustum->IsBoxVisible(bb.getMin(), bb.getMax())) {
+                continue;
             }
 
-            AABB bb = sm->getLocalBoundingBox();
-            bb.transform(mPerObjectData.world);
+            RenderItem item;
+            item.Mesh = sm;
+            item.BoneOffset = skeMesh ? (int32_t)skeMesh->mBonePaletteOffset : 0;
+            item.CascadeMask = cascadeMask;
+
+            if (transparent) {
+                // the transparent stuff is never skinned
+                item.VertexBuffer = sm->getVertexBuffer();
+                item.World = entityWorld;
+                item.Animated = 0;
+            } else {
+                item.VertexBuffer = preSkinned ? sm->getSkinnedVertexBuffer() : sm->getVertexBuffer();
+                item.Animated = (skeMesh && !preSkinned) ? (skeMesh->mCompactVertices ? 2 : 1) : 0;
+                if (skeMesh && pass == RenderPassType::LightingPass) {
+                    // the sub-mesh correction goes on the world side of the shared palette
+                    item.World = entityWorld * sm->tempMatInverse;
+                } else {
+                    item.World = entityWorld;
+                }
+            }
+
+            const float depth = glm::length(bb.getCenter() - viewPosition) / viewDistance;
+            const uint64_t key = RenderQueue::makeKey(pass, transparent, (uint32_t)item.Animated, mat->mSortId, sm->mSortId, depth);
+            mRenderQueue.submit(key, item);
+        }
+    }
+}
+
+void Game::_executeRenderQueue(enum RenderPassType pass, uint32_t begin, uint32_t end) {
+    const bool lightingPass = pass == RenderPassType::LightingPass;
+
+    Material* lastMaterial = nullptr;
+    IGPUResource* lastVertexBuffer = nullptr;
+    IGPUIndexBuffer* lastIndexBuffer = nullptr;
+    const RenderItem* lastItem = nullptr;
 
-            bool isVisibleToFrustum = false;
+    for (uint32_t i = begin; i < end; i++) {
+        const RenderItem& item = mRenderQueue.at(i);
+        SubMesh* sm = item.Mesh;
+        Material* mat = sm->getMaterial();
+        IGPUIndexBuffer* ib = sm->getIndexBuffer();
 
-            // BUG: ????!
-            if (skeMesh) {
-                isVisibleToFrustum = true;
+        Texture* textures[MATERIAL_TEXTURE_COUNT];
+        getPassTextures(pass, mat, textures);
+
+        const bool materialChanged = mat != lastMaterial;
+        for (int t = 0; t < MATERIAL_TEXTURE_COUNT; t++) {
+            if (textures[t] == nullptr) {
+                continue;
+            }
+            if (materialChanged) {
+                mRend->bindGPUTexture(textures[t]->getGPUResource(), t + 1);
+                mRenderQueueBinds++;
             } else {
-                isVisibleToFrustum = frustum->IsBoxVisible(bb.getMin(), bb.getMax());
+                mRenderQueueBindsSaved++;
+            }
+        }
+        if (lightingPass && materialChanged) {
+            mPerObjectData.hasNormalMap = textures[1] ? 1 : 0;
+            mPerObjectData.hasEmissionMap = textures[2] ? 1 : 0;
+            mPerObjectData.specularIntensity = mat->getSpecularColor().red;
+        }
+
+        // sub-meshes of the same entity usually share all of it
+        const bool objectChanged = lastItem == nullptr || (lightingPass && materialChanged) ||
+            item.Animated != lastItem->Animated || item.BoneOffset != lastItem->BoneOffset || item.World != lastItem->World ||
+            item.CascadeMask != lastItem->CascadeMask;
+        if (objectChanged) {
+            mPerObjectData.world = item.World;
+            mPerObjectData.cascadeMask = item.CascadeMask;
+            mPerObjectData.animated = item.Animated;
+            mPerObjectData.boneOffset = item.BoneOffset;
+            mRend->pushConstantData(mCBPerObject, &mPerObjectData, 1);
+            mRenderQueueBinds++;
+        } else {
+            mRenderQueueBindsSaved++;
+        }
+
+        if (item.VertexBuffer != lastVertexBuffer) {
+            mRend->bindResource(item.VertexBuffer);
+            mRenderQueueBinds++;
+        } else {
+            mRenderQueueBindsSaved++;
+        }
+        if (ib != lastIndexBuffer) {
+            mRend->bindResource(ib);
+            mRenderQueueBinds++;
+        } else {
+            mRenderQueueBindsSaved++;
+        }
+
+        mRend->draw(ib->getIndexCount());
+        totalDraw++;
+        mRenderQueueDraws++;
+
+        lastMaterial = mat;
+        lastVertexBuffer = item.VertexBuffer;
+        lastIndexBuffer = ib;
+        lastItem = &item;
+    }
+}
+
+void Game::_drawStaticGeometry(enum RenderPassType pass, Frustum* frustum, const AABB* bounds) {
+    if (!mUseIndirectDraws || mStaticGeometry == nullptr || mStaticGeometry->isEmpty()) {
+        return;
+    }
+    const bool lightingPass = pass == RenderPassType::LightingPass;
+    // nothing of the material is used by the point light shadows, one call does it all
+    const bool groupByMaterial = pass != RenderPassType::PointShadowPass;
+
+    mIndirectCommands.clear();
+    mIndirectGroups.clear();
+
+    const auto& draws = mStaticGeometry->mDraws;
+    for(auto it = draws.begin();it != draws.end();++it) {
+        const StaticDraw& draw = *it;
+        Material* mat = draw.Mesh->getMaterial();
+
+        // the transparent parts go through the render queue
+        if (lightingPass && mat->isTwoSided()) {
+            continue;
+        }
+        uint32_t cascadeMask = ALL_CASCADES_MASK;
+        if (pass == RenderPassType::SunShadowPass) {
+            cascadeMask = _getCascadeMask(draw.Bounds);
+            if (cascadeMask == 0) {
+                continue;
+            }
+        } else if (bounds) {
+            if (draw.Bounds.intersect(*bounds) == INTERSECTION_TYPE::OUTSIDE) {
+                continue;
             }
+        } else if (!frustum->IsBoxVisible(draw.Bounds.getMin(), draw.Bounds.getMax())) {
+            continue;
+        }
 
-            if (isVisibleToFrustum) {
-                Texture* dmap = mat->getDiffuseMap();
-                if (dmap) {
-                    auto gpur = dmap->getGPUResource();
-                    mRend->bindGPUTexture(gpur, 1);
-                    /*
-                    if (mat->isTwoSided()) {
-                        mPerObjectData.isTransparent = 1;
-                    }
-                    */
+        // the draws are sorted by material already
+        Material* groupMaterial = groupByMaterial ? mat : nullptr;
+        if (mIndirectGroups.empty() || mIndirectGroups.back().Mat != groupMaterial || mIndirectGroups.back().CascadeMask != cascadeMask) {
+            IndirectDrawGroup group;
+            group.Mat = groupMaterial;
+            group.CascadeMask = cascadeMask;
+            group.FirstCommand = (uint32_t)mIndirectCommands.size();
+            group.CommandCount = 0;
+            mIndirectGroups.push_back(group);
+        }
+        mIndirectGroups.back().CommandCount++;
+
+        DrawIndirectCommand command;
+        command.Count = draw.IndexCount;
+        command.InstanceCount = 1;
+        command.FirstIndex = draw.FirstIndex;
+        command.BaseVertex = (int32_t)draw.BaseVertex;
+        command.BaseInstance = 0;
+        mIndirectCommands.push_back(command);
+    }
+
+    if (mIndirectCommands.empty()) {
+        return;
+    }
+    mIndirectBuffer->updateData(&mIndirectCommands[0], (uint32_t)(mIndirectCommands.size() * sizeof(DrawIndirectCommand)));
+
+    // the merged vertices are in world space already
+    mPerObjectData.world = MatIdent;
+    mPerObjectData.animated = 0;
+    mPerObjectData.crowd = 0;
+
+    mRend->bindResource(mStaticGeometry->mVertexBuffer);
+    mRend->bindResource(mStaticGeometry->mIndexBuffer);
+
+    for(auto it = mIndirectGroups.begin();it != mIndirectGroups.end();++it) {
+        const IndirectDrawGroup& group = *it;
+        if (group.Mat) {
+            Texture* textures[MATERIAL_TEXTURE_COUNT];
+            getPassTextures(pass, group.Mat, textures);
+            for (int t = 0; t < MATERIAL_TEXTURE_COUNT; t++) {
+                if (textures[t]) {
+                    mRend->bindGPUTexture(textures[t]->getGPUResource(), t + 1);
                 }
-                mRend->bindResource(sm->getVertexBuffer());
-                mRend->bindResource(ib);
-                mRend->draw(ib->getIndexCount());
-                totalDraw++;
             }
+            if (lightingPass) {
+                mPerObjectData.hasNormalMap = textures[1] ? 1 : 0;
+                mPerObjectData.hasEmissionMap = textures[2] ? 1 : 0;
+                mPerObjectData.specularIntensity = group.Mat->getSpecularColor().red;
+            }
+        }
+        mPerObjectData.cascadeMask = group.CascadeMask;
+        mRend->pushConstantData(mCBPerObject, &mPerObjectData, 1);
+        mRend->drawIndirect(mIndirectBuffer, group.FirstCommand, group.CommandCount);
+        mIndirectCalls++;
+        totalDraw++;
+    }
+    mIndirectDraws += (uint32_t)mIndirectCommands.size();
+}
+
+void Game::_renderSunShadows() {
+    const float cameraFarPlane = mCamera->getFar();
+    const float shadowCascadeLevels[MAX_CSSM_SPLITS] = { cameraFarPlane / 15, cameraFarPlane / 5, cameraFarPlane };
+    const int mapSize = (int)CASCADE_SHADOW_MAP_SIZE;
+
+    // the cascades keep the old direction until the sun really turned, the cached depth was rendered with it
+    const glm::vec3 sunDirection = glm::normalize(mSunLight->getDirection());
+    if (glm::dot(sunDirection, mShadowSunDirection) < 0.99999f) {
+        mShadowSunDirection = sunDirection;
+        for (int c = 0; c < MAX_CSSM_SPLITS; c++) {
+            mStaticShadowValid[c] = false;
+        }
+    }
+
+    ShadowCascade cascades[MAX_CSSM_SPLITS];
+    for (int c = 0; c < MAX_CSSM_SPLITS; c++) {
+        const float nearPlane = c == 0 ? mCamera->getNear() : shadowCascadeLevels[c - 1];
+        cascades[c] = getShadowCascade(mShadowSunDirection, mPerFrameData.view, mCamera->getFOV(), nearPlane, shadowCascadeLevels[c]);
+
+        mCascadedShadowData.splits[c] = cascades[c].ViewProj;
+        mCascadeFrustums[c] = Frustum(cascades[c].ViewProj);
+    }
+    mCascadedShadowData.cascadePlaneDistances.x = shadowCascadeLevels[0];
+    mCascadedShadowData.cascadePlaneDistances.y = shadowCascadeLevels[1];
+    mCascadedShadowData.cascadePlaneDistances.z = shadowCascadeLevels[2];
+    mCascadedShadowData.cascadePlaneDistances.w = 0;
+
+    mCBCascadedShadow->updateData(&mCascadedShadowData);
+
+    float timerMs;
+    uint32_t timerTag;
+    if (mShadowTimer->getResult(timerMs, timerTag)) {
+        if (timerTag == SHADOW_TIMER_FULL) {
+            mShadowFullMs = timerMs;
+        } else {
+            mShadowCachedMs = timerMs;
+        }
+    }
+
+    // Direction/Sun light depth pass for cascaded shadow map, one traversal for all of them.
+    // Every draw goes to the layers in its cascade mask (see shadow_depth.geom)
+    mRend->bindResource(shadowDepthProgram);
+
+    const bool cacheStatic = mCacheStaticShadows && mUseIndirectDraws && mStaticGeometry && !mStaticGeometry->isEmpty();
+    if (!cacheStatic || mFrameIndex % SHADOW_FULL_REDRAW_INTERVAL == 0) {
+        // also every so often with the cache on, so there is a recent full pass to compare with
+        for (int c = 0; c < MAX_CSSM_SPLITS; c++) {
+            mStaticShadowValid[c] = false;
+        }
+    }
+    if (!cacheStatic) {
+        mShadowTexelsRedrawn = MAX_CSSM_SPLITS * mapSize * mapSize;
+
+        mShadowTimer->begin(SHADOW_TIMER_FULL);
+        mRend->bindFrameBuffer(mCascadedShadowFBO, {1.0f, 1.0f, 1.0f, 1.0f});
+        renderScene(RenderPassType::SunShadowPass, nullptr);
+        mShadowTimer->end();
+        return;
+    }
+
+    IGPUTexture* shadowMap = mCascadedShadowFBO->getDepthAttachmentId();
+    IGPUTexture* staticCache = mStaticShadowCacheFBO->getDepthAttachmentId();
+
+    // what has to be drawn again: whole cascades, and the strips a scroll uncovered
+    struct ShadowRegion {
+        int Cascade;
+        int X, Y, Width, Height;
+    };
+    std::vector<ShadowRegion> regions;
+    uint32_t redrawMask = 0;
+
+    for (int c = 0; c < MAX_CSSM_SPLITS; c++) {
+        const ShadowCascade& cascade = cascades[c];
+        const ShadowCascade& cached = mStaticCascades[c];
+
+        if (!mStaticShadowValid[c] || cascade.Radius != cached.Radius || cascade.DepthCenter != cached.DepthCenter ||
+            std::abs(cascade.TexelX - cached.TexelX) >= mapSize || std::abs(cascade.TexelY - cached.TexelY) >= mapSize) {
+            redrawMask |= 1 << c;
+        }
+    }
+
+    mShadowTimer->begin(redrawMask == ALL_CASCADES_MASK ? SHADOW_TIMER_FULL : SHADOW_TIMER_CACHED);
+
+    uint32_t changedMask = redrawMask;
+    for (int c = 0; c < MAX_CSSM_SPLITS; c++) {
+        if (redrawMask & (1 << c)) {
+            continue;
+        }
+        const int dx = cascades[c].TexelX - mStaticCascades[c].TexelX;
+        const int dy = cascades[c].TexelY - mStaticCascades[c].TexelY;
+
+        // the texels both have in common, a texel moves the other way the cascade does
+        const int width = mapSize - std::abs(dx);
+        const int height = mapSize - std::abs(dy);
+        mRend->copyTextureRegion(staticCache, c, std::max(dx, 0), std::max(dy, 0),
+                                 shadowMap, c, std::max(-dx, 0), std::max(-dy, 0), width, height);
+
+        if (dx != 0) {
+            regions.push_back({c, dx > 0 ? mapSize - dx : 0, 0, std::abs(dx), mapSize});
+        }
+        if (dy != 0) {
+            regions.push_back({c, 0, dy > 0 ? mapSize - dy : 0, mapSize, std::abs(dy)});
+        }
+        if (dx != 0 || dy != 0) {
+            changedMask |= 1 << c;
+        }
+    }
+
+    // no clear, every layer has been copied from the cache or gets redrawn
+    mRend->bindFrameBuffer(mCascadedShadowFBO, {1.0f, 1.0f, 1.0f, 1.0f}, false);
+
+    mShadowTexelsRedrawn = 0;
+    if (redrawMask) {
+        for (int c = 0; c < MAX_CSSM_SPLITS; c++) {
+            if (redrawMask & (1 << c)) {
+                mRend->clearDepthRegion(shadowMap, c, 0, 0, mapSize, mapSize, 1.0f);
+                mShadowTexelsRedrawn += mapSize * mapSize;
+            }
+        }
+        mActiveCascadeMask = redrawMask;
+        _drawStaticGeometry(RenderPassType::SunShadowPass, nullptr, nullptr);
+    }
+    for(auto it = regions.begin();it != regions.end();++it) {
+        const ShadowRegion& region = *it;
+        mRend->clearDepthRegion(shadowMap, region.Cascade, region.X, region.Y, region.Width, region.Height, 1.0f);
+        mShadowTexelsRedrawn += region.Width * region.Height;
+
+        mActiveCascadeMask = 1 << region.Cascade;
+        mRend->setScissor(true, region.X, region.Y, region.Width, region.Height);
+        _drawStaticGeometry(RenderPassType::SunShadowPass, nullptr, nullptr);
+    }
+    mRend->setScissor(false, 0, 0, 0, 0);
+    mActiveCascadeMask = ALL_CASCADES_MASK;
+
+    // the static depth of the cascades that moved is what gets scrolled next frame
+    for (int c = 0; c < MAX_CSSM_SPLITS; c++) {
+        if (changedMask & (1 << c)) {
+            mRend->copyTextureRegion(shadowMap, c, 0, 0, staticCache, c, 0, 0, mapSize, mapSize);
+            mStaticCascades[c] = cascades[c];
+            mStaticShadowValid[c] = true;
         }
     }
+
+    // dynamic casters on top, the static geometry isn't in the queue
+    mRenderQueue.clear();
+    _queueMeshes(RenderPassType::SunShadowPass, nullptr, nullptr, glm::vec3(mPerFrameData.cameraPosition), mPerFrameData.cameraFar);
+    mRenderQueue.sort();
+    _executeRenderQueue(RenderPassType::SunShadowPass, 0, mRenderQueue.size());
+
+    mPerObjectData.cascadeMask = ALL_CASCADES_MASK;
+    _drawCrowds(false);
+
+    mShadowTimer->end();
+}
+
+void Game::renderScene(enum RenderPassType pass, Frustum* frustum) {
+    _drawStaticGeometry(pass, frustum, nullptr);
+
+    mRenderQueue.clear();
+    _queueMeshes(pass, frustum, nullptr, glm::vec3(mPerFrameData.cameraPosition), mPerFrameData.cameraFar);
+    mRenderQueue.sort();
+    _executeRenderQueue(pass, 0, mRenderQueue.size());
+
+    // the crowd instances aren't culled one by one
+    mPerObjectData.cascadeMask = ALL_CASCADES_MASK;
+    _drawCrowds(false);
 }
 
 void Game::_bindShaders() {
@@ -286,11 +1137,7 @@ void Game::_bindShaders() {
     mRend->bindConstantBuffer(mCBPerFrame, CBBT_VS, 0);
     mRend->bindConstantBuffer(mCBPerFrame, CBBT_PS, 0);
 
-    mRend->bindConstantBuffer(mCBPerObject, CBBT_VS, 1);
-    mRend->bindConstantBuffer(mCBPerObject, CBBT_PS, 1);
-
-    mRend->bindConstantBuffer(mCBLightArray, CBBT_VS, 2);
-    mRend->bindConstantBuffer(mCBLightArray, CBBT_PS, 2);
+    // the per object data (binding 1) gets bound with every push to mCBPerObject
 
     mRend->bindConstantBuffer(mCBShadowCube, CBBT_GS, 3);
     mRend->bindConstantBuffer(mCBShadowCube, CBBT_PS, 3);
@@ -302,14 +1149,24 @@ void Game::_bindShaders() {
     mRend->bindConstantBuffer(mCBPostProcess, CBBT_VS, 5);
     mRend->bindConstantBuffer(mCBPostProcess, CBBT_PS, 5);
 
-    mRend->bindConstantBuffer(mCBCascadedShadowProj, CBBT_VS, 6);
-    mRend->bindConstantBuffer(mCBCascadedShadowProj, CBBT_PS, 6);
-
     mRend->bindConstantBuffer(mCBCascadedShadow, CBBT_VS, 7);
+    mRend->bindConstantBuffer(mCBCascadedShadow, CBBT_GS, 7);
     mRend->bindConstantBuffer(mCBCascadedShadow, CBBT_PS, 7);
 
+    mRend->bindConstantBuffer(mCBSkinning, CBBT_VS, 8);
+
     // animation bones data buffer
-    mRend->bindConstantBuffer(mCBPerAnimatedObject, CBBT_VS, 8);
+    mRend->bindStorageBuffer(mBonePaletteBuffer, 0);
+
+    // baked crowd animations and the crowd instances
+    mRend->bindStorageBuffer(mBakedFrameBuffer, 3);
+    mRend->bindStorageBuffer(mBakedClipBuffer, 4);
+    mRend->bindStorageBuffer(mCrowdInstanceBuffer, 5);
+
+    // clustered lighting
+    mRend->bindStorageBuffer(mLightBuffer, 6);
+    mRend->bindStorageBuffer(mClusterBuffer, 7);
+    mRend->bindStorageBuffer(mClusterLightIndexBuffer, 8);
 }
 
 void Game::render() {
@@ -318,6 +1175,13 @@ void Game::render() {
         mCurrentState->render();
     }
 */
+    // the GUI draws with its own GL calls at the end of the frame
+    mRend->invalidateState();
+
+    // per object blocks of the frame before last are free again
+    mCBPerObject->nextFrame();
+    mFrameIndex++;
+
     _preparePerFrameData();
 
     // We just need to bind them for once
@@ -331,14 +1195,30 @@ void Game::render() {
     // also provide the point light array
     _prepareLightData();
 
+    // and the bones of every skinned mesh, all the passes share them
+    _prepareBonePalettes();
+
+    // skinned meshes can be skinned up front, then every pass draws them like static ones
+    _preSkinMeshes();
+
+    // crowds don't have skeletons, just their instances to upload
+    _prepareCrowds();
+
     mPerObjectData.world = model;
     mPerObjectData.hasNormalMap = 0;
     mPerObjectData.hasEmissionMap = 0;
     mPerObjectData.specularIntensity = 0;
     mPerObjectData.animated = 0;
-    mCBPerObject->updateData(&mPerObjectData);
+    mPerObjectData.crowd = 0;
+    mPerObjectData.cascadeMask = ALL_CASCADES_MASK;
+    mRend->pushConstantData(mCBPerObject, &mPerObjectData, 1);
 
     totalDraw = 0;
+    mRenderQueueDraws = 0;
+    mRenderQueueBinds = 0;
+    mRenderQueueBindsSaved = 0;
+    mIndirectDraws = 0;
+    mIndirectCalls = 0;
 
     Frustum mainCameraFrustum(mPerFrameData.proj * mPerFrameData.view);
 
@@ -353,129 +1233,43 @@ void Game::render() {
     }
 
     if (mPerFrameData.sunEnableShadow) {
-        const float cameraFarPlane = mCamera->getFar();
-        std::vector<float> shadowCascadeLevels{ cameraFarPlane / 15, cameraFarPlane / 5, cameraFarPlane };
-
-        auto lightMatrics = getLightSpaceMatrices(mCamera, shadowCascadeLevels, mPerFrameData.view);
-
-        mCascadedShadowData.cascadePlaneDistances.x = shadowCascadeLevels[0];
-        mCascadedShadowData.cascadePlaneDistances.y = shadowCascadeLevels[1];
-        mCascadedShadowData.cascadePlaneDistances.z = shadowCascadeLevels[2];
-        mCascadedShadowData.cascadePlaneDistances.w = 0;
-
-        mCascadedShadowData.splits[0] = lightMatrics[0];
-        mCascadedShadowData.splits[1] = lightMatrics[1];
-        mCascadedShadowData.splits[2] = lightMatrics[2];
-
-        mCBCascadedShadow->updateData(&mCascadedShadowData);
-
-        // Direction/Sun light depth pass for cascaded shadow map...
-        mRend->bindResource(shadowDepthProgram);
-
-        cbCascadedShadowProj shadowProj;
-        Frustum cascadedFrustum;
-
-        mRend->bindFrameBuffer(mCascadedFBOSplit1, {1.0f, 1.0f, 1.0f, 1.0f});
-        shadowProj.lightProjView = mCascadedShadowData.splits[0];
-        mCBCascadedShadowProj->updateData(&shadowProj);
-
-        cascadedFrustum = Frustum(shadowProj.lightProjView);
-        renderScene(RenderPassType::SunShadowPass, &cascadedFrustum);
-
-        mRend->bindFrameBuffer(mCascadedFBOSplit2, {1.0f, 1.0f, 1.0f, 1.0f});
-        shadowProj.lightProjView = mCascadedShadowData.splits[1];
-        mCBCascadedShadowProj->updateData(&shadowProj);
-
-        cascadedFrustum = Frustum(shadowProj.lightProjView);
-        renderScene(RenderPassType::SunShadowPass, &cascadedFrustum);
-
-        mRend->bindFrameBuffer(mCascadedFBOSplit3, {1.0f, 1.0f, 1.0f, 1.0f});
-        shadowProj.lightProjView = mCascadedShadowData.splits[2];
-        mCBCascadedShadowProj->updateData(&shadowProj);
-
-        cascadedFrustum = Frustum(shadowProj.lightProjView);
-        renderScene(RenderPassType::SunShadowPass, &cascadedFrustum);
+        _renderSunShadows();
     }
 
-    // Cube depth map
-    const auto& lightList = mWorld->mPointLightComponents;
-
-    if (lightList.size() > 0) {
+    // Cube depth map, only for the lights _scheduleShadowUpdates() picked, the rest keep the map they have
+    if (mPointShadowsRedrawn > 0) {
         cbShadowCube data;
 
         mRend->bindResource(shadowCubeDepthProgram);
 
-        int totalVisbleLight = 0;
+        for(auto it = mVisibleLights.begin();it != mVisibleLights.end();++it) {
+            PointLight* pointLight = it->Light;
 
-        for(auto it = lightList.begin();it != lightList.end();it++) {
-            PointLight* pointLight = it->second;
+            if (!it->UpdateShadow) {
+                continue;
+            }
 
-            if (pointLight->isEnabled() && pointLight->isCastingShadow()) {
+            // the same world space position and range the lighting pass uses
+            const glm::vec3& lightPos = it->Position;
+            const AABB lightBB(lightPos, pointLight->getFarPlane());
 
-                const AABB lightBB = pointLight->getBoundingBox();
+            data.lightPos = glm::vec4(lightPos, pointLight->getFarPlane());
+            pointLight->getShadowViewProj(lightPos, data.shadowMatrices);
 
-                const glm::vec3& lightPos = pointLight->getPosition();
+            mCBShadowCube->updateData(&data);
 
-                data.lightPos = glm::vec4(lightPos, pointLight->getFarPlane());
+            mRend->bindFrameBuffer(pointLight->getShadowMapFBO(), {1.0f, 1.0f, 1.0f, 1.0f});
 
-                for (int m = 0;m < 6;m++) {
-                    data.shadowMatrices[m] = pointLight->getShadowViewProj(m);
-                }
+            _drawStaticGeometry(RenderPassType::PointShadowPass, nullptr, &lightBB);
 
-                mCBShadowCube->updateData(&data);
-
-                mRend->bindFrameBuffer(pointLight->getShadowMapFBO(), {1.0f, 1.0f, 1.0f, 1.0f});
-
-                if (mainCameraFrustum.IsBoxVisible(lightBB.getMin(), lightBB.getMax())) {
-                    totalVisbleLight++;
-
-                    for(auto itEnt = meshCompList.begin(); itEnt != meshCompList.end();++itEnt) {
-                        const MeshComponent& comp = itEnt->second;
-                        Mesh* mesh = comp.mMesh;
-                        Entity_T entityID = itEnt->first;
-
-                        SkeletonMesh* skeMesh = mesh->isSkeletonMesh();
-                        if (skeMesh) {
-                            Skeleton* skeleton = skeMesh->getSkeleton();
-
-                            for(auto it = skeMesh->mBoneInfoMap.begin(); it != skeMesh->mBoneInfoMap.end();++it){
-                                const BoneInfo& boneInfo = it->second;
-
-                                Bone* bone = skeleton->getBone(it->first);
-                                assert(boneInfo.id < MAX_BONES);
-                                mPerAnimatedObjectData.gBones[boneInfo.id] = bone->mWorldTransform * boneInfo.offset;
-                            }
-                            mCBPerAnimatedObject->updateData(&mPerAnimatedObjectData);
-
-                            mPerObjectData.animated = 1;
-                        } else {
-                            mPerObjectData.animated = 0;
-                        }
-                        auto itTrans = mWorld->mWorldTransforms.find(entityID);
-                        if (itTrans != mWorld->mWorldTransforms.end()) {
-                            mPerObjectData.world = itTrans->second;
-                        } else {
-                            mPerObjectData.world = model;
-                        }
-                        mCBPerObject->updateData(&mPerObjectData);
-
-                        const auto& sml = mesh->getSubMeshList();
-
-                        for (auto it = sml.begin(); it != sml.end();++it) {
-                            SubMesh* sm = *it;
-
-                            INTERSECTION_TYPE result = sm->getLocalBoundingBox().intersect(lightBB);
-
-                            if (result != INTERSECTION_TYPE::OUTSIDE) {
-                                IGPUIndexBuffer* ib = sm->getIndexBuffer();
-                                mRend->bindResource(sm->getVertexBuffer());
-                                mRend->bindResource(ib);
-                                mRend->draw(ib->getIndexCount());
-                            }
-                        }
-                    }
-                }
-            }
+            mRenderQueue.clear();
+            _queueMeshes(RenderPassType::PointShadowPass, nullptr, &lightBB, lightPos, pointLight->getFarPlane());
+            mRenderQueue.sort();
+            _executeRenderQueue(RenderPassType::PointShadowPass, 0, mRenderQueue.size());
+
+            _drawCrowds(false);
+
+            pointLight->setShadowMapUpdated(it->ShadowSignature, mFrameIndex);
         }
     }
     // Lighting Pass
@@ -485,15 +1279,15 @@ void Game::render() {
     mRend->bindResource(skyProgram);
     mRend->bindGPUTexture(mSkyTexture->getGPUResource(), 3);
 
-    glDisable(GL_CULL_FACE);
-    glDepthMask(GL_FALSE);
+    mRend->setCulling(false);
+    mRend->setDepthWrite(false);
     mRend->setDepthTest(false);
 
     mRend->bindResource(mSkyBoxVB);
     mRend->drawNonIndexed(mSkyBoxVB->getVertexCount());
 
-    glDepthMask(GL_TRUE);
-    glEnable(GL_CULL_FACE);
+    mRend->setDepthWrite(true);
+    mRend->setCulling(true);
     mRend->setDepthTest(true);
 
 
@@ -503,196 +1297,42 @@ void Game::render() {
 
     if (mPerFrameData.sunEnableShadow) {
         // Directional/Sun Light Cascaded Shadow Map
-        IGPUTexture* split1 = mCascadedFBOSplit1->getDepthAttachmentId();
-        IGPUTexture* split2 = mCascadedFBOSplit2->getDepthAttachmentId();
-        IGPUTexture* split3 = mCascadedFBOSplit3->getDepthAttachmentId();
-
-        mRend->bindGPUTexture(split1, 6);
-        mRend->bindGPUTexture(split2, 7);
-        mRend->bindGPUTexture(split3, 8);
+        mRend->bindGPUTexture(mCascadedShadowFBO->getDepthAttachmentId(), 6);
     }
 
     // First, bind all the scene lights depth map textures (from the cube depth pass)
     // so that we can use them to project shadows in our lighting shader/pass
-    int cubeShadowMapStartIndex = 9;
-    for(auto it = lightList.begin();it != lightList.end();it++) {
-        PointLight* pointLight = it->second;
-
-        if (pointLight->isEnabled() && pointLight->isCastingShadow()) {
-
-            IGPUTexture* tex = pointLight->getShadowMapFBO()->getDepthAttachmentId();
+    const int cubeShadowMapStartIndex = 9;
+    for(auto it = mVisibleLights.begin();it != mVisibleLights.end();++it) {
+        if (it->ShadowCubeMap >= 0) {
+            IGPUTexture* tex = it->Light->getShadowMapFBO()->getDepthAttachmentId();
 
-            mRend->bindGPUTexture(tex, cubeShadowMapStartIndex);
-            cubeShadowMapStartIndex++;
+            mRend->bindGPUTexture(tex, cubeShadowMapStartIndex + it->ShadowCubeMap);
         }
     }
 
-    // Draw level (Only Solid Stuffs)
-
-    for(auto itEnt = meshCompList.begin(); itEnt != meshCompList.end();++itEnt) {
-        const MeshComponent& comp = itEnt->second;
-        Mesh* mesh = comp.mMesh;
-        Entity_T entityID = itEnt->first;
-
-        SkeletonMesh* skeMesh = mesh->isSkeletonMesh();
-        auto itTrans = mWorld->mWorldTransforms.find(entityID);
-        if (itTrans != mWorld->mWorldTransforms.end()) {
-            mPerObjectData.world = itTrans->second;
-        } else {
-            mPerObjectData.world = model;
-        }
+    // Draw level, the transparent bit of the keys puts the transparent stuff after the solid stuff
+    mRenderQueue.clear();
+    _queueMeshes(RenderPassType::LightingPass, &mainCameraFrustum, nullptr, glm::vec3(mPerFrameData.cameraPosition), mPerFrameData.cameraFar);
+    mRenderQueue.sort();
 
-        const auto& sml = mesh->getSubMeshList();
-
-        for (auto it = sml.begin(); it != sml.end();++it) {
-            SubMesh* sm = *it;
-            Material* mat = sm->getMaterial();
-
-            if (mat->isTwoSided()) {
-                continue;
-            }
-
-            if (skeMesh) {
-                Skeleton* skeleton = skeMesh->getSkeleton();
-                for(auto it = skeMesh->mBoneInfoMap.begin(); it != skeMesh->mBoneInfoMap.end();++it){
-                    const BoneInfo& boneInfo = it->second;
-
-                    Bone* bone = skeleton->getBone(it->first);
-                    assert(boneInfo.id < MAX_BONES);
-                    mPerAnimatedObjectData.gBones[boneInfo.id] = glm::inverse(sm->tempMat) * bone->getWorldTransform() * boneInfo.offset;
-                }
-                mCBPerAnimatedObject->updateData(&mPerAnimatedObjectData);
-
-                mPerObjectData.animated = 1;
-            } else {
-                mPerObjectData.animated = 0;
-            }
-
-            AABB bb = sm->getLocalBoundingBox();
-            bb.transform(mPerObjectData.world);
-
-            bool isVisibleToCam = false;
-
-            // BUG: ????!
-            if (skeMesh) {
-                isVisibleToCam = true;
-            } else {
-                isVisibleToCam = mainCameraFrustum.IsBoxVisible(bb.getMin(), bb.getMax());
-            }
+    const uint32_t firstTransparent = mRenderQueue.lowerBound(RenderQueue::makeKey(RenderPassType::LightingPass, true, 0, 0, 0, 1.0f));
 
-            if (isVisibleToCam) {
-
-                mPerObjectData.hasNormalMap = 0;
-                mPerObjectData.hasEmissionMap = 0;
-
-                mPerObjectData.specularIntensity = mat->getSpecularColor().red;
-
-                if (mat) {
-
-                    Texture* dmap = mat->getDiffuseMap();
-                    if (dmap) {
-                        auto gpur = dmap->getGPUResource();
-                        mRend->bindGPUTexture(gpur, 1);
-                    }
-                    Texture* nmap = mat->getNormalMap();
-                    if (nmap) {
-                        auto gpur = nmap->getGPUResource();
-                        mRend->bindGPUTexture(gpur, 2);
-                        mPerObjectData.hasNormalMap = 1;
-                    }
-                    Texture* emap = mat->getEmissionMap();
-                    if (emap) {
-                        auto gpur = emap->getGPUResource();
-                        mRend->bindGPUTexture(gpur, 3);
-                        mPerObjectData.hasEmissionMap = 1;
-                    }
-
-                    if (mat->mMetalnessMap) {
-                        auto gpur = mat->mMetalnessMap->getGPUResource();
-                        mRend->bindGPUTexture(gpur, 4);
-                        //mPerObjectData.hasMetalnessMap = 1;
-                    }
-
-                    if (mat->mRoughnessMap) {
-                        auto gpur = mat->mRoughnessMap->getGPUResource();
-                        mRend->bindGPUTexture(gpur, 5);
-                        //mPerObjectData.hasRoughnessMap = 1;
-                    }
-                }
+    // Draw level (Only Solid Stuffs)
+    _drawStaticGeometry(RenderPassType::LightingPass, &mainCameraFrustum, nullptr);
+    _executeRenderQueue(RenderPassType::LightingPass, 0, firstTransparent);
 
-                mCBPerObject->updateData(&mPerObjectData);
-
-                IGPUIndexBuffer* ib = sm->getIndexBuffer();
-                mRend->bindResource(sm->getVertexBuffer());
-                mRend->bindResource(ib);
-                mRend->draw(ib->getIndexCount());
-                totalDraw++;
-            }
-        }
-    }
+    // Draw crowds (Only Solid Stuffs)
+    _drawCrowds(true);
 
     // Draw level (Only Transparent Stuffs)
-    glDisable(GL_CULL_FACE);
-    glEnable(GL_BLEND);
-    glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
-
-    for(auto itEnt = meshCompList.begin(); itEnt != meshCompList.end();++itEnt) {
-        const MeshComponent& comp = itEnt->second;
-        Mesh* mesh = comp.mMesh;
-        Entity_T entityID = itEnt->first;
+    mRend->setCulling(false);
+    mRend->setBlending(true);
 
-        mPerObjectData.animated = 0;
-        auto itTrans = mWorld->mWorldTransforms.find(entityID);
-        if (itTrans != mWorld->mWorldTransforms.end()) {
-            mPerObjectData.world = itTrans->second;
-        } else {
-            mPerObjectData.world = model;
-        }
-
-        const auto& sml = mesh->getSubMeshList();
-
-        for (auto it = sml.begin(); it != sml.end();++it) {
-            SubMesh* sm = *it;
-            Material* mat = sm->getMaterial();
-
-            if (!mat->isTwoSided()) {
-                continue;
-            }
-
-            mPerObjectData.hasNormalMap = 0;
-            mPerObjectData.hasEmissionMap = 0;
-            mPerObjectData.specularIntensity = mat->getSpecularColor().red;
+    _executeRenderQueue(RenderPassType::LightingPass, firstTransparent, mRenderQueue.size());
 
-            if (mat) {
-
-                Texture* dmap = mat->getDiffuseMap();
-                if (dmap) {
-                    auto gpur = dmap->getGPUResource();
-                    mRend->bindGPUTexture(gpur, 1);
-                }
-                Texture* nmap = mat->getNormalMap();
-                if (nmap) {
-                    auto gpur = nmap->getGPUResource();
-                    mRend->bindGPUTexture(gpur, 2);
-                    mPerObjectData.hasNormalMap = 1;
-                }
-                Texture* emap = mat->getEmissionMap();
-                if (emap) {
-                    auto gpur = emap->getGPUResource();
-                    mRend->bindGPUTexture(gpur, 3);
-                    mPerObjectData.hasEmissionMap = 1;
-                }
-            }
-
-            mCBPerObject->updateData(&mPerObjectData);
-
-            IGPUIndexBuffer* ib = sm->getIndexBuffer();
-            mRend->bindResource(sm->getVertexBuffer());
-            mRend->bindResource(ib);
-            mRend->draw(ib->getIndexCount());
-            totalDraw++;
-        }
-    }
+    // Draw crowds (Only Transparent Stuffs)
+    _drawCrowds(true, true);
 
     sprintf(debugText, "sub mesh rendered %d", totalDraw);
 
@@ -702,27 +1342,27 @@ void Game::render() {
     mRend->bindResource(fxProgram);
     mRend->bindQuadBuffer(mMuzzleQuad);
 
-    for (auto it = billboradCompList.begin();it != billboradCompList.end();it++) {
-        const BillboardComponent& billoard = it->second;
-        Entity_T entityID = it->first;
+    for (size_t i = 0;i < billboradCompList.size();i++) {
+        const BillboardComponent& billoard = billboradCompList.at(i);
+        Entity_T entityID = billboradCompList.getEntity(i);
 
-        auto itTrans = mWorld->mWorldTransforms.find(entityID);
-        if (itTrans != mWorld->mWorldTransforms.end()) {
-            mPerObjectData.world = itTrans->second;
+        const glm::mat4* worldTrans = mWorld->mWorldTransforms.find(entityID);
+        if (worldTrans) {
+            mPerObjectData.world = (*worldTrans);
         } else {
             mPerObjectData.world = glm::mat4(1.0);
         }
 
         mPerObjectData.opacity = billoard.Opacity;
-        mCBPerObject->updateData(&mPerObjectData);
+        mRend->pushConstantData(mCBPerObject, &mPerObjectData, 1);
 
         mRend->bindGPUTexture(billoard.Image->getGPUResource(), 3);
 
         mRend->draw(mMuzzleQuad->getIndexCount());
     }
 
-    glEnable(GL_CULL_FACE);
-    glDisable(GL_BLEND);
+    mRend->setCulling(true);
+    mRend->setBlending(false);
 /*
     glm::mat4 matObject(1.0);
 
@@ -731,22 +1371,22 @@ void Game::render() {
     mRend->bindResource(mBoneVB);
     mRend->bindResource(mBoneIB);
     mRend->setDepthTest(false);
-    for(auto itEnt = meshCompList.begin(); itEnt != meshCompList.end();++itEnt) {
-        const MeshComponent& comp = itEnt->second;
+    for(size_t i = 0; i < meshCompList.size();++i) {
+        const MeshComponent& comp = meshCompList.at(i);
         Mesh* mesh = comp.mMesh;
-        Entity_T entityID = itEnt->first;
+        Entity_T entityID = meshCompList.getEntity(i);
 
-        auto itTrans = mWorld->mWorldTransforms.find(entityID);
-        if (itTrans != mWorld->mWorldTransforms.end()) {
-            matObject = itTrans->second;
+        const glm::mat4* worldTrans = mWorld->mWorldTransforms.find(entityID);
+        if (worldTrans) {
+            matObject = (*worldTrans);
         }
 
         SkeletonMesh* skeMesh = mesh->isSkeletonMesh();
         if (skeMesh) {
             Skeleton* skeleton = skeMesh->getSkeleton();
 
-            for(auto it = skeleton->mBoneList.begin(); it != skeleton->mBoneList.end();++it){
-                Bone* bone = it->second;
+            for(auto it = skeleton->mBones.begin(); it != skeleton->mBones.end();++it){
+                Bone* bone = *it;
 
                 glm::vec3 size = glm::vec3(0.2, 1, 0.2);
                 glm::vec3 center2 = glm::vec3(0, 0, 0);
@@ -754,7 +1394,7 @@ void Game::render() {
 
                 mPerObjectData.world = bone->mWorldTransform * transform;
                 mPerObjectData.opacity = 1;
-                mCBPerObject->updateData(&mPerObjectData);
+                mRend->pushConstantData(mCBPerObject, &mPerObjectData, 1);
 
                 glDrawElements(GL_LINE_LOOP, 4, GL_UNSIGNED_INT, 0);
                 glDrawElements(GL_LINE_LOOP, 4, GL_UNSIGNED_INT, (GLvoid*)(4*sizeof(GLuint)));
@@ -770,17 +1410,17 @@ void Game::render() {
     mRend->bindResource(mBoundingBoxVB);
     mRend->bindResource(mBoundingBoxIB);
 
-    for(auto itEnt = meshCompList.begin(); itEnt != meshCompList.end();++itEnt) {
-        const MeshComponent& comp = itEnt->second;
+    for(size_t i = 0; i < meshCompList.size();++i) {
+        const MeshComponent& comp = meshCompList.at(i);
         Mesh* mesh = comp.mMesh;
-        Entity_T entityID = itEnt->first;
+        Entity_T entityID = meshCompList.getEntity(i);
 
         glm::mat4 bbTransform = glm::mat4(1.0f);
         char hasWorldTransform = 0;
 
-        auto itTrans = mWorld->mWorldTransforms.find(entityID);
-        if (itTrans != mWorld->mWorldTransforms.end()) {
-            bbTransform = itTrans->second;
+        const glm::mat4* worldTrans = mWorld->mWorldTransforms.find(entityID);
+        if (worldTrans) {
+            bbTransform = (*worldTrans);
         }
 
         const auto& sml = mesh->getSubMeshList();
@@ -804,7 +1444,7 @@ void Game::render() {
 
             mPerObjectData.world = transform;
             mPerObjectData.opacity = 1;
-            mCBPerObject->updateData(&mPerObjectData);
+            mRend->pushConstantData(mCBPerObject, &mPerObjectData, 1);
 
             glDrawElements(GL_LINE_LOOP, 4, GL_UNSIGNED_INT, 0);
             glDrawElements(GL_LINE_LOOP, 4, GL_UNSIGNED_INT, (GLvoid*)(4*sizeof(GLuint)));
@@ -831,7 +1471,7 @@ void Game::render() {
 
         mPerObjectData.world = transform;
         mPerObjectData.opacity = 1;
-        mCBPerObject->updateData(&mPerObjectData);
+        mRend->pushConstantData(mCBPerObject, &mPerObjectData, 1);
 
         glDrawElements(GL_LINE_LOOP, 4, GL_UNSIGNED_INT, 0);
         glDrawElements(GL_LINE_LOOP, 4, GL_UNSIGNED_INT, (GLvoid*)(4*sizeof(GLuint)));
@@ -841,9 +1481,8 @@ void Game::render() {
 
 
     // Draw Bullet Projectiles
-    glDisable(GL_CULL_FACE);
-    glEnable(GL_BLEND);
-    glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+    mRend->setCulling(false);
+    mRend->setBlending(true);
 
     mRend->bindResource(projectileProgram);
     mRend->bindResource(mProjectileVB);
@@ -853,7 +1492,7 @@ void Game::render() {
 
     for (BulletProjectile& bullet : mBulletProjectiles) {
         mPerObjectData.world = bullet.mTransform;
-        mCBPerObject->updateData(&mPerObjectData);
+        mRend->pushConstantData(mCBPerObject, &mPerObjectData, 1);
         mRend->draw(mProjectileIB->getIndexCount());
     }
 
@@ -863,12 +1502,12 @@ void Game::render() {
     for(auto it = mDecals.begin(); it != mDecals.end();it++) {
         Decal& decal = *it;
         mPerObjectData.world = decal.mTransform;
-        mCBPerObject->updateData(&mPerObjectData);
+        mRend->pushConstantData(mCBPerObject, &mPerObjectData, 1);
         mRend->draw(mProjectileIB->getIndexCount());
     }
 
-    glDisable(GL_BLEND);
-    glEnable(GL_CULL_FACE);
+    mRend->setBlending(false);
+    mRend->setCulling(true);
 
 
     // SSAO Pass
@@ -943,14 +1582,13 @@ void Game::render() {
     mRend->draw(mScreenQuad->getIndexCount());
 
     // Draw hud elements (on top of everything)
-    glEnable(GL_BLEND);
-    glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
-    glDisable(GL_CULL_FACE);
+    mRend->setBlending(true);
+    mRend->setCulling(false);
 
     renderHUD();
 
-    glEnable(GL_CULL_FACE);
-    glDisable(GL_BLEND);
+    mRend->setCulling(true);
+    mRend->setBlending(false);
 
     // Start the Dear ImGui frame
     ImGui_ImplOpenGL3_NewFrame();
@@ -999,6 +1637,60 @@ void Game::renderGUI() {
     ImGui::SliderFloat("Metalic", &this->mPerFrameData.metallic, 0.0f, 1.0f);
     ImGui::SliderFloat("Roughness", &this->mPerFrameData.roughness, 0.0f, 1.0f);
 
+    ImGui::Text("Stats");
+    ImGui::Text("World update: %.3f ms", mWorld->mUpdateTime);
+    ImGui::Text("Entities: %d (%d free)", (int)mWorld->getEntityCount(), (int)mWorld->mFreeEntityIds.size());
+    ImGui::Text("Transforms: %d, Meshes: %d", (int)mWorld->mTransformComponents.size(), (int)mWorld->mMeshComponents.size());
+    ImGui::Text("World transforms updated: %d", mWorld->mTransformUpdateCount);
+    ImGui::Text("Skeletons updated: %d", (int)mWorld->mSkeletonUpdateList.size());
+    ImGui::Text("Animation LOD: %d / %d / %d / %d", mWorld->mAnimationLODCounts[0], mWorld->mAnimationLODCounts[1],
+        mWorld->mAnimationLODCounts[2], mWorld->mAnimationLODCounts[3]);
+    const char* skinningModes[] = { "Vertex Shader", "Compute", "CPU" };
+    int skinningMode = (int)mWorld->mSkinningMode;
+    if (ImGui::Combo("Skinning", &skinningMode, skinningModes, IM_ARRAYSIZE(skinningModes))) {
+        mWorld->mSkinningMode = (SkinningMode)skinningMode;
+    }
+    ImGui::Text("Pre-skinned vertices: %d", (int)mPreSkinnedVertexCount);
+    RenderStateStats stateStats = mRend->resetStateStats();
+    ImGui::Text("GL state: %d calls, %d filtered", (int)stateStats.Calls, (int)stateStats.Filtered);
+    ImGui::Text("Render queue: %d draws, %d binds (%d saved)", (int)mRenderQueueDraws, (int)mRenderQueueBinds, (int)mRenderQueueBindsSaved);
+    ImGui::Checkbox("Multi-draw indirect", &mUseIndirectDraws);
+    ImGui::Text("Static geometry: %d draws in %d calls", (int)mIndirectDraws, (int)mIndirectCalls);
+    ImGui::Checkbox("Cache static shadows", &mCacheStaticShadows);
+    if (mCacheStaticShadows && mShadowFullMs > 0 && mShadowCachedMs > 0) {
+        ImGui::Text("Sun shadows GPU: %.2f ms cached, %.2f ms redrawn every %d frames (%.2f ms saved)", mShadowCachedMs, mShadowFullMs,
+                    (int)SHADOW_FULL_REDRAW_INTERVAL, mShadowFullMs - mShadowCachedMs);
+    } else {
+        ImGui::Text("Sun shadows GPU: %.2f ms cached, %.2f ms redrawn", mShadowCachedMs, mShadowFullMs);
+    }
+    ImGui::Text("Static shadow texels redrawn: %d", (int)mShadowTexelsRedrawn);
+    ImGui::Text("Lights: %d kept, %d culled, %d cluster entries", (int)mLightsKept, (int)mLightsCulled, (int)mClusterLightIndices.size());
+    ImGui::SliderInt("Point shadow budget", &mPointShadowBudget, 1, MAX_SHADOW_CUBE_MAPS);
+    ImGui::Text("Point shadows: %d stale, %d redrawn, %d cached", (int)mPointShadowsStale, (int)mPointShadowsRedrawn, (int)mPointShadowsCached);
+    ImGui::Text("Crowd instances: %d (%d meshes)", (int)mCrowdInstanceData.size(), (int)mCrowdBatches.size());
+
+    JobSystem* jobSystem = mEngine->getJobSystem();
+    JobSystemStats jobStats = jobSystem->resetStats();
+    ImGui::Text("Jobs: %d threads, %d executed, %d stolen", (int)jobSystem->getThreadCount(), (int)jobStats.JobsExecuted, (int)jobStats.JobsStolen);
+    if (ImGui::Button("Job Stress Test")) {
+        jobStressTestResult = jobSystem->runStressTest(100000);
+        jobSystem->resetStats();
+    }
+    ImGui::SameLine();
+    ImGui::Text("%.3f us per job", jobStressTestResult);
+
+    if (ImGui::Button("Component Benchmark")) {
+        componentBenchmarkResult = mWorld->runComponentBenchmark(100000, 10);
+    }
+    ImGui::SameLine();
+    ImGui::Text("100k transforms: %.3f ms packed, %.3f ms unordered_map", componentBenchmarkResult.PackedMs, componentBenchmarkResult.MapMs);
+    if (ImGui::Button("Hierarchy Benchmark")) {
+        hierarchyBenchmarkResult = mWorld->runHierarchyBenchmark(50000);
+    }
+    ImGui::Text("%d entities: rebuild %.3f ms, update %.3f ms (1%% dirty %.3f ms), recursive %.3f ms",
+                (int)hierarchyBenchmarkResult.EntityCount, hierarchyBenchmarkResult.RebuildMs, hierarchyBenchmarkResult.FullUpdateMs,
+                hierarchyBenchmarkResult.PartialUpdateMs, hierarchyBenchmarkResult.RecursiveMs);
+
     ImGui::End();
 }
 
@@ -85,6 +85,38 @@ GLVertexBuffer::GLVertexBuffer(const AnimatedVertex* data, uint32_t count) : mVe
 	glBindVertexArray(0);
 }
 
+GLVertexBuffer::GLVertexBuffer(const CompactAnimatedVertex* data, uint32_t count) : mVertexCount(count) {
+	glGenVertexArrays(1, &mVAO);
+	glBindVertexArray(mVAO);
+
+    glGenBuffers(1, &mVBO);
+    glBindBuffer(GL_ARRAY_BUFFER, mVBO);
+    glBufferData(GL_ARRAY_BUFFER, count * sizeof(CompactAnimatedVertex), data, GL_STATIC_DRAW);
+
+    glEnableVertexAttribArray(0);
+	glEnableVertexAttribArray(1);
+	glEnableVertexAttribArray(2);
+	glEnableVertexAttribArray(3);
+
+	// same slots as AnimatedVertex minus the second set of influences (5 and 7)
+	glEnableVertexAttribArray(4);
+	glEnableVertexAttribArray(6);
+
+	const uint32_t nSize = sizeof(CompactAnimatedVertex);
+
+	glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, nSize, (void*)offsetof(CompactAnimatedVertex, position));
+	glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, nSize, (void*)offsetof(CompactAnimatedVertex, normal));
+	glVertexAttribPointer(2, 3, GL_FLOAT, GL_FALSE, nSize, (void*)offsetof(CompactAnimatedVertex, tangent));
+	glVertexAttribPointer(3, 2, GL_FLOAT, GL_FALSE, nSize, (void*)offsetof(CompactAnimatedVertex, texCoord));
+
+	// ids come in as plain numbers (0-255), weights get normalized to 0-1
+	glVertexAttribPointer(4, 4, GL_UNSIGNED_BYTE, GL_FALSE, nSize, (void*)offsetof(CompactAnimatedVertex, boneIDs));
+	glVertexAttribPointer(6, 4, GL_UNSIGNED_SHORT, GL_TRUE, nSize, (void*)offsetof(CompactAnimatedVertex, boneWeights));
+
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+	glBindVertexArray(0);
+}
+
 GLVertexBuffer::~GLVertexBuffer() {
     glDeleteBuffers(1, &mVBO);
     glDeleteVertexArrays(1, &mVAO);
@@ -97,6 +129,12 @@ void GLVertexBuffer::updateData(const Vertex* data, uint32_t count) {
     mVertexCount = count;
 }
 
+void GLVertexBuffer::readData(void* data, uint32_t size) {
+    glBindBuffer(GL_ARRAY_BUFFER, mVBO);
+    glGetBufferSubData(GL_ARRAY_BUFFER, 0, size, data);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+}
+
 GLIndexBuffer::GLIndexBuffer(const uint32_t* data, uint32_t count) : mCount(count) {
 
     glGenBuffers(1, &mBufferId);
@@ -127,6 +165,93 @@ void GLConstantBuffer::updateData(void* data) {
     glBindBuffer(GL_UNIFORM_BUFFER, 0);
 }
 
+GLConstantRingBuffer::GLConstantRingBuffer(uint32_t blockSize, uint32_t blocksPerFrame)
+    : mMappedData(nullptr), mBlockSize(blockSize), mBlocksPerFrame(blocksPerFrame), mFrame(0), mBlock(0) {
 
+    GLint alignment = 256;
+    glGetIntegerv(GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT, &alignment);
+    mBlockStride = (blockSize + alignment - 1) / alignment * alignment;
 
+    const GLsizeiptr size = (GLsizeiptr)mBlockStride * blocksPerFrame * RING_BUFFER_FRAMES;
+    const GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
 
+    glGenBuffers(1, &mBufferId);
+    glBindBuffer(GL_UNIFORM_BUFFER, mBufferId);
+    glBufferStorage(GL_UNIFORM_BUFFER, size, 0, flags);
+    mMappedData = (uint8_t*)glMapBufferRange(GL_UNIFORM_BUFFER, 0, size, flags);
+	glBindBuffer(GL_UNIFORM_BUFFER, 0);
+
+    if (mMappedData == nullptr) {
+        printf("Failed to map the constant ring buffer\n");
+        assert(0);
+    }
+
+    for (uint32_t i = 0; i < RING_BUFFER_FRAMES; i++) {
+        mFences[i] = 0;
+    }
+}
+
+GLConstantRingBuffer::~GLConstantRingBuffer() {
+    for (uint32_t i = 0; i < RING_BUFFER_FRAMES; i++) {
+        if (mFences[i]) {
+            glDeleteSync(mFences[i]);
+        }
+    }
+    glBindBuffer(GL_UNIFORM_BUFFER, mBufferId);
+    glUnmapBuffer(GL_UNIFORM_BUFFER);
+	glBindBuffer(GL_UNIFORM_BUFFER, 0);
+    glDeleteBuffers(1, &mBufferId);
+}
+
+uint32_t GLConstantRingBuffer::write(const void* data) {
+    if (mBlock == mBlocksPerFrame) {
+        // more draws than we planned for, move on to the next frame's blocks early
+        nextFrame();
+    }
+    const uint32_t offset = (mFrame * mBlocksPerFrame + mBlock) * mBlockStride;
+    memcpy(mMappedData + offset, data, mBlockSize);
+    mBlock++;
+    return offset;
+}
+
+void GLConstantRingBuffer::nextFrame() {
+    // signaled once the GPU gets past everything that used this frame's blocks
+    mFences[mFrame] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+
+    mFrame = (mFrame + 1) % RING_BUFFER_FRAMES;
+    mBlock = 0;
+
+    if (mFences[mFrame]) {
+        GLenum result = glClientWaitSync(mFences[mFrame], GL_SYNC_FLUSH_COMMANDS_BIT, 1000000000);
+        while (result == GL_TIMEOUT_EXPIRED) {
+            result = glClientWaitSync(mFences[mFrame], 0, 1000000000);
+        }
+        glDeleteSync(mFences[mFrame]);
+        mFences[mFrame] = 0;
+    }
+}
+
+GLStorageBuffer::GLStorageBuffer(uint32_t sizeinBytes) : mSize(sizeinBytes) {
+
+    glGenBuffers(1, &mBufferId);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, mBufferId);
+    glBufferData(GL_SHADER_STORAGE_BUFFER, sizeinBytes, 0, GL_DYNAMIC_DRAW);
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+}
+
+GLStorageBuffer::~GLStorageBuffer() {
+    glDeleteBuffers(1, &mBufferId);
+}
+
+void GLStorageBuffer::updateData(const void* data, uint32_t sizeinBytes) {
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, mBufferId);
+    if (sizeinBytes > mSize) {
+        mSize = sizeinBytes;
+        glBufferData(GL_SHADER_STORAGE_BUFFER, mSize, data, GL_DYNAMIC_DRAW);
+    } else {
+        // orphan the old storage so we don't wait on draws that still read it
+        glBufferData(GL_SHADER_STORAGE_BUFFER, mSize, 0, GL_DYNAMIC_DRAW);
+        glBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, sizeinBytes, data);
+    }
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+}
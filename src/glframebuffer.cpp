@@ -127,6 +127,32 @@ GLFrameBuffer::GLFrameBuffer(const FrameBufferDesc& desc)
 
         glBindTexture(GL_TEXTURE_2D, 0);
     }
+    else if (desc.Flags & FRAME_BUFFER_FLAG_SHADOW_ARRAY) {
+
+        GLTextureArrayDesc tdesc = {
+            .Width = desc.Width,
+            .Height = desc.Height,
+            .Layers = desc.Layers,
+            .InternalFormat = GL_DEPTH_COMPONENT32F,
+            .WrapType = GL_CLAMP_TO_EDGE,
+            .Format = GL_DEPTH_COMPONENT,
+            .DataType = GL_FLOAT,
+        };
+
+        mDepthAttachment = new GLTexture(tdesc);
+
+        glBindTexture(GL_TEXTURE_2D_ARRAY, mDepthAttachment->getResourceId());
+
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_COMPARE_MODE, GL_COMPARE_REF_TO_TEXTURE);
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_COMPARE_FUNC, GL_LEQUAL);
+
+        // layered, the geometry shader picks the layer
+        glFramebufferTexture(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, mDepthAttachment->getResourceId(), 0);
+        glDrawBuffer(GL_NONE);
+        glReadBuffer(GL_NONE);
+
+        glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+    }
     else if (desc.Flags & FRAME_BUFFER_FLAG_SHADOW_CUBE) {
 
         GLTextureDesc tdesc = {
@@ -58,6 +58,25 @@ GLProgram::GLProgram(GLShader* vs, GLShader* ps, GLShader* gs) {
 	}
 }
 
+GLProgram::GLProgram(GLShader* cs) {
+    GLint Result = GL_FALSE;
+	int InfoLogLength;
+
+	mProgramId = glCreateProgram();
+	glAttachShader(mProgramId, cs->getResourceId());
+	glLinkProgram(mProgramId);
+
+	glGetProgramiv(mProgramId, GL_LINK_STATUS, &Result);
+	glGetProgramiv(mProgramId, GL_INFO_LOG_LENGTH, &InfoLogLength);
+	if (InfoLogLength > 0) {
+		std::vector<char> ProgramErrorMessage(InfoLogLength + 1);
+		glGetProgramInfoLog(mProgramId, InfoLogLength, NULL, &ProgramErrorMessage[0]);
+		printf("%s\n", &ProgramErrorMessage[0]);
+	}
+
+	glDetachShader(mProgramId, cs->getResourceId());
+}
+
 GLProgram::~GLProgram() {
     glDeleteProgram(mProgramId);
 }
@@ -4,8 +4,8 @@
 #include "glsystem.h"
 #include <glad\glad.h>
 
-OpenGLRenderer::OpenGLRenderer(GLFWwindow* windowHandle) : mWindowHandle(windowHandle) {
-
+OpenGLRenderer::OpenGLRenderer(GLFWwindow* windowHandle) : mWindowHandle(windowHandle), mStateStats{0, 0} {
+    invalidateState();
 }
 
 bool OpenGLRenderer::init() {
@@ -17,8 +17,10 @@ bool OpenGLRenderer::init() {
 		return false;
 	}
 	//glPolygonMode(GL_FRONT_AND_BACK, GL_FILL);
-	glEnable(GL_CULL_FACE);
+	setCulling(true);
 	setDepthTest(true);
+	// the only blending we ever do, setBlending() just turns it on and off
+	glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
 
 	glEnable(GL_POLYGON_OFFSET_FILL);
     glPolygonOffset(1, 0);
@@ -50,6 +52,7 @@ IGPUTexture* OpenGLRenderer::createGPUTexture(int width, int height, void* data,
     };
     IGPUTexture* r = new GLTexture(tdesc, false);
     mResources.push_back(r);
+    _invalidateBindings();
     return r;
 }
 
@@ -66,24 +69,35 @@ IGPUTexture* OpenGLRenderer::createGPUCubeMapTexture(int width, int height, std:
     };
     IGPUTexture* r = new GLTexture(tdesc);
     mResources.push_back(r);
+    _invalidateBindings();
     return r;
 }
 
 IGPUVertexBuffer* OpenGLRenderer::createGPUVertexBuffer(const Vertex* data, uint32_t count) {
     IGPUVertexBuffer* r = new GLVertexBuffer(data, count);
     mResources.push_back(r);
+    _invalidateBindings();
     return r;
 }
 
 IGPUVertexBuffer* OpenGLRenderer::createGPUAnimatedVertexBuffer(const AnimatedVertex* data, uint32_t count) {
     IGPUVertexBuffer* r = new GLVertexBuffer(data, count);
     mResources.push_back(r);
+    _invalidateBindings();
+    return r;
+}
+
+IGPUVertexBuffer* OpenGLRenderer::createGPUAnimatedVertexBuffer(const CompactAnimatedVertex* data, uint32_t count) {
+    IGPUVertexBuffer* r = new GLVertexBuffer(data, count);
+    mResources.push_back(r);
+    _invalidateBindings();
     return r;
 }
 
 IGPUIndexBuffer* OpenGLRenderer::createGPUIndexBuffer(const uint32_t* data, uint32_t count) {
     IGPUIndexBuffer* r = new GLIndexBuffer(data, count);
     mResources.push_back(r);
+    _invalidateBindings();
     return r;
 }
 
@@ -93,6 +107,12 @@ IGPUShaderProgram* OpenGLRenderer::createGPUProgram(IGPUResource* vs, IGPUResour
     return r;
 }
 
+IGPUShaderProgram* OpenGLRenderer::createGPUComputeProgram(IGPUResource* cs) {
+    IGPUShaderProgram* r = new GLProgram(dynamic_cast<GLShader*>(cs));
+    mResources.push_back(r);
+    return r;
+}
+
 IGPUResource* OpenGLRenderer::createVertexShader(const std::string& code) {
     IGPUResource* r = new GLShader(GL_VERTEX_SHADER, code.c_str());
     mResources.push_back(r);
@@ -110,13 +130,20 @@ IGPUResource* OpenGLRenderer::createGeometryShader(const std::string& code) {
     return r;
 }
 
+IGPUResource* OpenGLRenderer::createComputeShader(const std::string& code) {
+    IGPUResource* r = new GLShader(GL_COMPUTE_SHADER, code.c_str());
+    mResources.push_back(r);
+    return r;
+}
+
 FrameBuffer* OpenGLRenderer::createFrameBufferObject(const FrameBufferDesc& desc) {
     FrameBuffer* r = new GLFrameBuffer(desc);
     mResources.push_back(r);
+    _invalidateBindings();
     return r;
 }
 
-void OpenGLRenderer::bindFrameBuffer(FrameBuffer* fb, const ColorF& color) {
+void OpenGLRenderer::bindFrameBuffer(FrameBuffer* fb, const ColorF& color, bool clear) {
     if (!fb) {
         int width, height;
         glfwGetWindowSize(mWindowHandle, &width, &height);
@@ -127,8 +154,10 @@ void OpenGLRenderer::bindFrameBuffer(FrameBuffer* fb, const ColorF& color) {
         setViewport(0, 0, desc.Width, desc.Height);
         glBindFramebuffer(GL_FRAMEBUFFER, fb->getRenderingId());
     }
-    glClearColor(color.red, color.green, color.blue, 1.0f);
-    glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+    if (clear) {
+        glClearColor(color.red, color.green, color.blue, 1.0f);
+        glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+    }
 }
 
 IGPUConstantBuffer* OpenGLRenderer::createGPUConstantBuffer(uint32_t sizeinBytes) {
@@ -137,101 +166,63 @@ IGPUConstantBuffer* OpenGLRenderer::createGPUConstantBuffer(uint32_t sizeinBytes
     return r;
 }
 
+IGPUStorageBuffer* OpenGLRenderer::createGPUStorageBuffer(uint32_t sizeinBytes) {
+    IGPUStorageBuffer* r = new GLStorageBuffer(sizeinBytes);
+    mResources.push_back(r);
+    return r;
+}
+
+IGPUConstantRingBuffer* OpenGLRenderer::createGPUConstantRingBuffer(uint32_t blockSize, uint32_t blocksPerFrame) {
+    IGPUConstantRingBuffer* r = new GLConstantRingBuffer(blockSize, blocksPerFrame);
+    mResources.push_back(r);
+    return r;
+}
+
+IGPUTimer* OpenGLRenderer::createGPUTimer() {
+    IGPUTimer* r = new GLTimer();
+    mResources.push_back(r);
+    return r;
+}
+
 void OpenGLRenderer::bindConstantBuffer(IGPUConstantBuffer* buffer, enum CBufferBindType type, uint32_t index) {
-    glBindBufferBase(GL_UNIFORM_BUFFER, index, buffer->getResourceId());
+    assert(index < MAX_CACHED_BUFFER_BINDINGS);
+    if (_changeState(mState.UniformBuffers[index], buffer->getResourceId())) {
+        glBindBufferBase(GL_UNIFORM_BUFFER, index, buffer->getResourceId());
+    }
+}
+
+void OpenGLRenderer::bindStorageBuffer(IGPUResource* buffer, uint32_t index) {
+    assert(index < MAX_CACHED_BUFFER_BINDINGS);
+    if (_changeState(mState.StorageBuffers[index], buffer->getResourceId())) {
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, index, buffer->getResourceId());
+    }
+}
+
+void OpenGLRenderer::pushConstantData(IGPUConstantRingBuffer* ring, const void* data, uint32_t index) {
+    assert(index < MAX_CACHED_BUFFER_BINDINGS);
+    const uint32_t offset = ring->write(data);
+    glBindBufferRange(GL_UNIFORM_BUFFER, index, ring->getResourceId(), offset, ring->getBlockSize());
+    // a range of the ring is never the same binding twice
+    mState.UniformBuffers[index] = UNKNOWN_GL_STATE;
+    mStateStats.Calls++;
 }
 
 void OpenGLRenderer::bindGPUTexture(IGPUTexture* tex, int index) {
     if (tex == nullptr) {
         return;
     }
-    switch(index) {
-    case 0:
-        glActiveTexture(GL_TEXTURE0);
-        break;
-    case 1:
-        glActiveTexture(GL_TEXTURE1);
-        break;
-    case 2:
-        glActiveTexture(GL_TEXTURE2);
-        break;
-    case 3:
-        glActiveTexture(GL_TEXTURE3);
-        break;
-    case 4:
-        glActiveTexture(GL_TEXTURE4);
-        break;
-    case 5:
-        glActiveTexture(GL_TEXTURE5);
-        break;
-    case 6:
-        glActiveTexture(GL_TEXTURE6);
-        break;
-    case 7:
-        glActiveTexture(GL_TEXTURE7);
-        break;
-    case 8:
-        glActiveTexture(GL_TEXTURE8);
-        break;
-    case 9:
-        glActiveTexture(GL_TEXTURE9);
-        break;
-    case 10:
-        glActiveTexture(GL_TEXTURE10);
-        break;
-    case 11:
-        glActiveTexture(GL_TEXTURE11);
-        break;
-    case 12:
-        glActiveTexture(GL_TEXTURE12);
-        break;
-    case 13:
-        glActiveTexture(GL_TEXTURE13);
-        break;
-    case 14:
-        glActiveTexture(GL_TEXTURE14);
-        break;
-    case 15:
-        glActiveTexture(GL_TEXTURE15);
-        break;
-    case 16:
-        glActiveTexture(GL_TEXTURE16);
-        break;
-    case 17:
-        glActiveTexture(GL_TEXTURE17);
-        break;
-    case 18:
-        glActiveTexture(GL_TEXTURE18);
-        break;
-    case 19:
-        glActiveTexture(GL_TEXTURE19);
-        break;
-    case 20:
-        glActiveTexture(GL_TEXTURE20);
-        break;
-    case 21:
-        glActiveTexture(GL_TEXTURE21);
-        break;
-    case 22:
-        glActiveTexture(GL_TEXTURE22);
-        break;
-    case 23:
-        glActiveTexture(GL_TEXTURE23);
-        break;
-    case 24:
-        glActiveTexture(GL_TEXTURE24);
-        break;
-    case 25:
-        glActiveTexture(GL_TEXTURE25);
-        break;
-    case 26:
-        glActiveTexture(GL_TEXTURE26);
-        break;
-    default:
-        assert(0);
+    assert(index >= 0 && index < MAX_CACHED_TEXTURE_UNITS);
+    // texture names are unique across targets, so one slot per unit is enough
+    if (!_changeState(mState.Textures[index], tex->getResourceId())) {
+        return;
+    }
+    if (_changeState(mState.ActiveTexture, index)) {
+        glActiveTexture(GL_TEXTURE0 + index);
     }
     if (tex->isCubeMap()) {
         glBindTexture(GL_TEXTURE_CUBE_MAP, tex->getResourceId());
+    } else if (tex->isArray()) {
+        glBindTexture(GL_TEXTURE_2D_ARRAY, tex->getResourceId());
     } else {
         glBindTexture(GL_TEXTURE_2D, tex->getResourceId());
     }
@@ -241,26 +232,40 @@ void OpenGLRenderer::bindResource(IGPUResource* r) {
     if (r->getType() == GRT_TEXTURE) {
         assert(0);
     } else if (r->getType() == GRT_VERTEX_BUFFER) {
-        GLVertexBuffer* vb = dynamic_cast<GLVertexBuffer*>(r);
-        glBindBuffer(GL_ARRAY_BUFFER, r->getResourceId());
-        glBindVertexArray(vb->getVertexArrayObject());
+        // the vertex array has the attribute pointers, the draws don't need GL_ARRAY_BUFFER
+        GLVertexBuffer* vb = static_cast<GLVertexBuffer*>(r);
+        if (_changeState(mState.VertexArray, vb->getVertexArrayObject())) {
+            glBindVertexArray(vb->getVertexArrayObject());
+            mState.ElementBuffer = UNKNOWN_GL_STATE;
+        }
     } else if (r->getType() == GRT_INDEX_BUFFER) {
-        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, r->getResourceId());
+        if (_changeState(mState.ElementBuffer, r->getResourceId())) {
+            glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, r->getResourceId());
+        }
     } else if (r->getType() == GRT_SHADER_PROGRAM) {
-        glUseProgram(r->getResourceId());
+        if (_changeState(mState.Program, r->getResourceId())) {
+            glUseProgram(r->getResourceId());
+        }
     }
 }
 
 void OpenGLRenderer::unbindResource(IGPUResource* r) {
     if (r->getType() == GRT_TEXTURE) {
         glBindTexture(GL_TEXTURE_2D, 0);
+        if (mState.ActiveTexture < MAX_CACHED_TEXTURE_UNITS) {
+            mState.Textures[mState.ActiveTexture] = UNKNOWN_GL_STATE;
+        }
     } else if (r->getType() == GRT_VERTEX_BUFFER) {
         glBindBuffer(GL_ARRAY_BUFFER, 0);
         glBindVertexArray(0);
+        mState.VertexArray = 0;
+        mState.ElementBuffer = UNKNOWN_GL_STATE;
     } else if (r->getType() == GRT_INDEX_BUFFER) {
         glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+        mState.ElementBuffer = 0;
     } else if (r->getType() == GRT_SHADER_PROGRAM) {
         glUseProgram(0);
+        mState.Program = 0;
     }
 }
 
@@ -268,14 +273,55 @@ void OpenGLRenderer::setViewport(float left, float top, float width, float heigh
     glViewport(left, top, width, height);
 }
 
-void OpenGLRenderer::setDepthTest(bool enable) {
+void OpenGLRenderer::setScissor(bool enable, int left, int bottom, int width, int height) {
+    _setCapability(GL_SCISSOR_TEST, mState.ScissorTest, enable);
     if (enable) {
-        glEnable(GL_DEPTH_TEST);
+        glScissor(left, bottom, width, height);
+    }
+}
+
+void OpenGLRenderer::copyTextureRegion(IGPUTexture* src, uint32_t srcLayer, int srcX, int srcY,
+                                       IGPUTexture* dst, uint32_t dstLayer, int dstX, int dstY, int width, int height) {
+    const GLenum srcTarget = src->isArray() ? GL_TEXTURE_2D_ARRAY : GL_TEXTURE_2D;
+    const GLenum dstTarget = dst->isArray() ? GL_TEXTURE_2D_ARRAY : GL_TEXTURE_2D;
+    glCopyImageSubData(src->getResourceId(), srcTarget, 0, srcX, srcY, srcLayer,
+                       dst->getResourceId(), dstTarget, 0, dstX, dstY, dstLayer, width, height, 1);
+}
+
+void OpenGLRenderer::clearDepthRegion(IGPUTexture* tex, uint32_t layer, int x, int y, int width, int height, float depth) {
+    // unlike glClear this leaves the other layers of a layered framebuffer alone
+    glClearTexSubImage(tex->getResourceId(), 0, x, y, layer, width, height, 1, GL_DEPTH_COMPONENT, GL_FLOAT, &depth);
+}
+
+void OpenGLRenderer::_setCapability(GLenum cap, GLuint& cached, bool enable) {
+    if (!_changeState(cached, enable ? 1 : 0)) {
+        return;
+    }
+    if (enable) {
+        glEnable(cap);
     } else {
-        glDisable(GL_DEPTH_TEST);
+        glDisable(cap);
+    }
+}
+
+void OpenGLRenderer::setDepthTest(bool enable) {
+    _setCapability(GL_DEPTH_TEST, mState.DepthTest, enable);
+}
+
+void OpenGLRenderer::setDepthWrite(bool enable) {
+    if (_changeState(mState.DepthWrite, enable ? 1 : 0)) {
+        glDepthMask(enable ? GL_TRUE : GL_FALSE);
     }
 }
 
+void OpenGLRenderer::setCulling(bool enable) {
+    _setCapability(GL_CULL_FACE, mState.CullFace, enable);
+}
+
+void OpenGLRenderer::setBlending(bool enable) {
+    _setCapability(GL_BLEND, mState.Blend, enable);
+}
+
 void OpenGLRenderer::draw(uint32_t numTriangle) {
     glDrawElements(GL_TRIANGLES, numTriangle, GL_UNSIGNED_INT, 0);
 }
@@ -288,5 +334,49 @@ void OpenGLRenderer::drawNonIndexed(uint32_t numVertices) {
     glDrawArrays(GL_TRIANGLES, 0, numVertices);
 }
 
+void OpenGLRenderer::drawIndirect(IGPUResource* commands, uint32_t firstCommand, uint32_t commandCount) {
+    if (_changeState(mState.IndirectBuffer, commands->getResourceId())) {
+        glBindBuffer(GL_DRAW_INDIRECT_BUFFER, commands->getResourceId());
+    }
+    const uintptr_t offset = firstCommand * sizeof(DrawIndirectCommand);
+    glMultiDrawElementsIndirect(GL_TRIANGLES, GL_UNSIGNED_INT, (const void*)offset, commandCount, 0);
+}
 
+void OpenGLRenderer::dispatchCompute(uint32_t groupsX, uint32_t groupsY, uint32_t groupsZ) {
+    glDispatchCompute(groupsX, groupsY, groupsZ);
+}
 
+void OpenGLRenderer::memoryBarrier() {
+    glMemoryBarrier(GL_VERTEX_ATTRIB_ARRAY_BARRIER_BIT);
+}
+
+void OpenGLRenderer::_invalidateBindings() {
+    mState.VertexArray = UNKNOWN_GL_STATE;
+    mState.ElementBuffer = UNKNOWN_GL_STATE;
+    mState.ActiveTexture = UNKNOWN_GL_STATE;
+    for (int i = 0; i < MAX_CACHED_TEXTURE_UNITS; i++) {
+        mState.Textures[i] = UNKNOWN_GL_STATE;
+    }
+}
+
+void OpenGLRenderer::invalidateState() {
+    _invalidateBindings();
+    mState.Program = UNKNOWN_GL_STATE;
+    mState.IndirectBuffer = UNKNOWN_GL_STATE;
+    for (int i = 0; i < MAX_CACHED_BUFFER_BINDINGS; i++) {
+        mState.UniformBuffers[i] = UNKNOWN_GL_STATE;
+        mState.StorageBuffers[i] = UNKNOWN_GL_STATE;
+    }
+    mState.Blend = UNKNOWN_GL_STATE;
+    mState.CullFace = UNKNOWN_GL_STATE;
+    mState.DepthTest = UNKNOWN_GL_STATE;
+    mState.DepthWrite = UNKNOWN_GL_STATE;
+    mState.ScissorTest = UNKNOWN_GL_STATE;
+}
+
+RenderStateStats OpenGLRenderer::resetStateStats() {
+    RenderStateStats stats = mStateStats;
+    mStateStats.Calls = 0;
+    mStateStats.Filtered = 0;
+    return stats;
+}
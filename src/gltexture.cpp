@@ -29,7 +29,7 @@ GLuint getGLTextureFormat(TextureFormat format) {
 }
 
 GLTexture::GLTexture(const GLCubeMapTextureDesc& desc)
-    : mWidth(desc.Width), mHeight(desc.Height), mCubeMap(true)
+    : mWidth(desc.Width), mHeight(desc.Height), mCubeMap(true), mArray(false)
 {
     assert(desc.DataList.size() == 6);
 
@@ -51,8 +51,26 @@ GLTexture::GLTexture(const GLCubeMapTextureDesc& desc)
     glBindTexture(GL_TEXTURE_CUBE_MAP, 0);
 }
 
+GLTexture::GLTexture(const GLTextureArrayDesc& desc)
+    : mWidth(desc.Width), mHeight(desc.Height), mCubeMap(false), mArray(true)
+{
+    glGenTextures(1, &mTextureId);
+    glBindTexture(GL_TEXTURE_2D_ARRAY, mTextureId);
+
+    glTexImage3D(GL_TEXTURE_2D_ARRAY, 0, desc.InternalFormat, desc.Width, desc.Height, desc.Layers, 0,
+          desc.Format, desc.DataType, nullptr);
+
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, desc.WrapType);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, desc.WrapType);
+
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+
+    glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+}
+
 GLTexture::GLTexture(const GLTextureDesc& desc, bool cubemap)
-    : mWidth(desc.Width), mHeight(desc.Height), mCubeMap(cubemap)
+    : mWidth(desc.Width), mHeight(desc.Height), mCubeMap(cubemap), mArray(false)
 {
     glGenTextures(1, &mTextureId);
 
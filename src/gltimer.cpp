@@ -0,0 +1,60 @@
+#include "stdafx.h"
+#include "engine.h"
+#include "renderer.h"
+#include "glsystem.h"
+
+GLTimer::GLTimer() : mFirstPending(0), mPendingCount(0), mRunning(false) {
+    glGenQueries(GPU_TIMER_QUERIES, mQueries);
+    for (uint32_t i = 0; i < GPU_TIMER_QUERIES; i++) {
+        mTags[i] = 0;
+    }
+}
+
+GLTimer::~GLTimer() {
+    glDeleteQueries(GPU_TIMER_QUERIES, mQueries);
+}
+
+void GLTimer::begin(uint32_t tag) {
+    assert(!mRunning);
+    // waiting for the oldest one would stall the CPU, better lose a measurement
+    if (mPendingCount == GPU_TIMER_QUERIES) {
+        return;
+    }
+    const uint32_t query = (mFirstPending + mPendingCount) % GPU_TIMER_QUERIES;
+    mTags[query] = tag;
+    glBeginQuery(GL_TIME_ELAPSED, mQueries[query]);
+    mRunning = true;
+}
+
+void GLTimer::end() {
+    if (!mRunning) {
+        return;
+    }
+    glEndQuery(GL_TIME_ELAPSED);
+    mPendingCount++;
+    mRunning = false;
+}
+
+bool GLTimer::getResult(float& milliseconds, uint32_t& tag) {
+    bool found = false;
+    // they finish in order, stop at the first one that isn't ready
+    while (mPendingCount > 0) {
+        const GLuint query = mQueries[mFirstPending];
+
+        GLint available = 0;
+        glGetQueryObjectiv(query, GL_QUERY_RESULT_AVAILABLE, &available);
+        if (!available) {
+            break;
+        }
+
+        GLuint64 nanoseconds = 0;
+        glGetQueryObjectui64v(query, GL_QUERY_RESULT, &nanoseconds);
+        milliseconds = (float)(nanoseconds / 1000000.0);
+        tag = mTags[mFirstPending];
+        found = true;
+
+        mFirstPending = (mFirstPending + 1) % GPU_TIMER_QUERIES;
+        mPendingCount--;
+    }
+    return found;
+}
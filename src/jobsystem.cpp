@@ -0,0 +1,242 @@
+#include "stdafx.h"
+#include "engine.h"
+#include "jobsystem.h"
+
+JobSystem* JobSystem::sJobSystem = nullptr;
+
+// 0 is the main thread (or any other thread that isn't a worker)
+static thread_local uint32_t tQueueIndex = 0;
+
+JobSystem::JobSystem(uint32_t workerCount)
+    : mRunning(true), mQueuedJobs(0), mJobsExecuted(0), mJobsStolen(0) {
+    if (JobSystem::sJobSystem != nullptr) {
+        assert(0);
+    }
+    JobSystem::sJobSystem = this;
+
+    if (workerCount == 0) {
+        uint32_t hardwareThreads = std::thread::hardware_concurrency();
+        workerCount = hardwareThreads > 1 ? hardwareThreads - 1 : 1;
+    }
+
+    for (uint32_t i = 0; i < workerCount + 1; i++) {
+        mQueues.push_back(new JobQueue());
+    }
+    for (uint32_t i = 1; i < workerCount + 1; i++) {
+        mThreads.push_back(std::thread(&JobSystem::_workerLoop, this, i));
+    }
+}
+
+JobSystem::~JobSystem() {
+    mRunning = false;
+    {
+        std::lock_guard<std::mutex> lock(mWakeLock);
+    }
+    mWakeCondition.notify_all();
+
+    for(auto it = mThreads.begin(); it != mThreads.end();++it) {
+        (*it).join();
+    }
+    for(auto it = mQueues.begin(); it != mQueues.end();++it) {
+        delete *it;
+    }
+    JobSystem::sJobSystem = nullptr;
+}
+
+void JobSystem::run(const JobFunction& function, JobCounter* counter, JobCounter* dependency) {
+    if (counter) {
+        counter->Value.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    Job job;
+    job.Function = function;
+    job.Counter = counter;
+    if (_defer(&job, 1, dependency)) {
+        return;
+    }
+    _push(tQueueIndex, &job, 1);
+    _wakeWorkers(false);
+}
+
+void JobSystem::parallelFor(uint32_t count, uint32_t groupSize, const JobRangeFunction& func,
+    JobCounter* counter, JobCounter* dependency) {
+    if (count == 0) {
+        return;
+    }
+    if (groupSize == 0) {
+        groupSize = 1;
+    }
+    uint32_t groupCount = (count + groupSize - 1) / groupSize;
+
+    if (counter) {
+        counter->Value.fetch_add(groupCount, std::memory_order_relaxed);
+    }
+
+    // all the groups share one copy of the function
+    auto sharedFunc = std::make_shared<JobRangeFunction>(func);
+
+    std::vector<Job> jobs(groupCount);
+    for (uint32_t group = 0; group < groupCount; group++) {
+        uint32_t start = group * groupSize;
+        uint32_t end = std::min(start + groupSize, count);
+
+        jobs[group].Function = [sharedFunc, start, end]() { (*sharedFunc)(start, end); };
+        jobs[group].Counter = counter;
+    }
+    if (_defer(&jobs[0], groupCount, dependency)) {
+        return;
+    }
+    _push(tQueueIndex, &jobs[0], groupCount);
+    _wakeWorkers(true);
+}
+
+void JobSystem::wait(JobCounter* counter) {
+    while (!counter->isDone()) {
+        if (!_executeNext(tQueueIndex)) {
+            std::this_thread::yield();
+        }
+    }
+    // the job that took it to zero may still be releasing its waiting jobs
+    std::lock_guard<std::mutex> lock(counter->Lock);
+}
+
+JobSystemStats JobSystem::resetStats() {
+    JobSystemStats stats;
+    stats.JobsExecuted = mJobsExecuted.exchange(0);
+    stats.JobsStolen = mJobsStolen.exchange(0);
+    return stats;
+}
+
+double JobSystem::runStressTest(uint32_t jobCount) {
+    JobCounter counter;
+    std::atomic<uint32_t> sum(0);
+
+    auto start = std::chrono::high_resolution_clock::now();
+    for (uint32_t i = 0; i < jobCount; i++) {
+        run([&sum]() { sum.fetch_add(1, std::memory_order_relaxed); }, &counter);
+    }
+    wait(&counter);
+    auto end = std::chrono::high_resolution_clock::now();
+
+    assert(sum.load() == jobCount);
+    return std::chrono::duration<double, std::micro>(end - start).count() / double(jobCount);
+}
+
+void JobSystem::_push(uint32_t queueIndex, const Job* jobs, uint32_t count) {
+    JobQueue* queue = mQueues[queueIndex];
+    {
+        std::lock_guard<std::mutex> lock(queue->Lock);
+        queue->Jobs.insert(queue->Jobs.end(), jobs, jobs + count);
+    }
+    mQueuedJobs.fetch_add(count, std::memory_order_release);
+}
+
+bool JobSystem::_defer(const Job* jobs, uint32_t count, JobCounter* dependency) {
+    if (!dependency || dependency->isDone()) {
+        return false;
+    }
+    // checked again under the lock, the counter only reaches zero with it held (see _finishJob())
+    std::lock_guard<std::mutex> lock(dependency->Lock);
+    if (dependency->isDone()) {
+        return false;
+    }
+    dependency->Waiting.insert(dependency->Waiting.end(), jobs, jobs + count);
+    return true;
+}
+
+void JobSystem::_finishJob(JobCounter* counter) {
+    // no lock while other jobs of the batch are still running
+    int value = counter->Value.load(std::memory_order_relaxed);
+    while (value > 1) {
+        if (counter->Value.compare_exchange_weak(value, value - 1, std::memory_order_acq_rel)) {
+            return;
+        }
+    }
+
+    // the last one reaches zero under the lock, so wait() can't let the counter go before we're done with it
+    std::vector<Job> jobs;
+    {
+        std::lock_guard<std::mutex> lock(counter->Lock);
+        if (counter->Value.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+            jobs.swap(counter->Waiting);
+        }
+    }
+    if (jobs.empty()) {
+        return;
+    }
+    _push(tQueueIndex, &jobs[0], (uint32_t)jobs.size());
+    _wakeWorkers(jobs.size() > 1);
+}
+
+void JobSystem::_wakeWorkers(bool all) {
+    // taking the lock makes sure a worker that is about to sleep sees the new jobs
+    {
+        std::lock_guard<std::mutex> lock(mWakeLock);
+    }
+    if (all) {
+        mWakeCondition.notify_all();
+    } else {
+        mWakeCondition.notify_one();
+    }
+}
+
+bool JobSystem::_executeNext(uint32_t queueIndex) {
+    Job job;
+    bool found = false;
+
+    // our own newest job first (most likely still in the cache)
+    JobQueue* queue = mQueues[queueIndex];
+    {
+        std::lock_guard<std::mutex> lock(queue->Lock);
+        if (!queue->Jobs.empty()) {
+            job = queue->Jobs.back();
+            queue->Jobs.pop_back();
+            found = true;
+        }
+    }
+
+    // otherwise steal the oldest job of some other thread
+    if (!found) {
+        const uint32_t queueCount = (uint32_t)mQueues.size();
+        for (uint32_t i = 1; i < queueCount && !found; i++) {
+            JobQueue* victim = mQueues[(queueIndex + i) % queueCount];
+            std::lock_guard<std::mutex> lock(victim->Lock);
+            if (!victim->Jobs.empty()) {
+                job = victim->Jobs.front();
+                victim->Jobs.pop_front();
+                found = true;
+                mJobsStolen.fetch_add(1, std::memory_order_relaxed);
+            }
+        }
+    }
+
+    if (!found) {
+        return false;
+    }
+
+    mQueuedJobs.fetch_sub(1, std::memory_order_acq_rel);
+
+    job.Function();
+
+    mJobsExecuted.fetch_add(1, std::memory_order_relaxed);
+    if (job.Counter) {
+        _finishJob(job.Counter);
+    }
+    return true;
+}
+
+void JobSystem::_workerLoop(uint32_t queueIndex) {
+    tQueueIndex = queueIndex;
+
+    while (mRunning) {
+        if (_executeNext(queueIndex)) {
+            continue;
+        }
+        // nothing we can run right now, sleep until new jobs come in
+        std::this_thread::yield();
+        std::unique_lock<std::mutex> lock(mWakeLock);
+        mWakeCondition.wait(lock, [this]() {
+            return mQueuedJobs.load(std::memory_order_acquire) > 0 || !mRunning;
+        });
+    }
+}
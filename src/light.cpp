@@ -11,7 +11,8 @@ Light::Light(bool castShadow)
 }
 
 PointLight::PointLight(const glm::vec3& pos, bool castShadow)
-    : Light(castShadow), mPosition(pos), mShadowMapFBO(nullptr), mFarPlane(700), mRadius(150), mNeedUpdate(true), mEnabled(true) {
+    : Light(castShadow), mPosition(pos), mShadowMapFBO(nullptr), mFarPlane(700), mRadius(150), mNeedUpdate(true), mEnabled(true),
+    mShadowSignature(0), mShadowMapValid(false), mShadowUpdateFrame(0) {
 
     if (castShadow) {
         Renderer* rnd = Engine::get()->getRenderingSystem();
@@ -35,18 +36,20 @@ AABB PointLight::getBoundingBox() {
 void PointLight::_updateMatrices() {
     mShadowProjection = glm::perspective(glm::radians(90.0f), 1.0f, 0.1f, mFarPlane);
 
-    const auto& lightPos = this->mPosition;
-
-    mShadowViewProjArray[0] = mShadowProjection * glm::lookAt(lightPos, lightPos + glm::vec3(1.0, 0.0, 0.0), glm::vec3(0.0, -1.0, 0.0));
-    mShadowViewProjArray[1] = mShadowProjection * glm::lookAt(lightPos, lightPos + glm::vec3(-1.0, 0.0, 0.0), glm::vec3(0.0, -1.0, 0.0));
-    mShadowViewProjArray[2] = mShadowProjection * glm::lookAt(lightPos, lightPos + glm::vec3(0.0, 1.0, 0.0), glm::vec3(0.0, 0.0, 1.0));
-    mShadowViewProjArray[3] = mShadowProjection * glm::lookAt(lightPos, lightPos + glm::vec3(0.0, -1.0, 0.0), glm::vec3(0.0, 0.0, -1.0));
-    mShadowViewProjArray[4] = mShadowProjection * glm::lookAt(lightPos, lightPos + glm::vec3(0.0, 0.0, 1.0), glm::vec3(0.0, -1.0, 0.0));
-    mShadowViewProjArray[5] = mShadowProjection * glm::lookAt(lightPos, lightPos + glm::vec3(0.0, 0.0, -1.0), glm::vec3(0.0, -1.0, 0.0));
+    getShadowViewProj(mPosition, mShadowViewProjArray);
 
     mNeedUpdate = false;
 }
 
+void PointLight::getShadowViewProj(const glm::vec3& lightPos, glm::mat4* viewProjArray) const {
+    viewProjArray[0] = mShadowProjection * glm::lookAt(lightPos, lightPos + glm::vec3(1.0, 0.0, 0.0), glm::vec3(0.0, -1.0, 0.0));
+    viewProjArray[1] = mShadowProjection * glm::lookAt(lightPos, lightPos + glm::vec3(-1.0, 0.0, 0.0), glm::vec3(0.0, -1.0, 0.0));
+    viewProjArray[2] = mShadowProjection * glm::lookAt(lightPos, lightPos + glm::vec3(0.0, 1.0, 0.0), glm::vec3(0.0, 0.0, 1.0));
+    viewProjArray[3] = mShadowProjection * glm::lookAt(lightPos, lightPos + glm::vec3(0.0, -1.0, 0.0), glm::vec3(0.0, 0.0, -1.0));
+    viewProjArray[4] = mShadowProjection * glm::lookAt(lightPos, lightPos + glm::vec3(0.0, 0.0, 1.0), glm::vec3(0.0, -1.0, 0.0));
+    viewProjArray[5] = mShadowProjection * glm::lookAt(lightPos, lightPos + glm::vec3(0.0, 0.0, -1.0), glm::vec3(0.0, -1.0, 0.0));
+}
+
 void PointLight::update(float dt) {
     if (mNeedUpdate) {
         _updateMatrices();
@@ -3,6 +3,10 @@
 #include "renderer.h"
 #include "mesh.h"
 
+#if defined(__SSE__)
+#include <xmmintrin.h>
+#endif
+
 /* Gets normalized value for Lerp & Slerp*/
 float BoneAnimationTrack::GetScaleFactor(float lastTimeStamp, float nextTimeStamp, float animationTime)
 {
@@ -10,81 +14,103 @@ float BoneAnimationTrack::GetScaleFactor(float lastTimeStamp, float nextTimeStam
     float midWayLength = animationTime - lastTimeStamp;
     float framesDiff = nextTimeStamp - lastTimeStamp;
     scaleFactor = midWayLength / framesDiff;
-    return scaleFactor;
+    // don't extrapolate past the first/last key
+    return glm::clamp(scaleFactor, 0.0f, 1.0f);
 }
 
-int BoneAnimationTrack::GetPositionIndex(float animationTime)
+int BoneAnimationTrack::GetPositionIndex(float animationTime, uint32_t& cursor)
 {
-    //printf("bone (%s): pos size %d\n", mName.c_str(), mPositions.size());
-    for (size_t index = 0; index < mPositions.size() - 1; ++index)
-    {
-        if (animationTime < mPositions[index + 1].timeStamp) {
-            return index;
-        }
-    }
-    //printf("bone (%s): no position key found for time stamp %f\n", mName.c_str(), animationTime);
-    return 0;
+    const float* times = mPositionTimes.data();
+    return findKeyFrame((uint32_t)mPositionTimes.size(), animationTime, cursor,
+        [times](uint32_t i) { return times[i]; });
 }
 
-/*figures out which position keys to interpolate b/w and performs the interpolation
-and returns the translation matrix*/
-glm::mat4 BoneAnimationTrack::InterpolatePosition(float animationTime)
+int BoneAnimationTrack::GetRotationIndex(float animationTime, uint32_t& cursor)
 {
-    if (1 == mPositions.size())
-        return glm::translate(glm::mat4(1.0f), mPositions[0].position);
-
-    int p0Index = GetPositionIndex(animationTime);
-    int p1Index = p0Index + 1;
-    float scaleFactor = GetScaleFactor(mPositions[p0Index].timeStamp,
-        mPositions[p1Index].timeStamp, animationTime);
-    glm::vec3 finalPosition = glm::mix(mPositions[p0Index].position,
-        mPositions[p1Index].position, scaleFactor);
-    return glm::translate(glm::mat4(1.0f), finalPosition);
+    const float* times = mRotationTimes.data();
+    return findKeyFrame((uint32_t)mRotationTimes.size(), animationTime, cursor,
+        [times](uint32_t i) { return times[i]; });
 }
 
-/*figures out which rotations keys to interpolate b/w and performs the interpolation
-and returns the rotation matrix*/
-glm::mat4 BoneAnimationTrack::InterpolateRotation(float animationTime)
+int BoneAnimationTrack::GetScaleIndex(float animationTime, uint32_t& cursor)
 {
-    if (1 == mRotations.size())
-    {
-        auto rotation = glm::normalize(mRotations[0].orientation);
-        return glm::toMat4(rotation);
-    }
-
-    int p0Index = GetRotationIndex(animationTime);
-    int p1Index = p0Index + 1;
-    float scaleFactor = GetScaleFactor(mRotations[p0Index].timeStamp,
-        mRotations[p1Index].timeStamp, animationTime);
-    glm::quat finalRotation = glm::slerp(mRotations[p0Index].orientation,
-        mRotations[p1Index].orientation, scaleFactor);
-    finalRotation = glm::normalize(finalRotation);
-    return glm::toMat4(finalRotation);
+    const float* times = mScaleTimes.data();
+    return findKeyFrame((uint32_t)mScaleTimes.size(), animationTime, cursor,
+        [times](uint32_t i) { return times[i]; });
 }
 
-/*figures out which scaling keys to interpolate b/w and performs the interpolation
-and returns the scale matrix*/
-glm::mat4 BoneAnimationTrack::InterpolateScaling(float animationTime)
-{
-    if (1 == mScales.size())
-        return glm::scale(glm::mat4(1.0f), mScales[0].scale);
-
-    int p0Index = GetScaleIndex(animationTime);
-    int p1Index = p0Index + 1;
-    float scaleFactor = GetScaleFactor(mScales[p0Index].timeStamp,
-        mScales[p1Index].timeStamp, animationTime);
-    glm::vec3 finalScale = glm::mix(mScales[p0Index].scale, mScales[p1Index].scale
-        , scaleFactor);
-    return glm::scale(glm::mat4(1.0f), finalScale);
-}
+static uint32_t sSubMeshCount = 0;
 
 SubMesh::SubMesh(IGPUResource* vb, IGPUIndexBuffer* ib)
-    : mVertexBuffer(vb), mIndexBuffer(ib), mMaterial(nullptr) {
+    : mVertexBuffer(vb), mIndexBuffer(ib), mMaterial(nullptr), mSkinnedVertexBuffer(nullptr), mSortId(sSubMeshCount++) {
     tempMat = glm::mat4(1.0);
+    tempMatInverse = glm::mat4(1.0);
+}
+
+void StaticGeometry::build(Renderer* rend) {
+    assert(mVertexBuffer == nullptr);
+
+    std::vector<std::pair<SubMesh*, const glm::mat4*>> subMeshes;
+    for(auto it = mPendingMeshes.begin();it != mPendingMeshes.end();++it) {
+        const auto& sml = it->first->getSubMeshList();
+        for(auto itSub = sml.begin();itSub != sml.end();++itSub) {
+            SubMesh* sm = *itSub;
+            if (sm->mIndices.empty()) {
+                printf("Static mesh %s has no geometry to merge, load it with keepGeometry\n", it->first->getName().c_str());
+                assert(0);
+                continue;
+            }
+            subMeshes.push_back(std::make_pair(sm, &it->second));
+        }
+    }
+
+    // one contiguous range of draws per material
+    std::stable_sort(subMeshes.begin(), subMeshes.end(), [](const auto& a, const auto& b) {
+        return a.first->getMaterial()->mSortId < b.first->getMaterial()->mSortId;
+    });
+
+    std::vector<Vertex> vertices;
+    std::vector<uint32_t> indices;
+
+    for(auto it = subMeshes.begin();it != subMeshes.end();++it) {
+        SubMesh* sm = it->first;
+        const glm::mat4& world = *it->second;
+        const glm::mat3 normalMatrix = glm::transpose(glm::inverse(glm::mat3(world)));
+
+        StaticDraw draw;
+        draw.Mesh = sm;
+        draw.IndexCount = (uint32_t)sm->mIndices.size();
+        draw.FirstIndex = (uint32_t)indices.size();
+        draw.BaseVertex = (uint32_t)vertices.size();
+        draw.Bounds = sm->getLocalBoundingBox();
+        draw.Bounds.transform(world);
+        mDraws.push_back(draw);
+
+        for(auto itVertex = sm->mVertices.begin();itVertex != sm->mVertices.end();++itVertex) {
+            Vertex v = *itVertex;
+            v.position = glm::vec3(world * glm::vec4(v.position, 1.0f));
+            v.normal = normalMatrix * v.normal;
+            v.tangent = glm::mat3(world) * v.tangent;
+            vertices.push_back(v);
+        }
+        // indices stay relative to the sub-mesh, BaseVertex takes care of it
+        indices.insert(indices.end(), sm->mIndices.begin(), sm->mIndices.end());
+
+        // nobody needs the CPU copy anymore
+        std::vector<Vertex>().swap(sm->mVertices);
+        std::vector<uint32_t>().swap(sm->mIndices);
+    }
+    mPendingMeshes.clear();
+
+    if (!vertices.empty()) {
+        mVertexBuffer = rend->createGPUVertexBuffer(&vertices[0], (uint32_t)vertices.size());
+        mIndexBuffer = rend->createGPUIndexBuffer(&indices[0], (uint32_t)indices.size());
+    }
+    printf("Static geometry: %d draws, %d vertices, %d indices\n", (int)mDraws.size(), (int)vertices.size(), (int)indices.size());
 }
 
 Bone::Bone(const std::string& name, Bone* parent, uint32_t id)
-    : mName(name), mParent(parent), boneId(id) {
+    : mName(name), mParent(parent), boneId(id), mIndex(0), mParentIndex(-1) {
     if (parent) {
         parent->mChildren.push_back(this);
     }
@@ -101,7 +127,8 @@ void Bone::updateWorldTransform() {
     }
 }
 
-Skeleton::Skeleton() {
+Skeleton::Skeleton()
+    : mLODUpdateInterval(1), mLODBoneCount(0), mLODTick(0), mLODTime(0), mPoseVersion(0) {
 
 }
 
@@ -131,12 +158,53 @@ AnimationState* Skeleton::getAnimationState(const std::string& name) {
 }
 
 AnimationState* Skeleton::setAnimationState(const std::string& name) {
-    mCurrentAnimState = mAnimationStateList[name];
-    return mCurrentAnimState;
+    return setAnimationState(mAnimationStateList[name]);
 }
 
 AnimationState* Skeleton::setAnimationState(AnimationState* state) {
+    for(auto it = mActiveStates.begin();it != mActiveStates.end();++it) {
+        (*it)->mWeight = 0;
+        (*it)->mTargetWeight = 0;
+    }
+    mActiveStates.clear();
+
+    mCurrentAnimState = state;
+    if (state) {
+        state->mWeight = 1;
+        state->mTargetWeight = 1;
+        state->mFadeSpeed = 0;
+        mActiveStates.push_back(state);
+    }
+    return mCurrentAnimState;
+}
+
+void Skeleton::fadeAnimationState(AnimationState* state, float weight, float fadeTime) {
+    auto it = std::find(mActiveStates.begin(), mActiveStates.end(), state);
+    if (it == mActiveStates.end()) {
+        if (weight <= 0) {
+            return;
+        }
+        state->mWeight = 0;
+        mActiveStates.push_back(state);
+    }
+    state->mTargetWeight = weight;
+    if (fadeTime > 0) {
+        state->mFadeSpeed = fabsf(weight - state->mWeight) / fadeTime;
+    } else {
+        state->mWeight = weight;
+        state->mFadeSpeed = 0;
+    }
+}
+
+AnimationState* Skeleton::crossFade(AnimationState* state, float fadeTime) {
+    for(auto it = mActiveStates.begin();it != mActiveStates.end();++it) {
+        if (*it != state) {
+            fadeAnimationState(*it, 0, fadeTime);
+        }
+    }
+    fadeAnimationState(state, 1, fadeTime);
     mCurrentAnimState = state;
+    return state;
 }
 
 Bone* Skeleton::createBone(const std::string& name, uint32_t id, Bone* parent) {
@@ -149,33 +217,494 @@ Bone* Skeleton::getBone(const std::string& name) {
     return mBoneList[name];
 }
 
+// rotation * scale in the upper 3x3 and the translation in the last column,
+// same as translate * toMat4(rotation) * scale without the matrix products
+static glm::mat4 composeBonePose(const BonePose& pose) {
+    glm::mat3 rotation = glm::mat3_cast(pose.Rotation);
+    glm::mat4 m;
+    m[0] = glm::vec4(rotation[0] * pose.Scale.x, 0.0f);
+    m[1] = glm::vec4(rotation[1] * pose.Scale.y, 0.0f);
+    m[2] = glm::vec4(rotation[2] * pose.Scale.z, 0.0f);
+    m[3] = glm::vec4(pose.Position, 1.0f);
+    return m;
+}
+
+// inverse of composeBonePose(), assumes there's no shear. Collapsed (zero scale) axes get a
+// direction from the others and a mirror goes into the scale, so the rotation stays a rotation
+static BonePose decomposeBonePose(const glm::mat4& m) {
+    const glm::vec3 unitAxes[3] = { glm::vec3(1, 0, 0), glm::vec3(0, 1, 0), glm::vec3(0, 0, 1) };
+
+    BonePose pose;
+    pose.Position = glm::vec3(m[3]);
+
+    glm::vec3 axes[3];
+    int validCount = 0;
+    int validAxis = 0;
+    for (int i = 0; i < 3; i++) {
+        axes[i] = glm::vec3(m[i]);
+        pose.Scale[i] = glm::length(axes[i]);
+        if (pose.Scale[i] > 1e-6f) {
+            axes[i] /= pose.Scale[i];
+            validCount++;
+            validAxis = i;
+        } else {
+            pose.Scale[i] = 0.0f;
+            axes[i] = glm::vec3(0.0f);
+        }
+    }
+
+    if (validCount == 0) {
+        pose.Rotation = glm::quat(1, 0, 0, 0);
+        return pose;
+    }
+    if (validCount == 1) {
+        // any axis at right angles will do, the bone is flat on it anyway
+        const int next = (validAxis + 1) % 3;
+        const int last = (validAxis + 2) % 3;
+        glm::vec3 helper = std::abs(glm::dot(axes[validAxis], unitAxes[last])) < 0.9f ? unitAxes[last] : unitAxes[next];
+        axes[next] = glm::normalize(glm::cross(helper, axes[validAxis]));
+    }
+    // the one still missing follows from the other two (x = y cross z and so on)
+    for (int i = 0; i < 3; i++) {
+        if (pose.Scale[i] == 0.0f && axes[i] == glm::vec3(0.0f)) {
+            axes[i] = glm::normalize(glm::cross(axes[(i + 1) % 3], axes[(i + 2) % 3]));
+        }
+    }
+
+    glm::mat3 rotation(axes[0], axes[1], axes[2]);
+    if (glm::determinant(rotation) < 0.0f) {
+        pose.Scale.x = -pose.Scale.x;
+        rotation[0] = -rotation[0];
+    }
+    pose.Rotation = glm::normalize(glm::quat_cast(rotation));
+    return pose;
+}
+
+// out = mix(from, to, alpha) for count bones, rotations are nlerped
+static void blendBonePoses(const BonePose* from, const BonePose* to, float alpha, BonePose* out, size_t count) {
+    for (size_t i = 0; i < count; i++) {
+        out[i].Position = glm::mix(from[i].Position, to[i].Position, alpha);
+        out[i].Scale = glm::mix(from[i].Scale, to[i].Scale, alpha);
+        float sign = glm::dot(from[i].Rotation, to[i].Rotation) < 0 ? -1.0f : 1.0f;
+        out[i].Rotation = glm::normalize(from[i].Rotation * (1.0f - alpha) + to[i].Rotation * (alpha * sign));
+    }
+}
+
+void Skeleton::_buildBoneList() {
+    mBones.clear();
+    mBones.reserve(mBoneList.size());
+
+    // breadth-first so a single pass over mBones can resolve the hierarchy
+    for(auto it = mRootBoneList.begin();it != mRootBoneList.end();++it) {
+        Bone* root = *it;
+        root->mIndex = (uint32_t)mBones.size();
+        root->mParentIndex = -1;
+        mBones.push_back(root);
+    }
+    for (size_t i = 0; i < mBones.size(); i++) {
+        Bone* bone = mBones[i];
+        for(auto it = bone->mChildren.begin();it != bone->mChildren.end();++it) {
+            Bone* child = *it;
+            child->mIndex = (uint32_t)mBones.size();
+            child->mParentIndex = (int32_t)bone->mIndex;
+            mBones.push_back(child);
+        }
+    }
+
+    mBindPose.resize(mBones.size());
+    for (size_t i = 0; i < mBones.size(); i++) {
+        mBindPose[i] = decomposeBonePose(mBones[i]->mLocalTransform);
+    }
+    mLocalPose = mBindPose;
+}
+
 void Skeleton::_initAnimationStates() {
     for(auto it = mAnimationList.begin();it != mAnimationList.end();++it) {
         SkeletonAnimation* anim = it->second;
 
+        anim->bindTracks();
+
         AnimationState* state = new AnimationState(anim->mName, anim->mDuration);
+        state->mAnimation = anim;
         mAnimationStateList[anim->mName] = state;
     }
 }
 
+void Skeleton::_updateAnimationWeights(float dt) {
+    for (size_t i = 0; i < mActiveStates.size();) {
+        AnimationState* state = mActiveStates[i];
+        if (state->mWeight < state->mTargetWeight) {
+            state->mWeight = std::min(state->mWeight + state->mFadeSpeed * dt, state->mTargetWeight);
+        } else if (state->mWeight > state->mTargetWeight) {
+            state->mWeight = std::max(state->mWeight - state->mFadeSpeed * dt, state->mTargetWeight);
+        }
+        // faded out
+        if (state->mWeight <= 0 && state->mTargetWeight <= 0) {
+            mActiveStates.erase(mActiveStates.begin() + i);
+        } else {
+            i++;
+        }
+    }
+}
+
+// Blends the layer poses into mLocalPose in one pass over the bones. Rotations are
+// summed (flipped onto the first layer's hemisphere) and normalized, which is
+// close enough to slerp for the small differences between the layers
+void Skeleton::_blendLayers(uint32_t layerCount) {
+    const size_t boneCount = mBones.size();
+
+    float totalWeight = 0;
+    mLayerWeights.resize(layerCount);
+    for (uint32_t layer = 0; layer < layerCount; layer++) {
+        mLayerWeights[layer] = mActiveStates[layer]->mWeight;
+        totalWeight += mLayerWeights[layer];
+    }
+    for (uint32_t layer = 0; layer < layerCount; layer++) {
+        mLayerWeights[layer] = totalWeight > 0 ? mLayerWeights[layer] / totalWeight : 1.0f / layerCount;
+    }
+
+    const BonePose* layerPoses = &mLayerPoses[0];
+    const float* weights = &mLayerWeights[0];
+    for (size_t i = 0; i < boneCount; i++) {
+        const BonePose& first = layerPoses[i];
+        glm::vec3 position = first.Position * weights[0];
+        glm::vec3 scale = first.Scale * weights[0];
+        glm::quat rotation = first.Rotation * weights[0];
+
+        for (uint32_t layer = 1; layer < layerCount; layer++) {
+            const BonePose& pose = layerPoses[layer * boneCount + i];
+            float weight = weights[layer];
+            position += pose.Position * weight;
+            scale += pose.Scale * weight;
+            float sign = glm::dot(first.Rotation, pose.Rotation) < 0 ? -weight : weight;
+            rotation = rotation + pose.Rotation * sign;
+        }
+
+        BonePose& result = mLocalPose[i];
+        result.Position = position;
+        result.Scale = scale;
+        result.Rotation = glm::normalize(rotation);
+    }
+}
+
+void Skeleton::setLOD(uint32_t updateInterval, uint32_t boneCount) {
+    if (updateInterval < 1) {
+        updateInterval = 1;
+    }
+    if (updateInterval != mLODUpdateInterval) {
+        // start over with a fresh sample on the next update
+        mLODUpdateInterval = updateInterval;
+        mLODTick = 0;
+    }
+    mLODBoneCount = boneCount;
+}
+
+// Samples (and blends) all the active states into mLocalPose and moves them dt forward
+void Skeleton::_samplePose(float dt) {
+    _updateAnimationWeights(dt);
+
+    const uint32_t layerCount = (uint32_t)mActiveStates.size();
+    const size_t boneCount = mBones.size();
+    const uint32_t sampledBoneCount = mLODBoneCount > 0 ? mLODBoneCount : (uint32_t)boneCount;
+
+    if (layerCount == 1) {
+        // nothing to blend, sample straight into the local pose
+        AnimationState* state = mActiveStates[0];
+        assert(state->mAnimation);
+        mLocalPose = mBindPose;
+        state->mAnimation->samplePose(state->getTime(), state->mCursors, &mLocalPose[0], sampledBoneCount);
+        state->update(dt);
+    } else if (layerCount > 1) {
+        mLayerPoses.resize(layerCount * boneCount);
+        for (uint32_t layer = 0; layer < layerCount; layer++) {
+            AnimationState* state = mActiveStates[layer];
+            assert(state->mAnimation);
+            BonePose* pose = &mLayerPoses[layer * boneCount];
+            std::copy(mBindPose.begin(), mBindPose.end(), pose);
+            state->mAnimation->samplePose(state->getTime(), state->mCursors, pose, sampledBoneCount);
+            state->update(dt);
+        }
+        _blendLayers(layerCount);
+    }
+}
+
+static bool sameBonePoses(const std::vector<BonePose>& a, const std::vector<BonePose>& b) {
+    if (a.size() != b.size()) {
+        return false;
+    }
+    for (size_t i = 0; i < a.size(); i++) {
+        if (a[i].Position != b[i].Position || a[i].Rotation != b[i].Rotation || a[i].Scale != b[i].Scale) {
+            return false;
+        }
+    }
+    return true;
+}
+
+void Skeleton::_updatePoseVersion() {
+    if (sameBonePoses(mVersionedPose, mLocalPose)) {
+        return;
+    }
+    mVersionedPose = mLocalPose;
+    mPoseVersion++;
+}
+
 void Skeleton::update(float dt) {
     if (mCurrentAnimState == nullptr) {
         // grab the first for testing
         for(auto it = mAnimationStateList.begin();it != mAnimationStateList.end();++it) {
-            mCurrentAnimState = it->second;
+            setAnimationState(it->second);
             break;
         }
     }
 
-    if (mCurrentAnimState != nullptr) {
-        SkeletonAnimation* anim = mAnimationList[mCurrentAnimState->mName];
-        anim->applyToSkeleton(this, mCurrentAnimState->getTime(), 1);
+    // with a LOD interval, only every n-th tick samples (with the time of all of them)
+    mLODTime += dt;
+    if (mLODUpdateInterval <= 1) {
+        _samplePose(mLODTime);
+        mLODTime = 0;
+        _updatePoseVersion();
+    } else {
+        if (mLODTick == 0) {
+            mLODSourcePose = mLocalPose;
+            _samplePose(mLODTime);
+            mLODTime = 0;
+            mLODTargetPose = mLocalPose;
+            _updatePoseVersion();
+        }
+        // reaches the sample right before the next one is taken
+        float alpha = float(mLODTick + 1) / float(mLODUpdateInterval);
+        blendBonePoses(&mLODSourcePose[0], &mLODTargetPose[0], alpha, &mLocalPose[0], mLocalPose.size());
+        mLODTick = (mLODTick + 1) % mLODUpdateInterval;
+    }
 
-        mCurrentAnimState->update(dt);
+    // parents come first in mBones, so their world transforms are always ready
+    for (size_t i = 0; i < mBones.size(); i++) {
+        Bone* bone = mBones[i];
+        bone->mLocalTransform = composeBonePose(mLocalPose[i]);
+        if (bone->mParentIndex >= 0) {
+            bone->mWorldTransform = mBones[bone->mParentIndex]->mWorldTransform * bone->mLocalTransform;
+        } else {
+            bone->mWorldTransform = bone->mLocalTransform;
+        }
     }
+}
 
-    for(Bone* rootBone : mRootBoneList) {
-        rootBone->updateWorldTransform();
+
+void SkeletonMesh::_resolveBones() {
+    mPaletteBones.assign(mBoneCounter, 0);
+    mPaletteOffsets.assign(mBoneCounter, glm::mat4(1.0f));
+    mBonePalette.assign(mBoneCounter, glm::mat4(1.0f));
+
+    for(auto it = mBoneInfoMap.begin();it != mBoneInfoMap.end();++it) {
+        const BoneInfo& boneInfo = it->second;
+        assert(boneInfo.id >= 0 && boneInfo.id < mBoneCounter);
+
+        auto itBone = mSkeleton.mBoneList.find(it->first);
+        if (itBone == mSkeleton.mBoneList.end()) {
+            printf("Bone %s cannot be found in the skeleton\n", it->first.c_str());
+            assert(0);
+            continue;
+        }
+        mPaletteBones[boneInfo.id] = itBone->second->mIndex;
+        mPaletteOffsets[boneInfo.id] = boneInfo.offset;
     }
 }
 
+void SkeletonMesh::updateBonePalette() {
+    const std::vector<Bone*>& bones = mSkeleton.mBones;
+    for (size_t i = 0; i < mBonePalette.size(); i++) {
+        mBonePalette[i] = bones[mPaletteBones[i]]->mWorldTransform * mPaletteOffsets[i];
+    }
+}
+
+void SkeletonMesh::bakeAnimations(float frameRate) {
+    mBakedClips.clear();
+    mBakedFrames.clear();
+
+    if (mBoneCounter == 0 || frameRate <= 0.0f) {
+        return;
+    }
+
+    const std::vector<Bone*>& bones = mSkeleton.mBones;
+    const uint32_t boneCount = (uint32_t)bones.size();
+    std::vector<BonePose> pose(boneCount);
+    std::vector<glm::mat4> worldTransforms(boneCount);
+    std::vector<TrackCursor> cursors;
+
+    for(auto it = mSkeleton.mAnimationList.begin();it != mSkeleton.mAnimationList.end();++it) {
+        SkeletonAnimation* animation = it->second;
+        // same fallback as assimp when the file doesn't say
+        const float ticksPerSecond = animation->mTicks > 0.0f ? animation->mTicks : 25.0f;
+        const float seconds = animation->mDuration / ticksPerSecond;
+
+        BakedAnimationClip clip;
+        clip.Name = animation->mName;
+        clip.FirstFrame = (uint32_t)(mBakedFrames.size() / mBoneCounter);
+        clip.FrameCount = std::max(1u, (uint32_t)std::ceil(seconds * frameRate));
+        clip.FrameRate = frameRate;
+
+        // frames are sampled in order, so the cursors only ever move forward
+        cursors.clear();
+
+        for (uint32_t frame = 0; frame < clip.FrameCount; frame++) {
+            const float time = std::min(frame / frameRate * ticksPerSecond, animation->mDuration);
+
+            pose = mSkeleton.mBindPose;
+            animation->samplePose(time, cursors, &pose[0], boneCount);
+
+            // parents come first in mBones
+            for (uint32_t i = 0; i < boneCount; i++) {
+                const glm::mat4 local = composeBonePose(pose[i]);
+                const int32_t parent = bones[i]->mParentIndex;
+                worldTransforms[i] = parent >= 0 ? worldTransforms[parent] * local : local;
+            }
+            for (int i = 0; i < mBoneCounter; i++) {
+                mBakedFrames.push_back(worldTransforms[mPaletteBones[i]] * mPaletteOffsets[i]);
+            }
+        }
+        mBakedClips.push_back(clip);
+    }
+
+    printf("Baked %d animations of %s (%d frames)\n", (int)mBakedClips.size(), mName.c_str(),
+           (int)(mBakedFrames.size() / mBoneCounter));
+}
+
+int SkeletonMesh::getBakedClipIndex(const std::string& name) const {
+    for (size_t i = 0; i < mBakedClips.size(); i++) {
+        if (mBakedClips[i].Name == name) {
+            return (int)i;
+        }
+    }
+    return -1;
+}
+
+// Back to AnimatedVertex (the unused influences get zero weight)
+static void expandCompactVertices(const std::vector<CompactAnimatedVertex>& compact, std::vector<AnimatedVertex>& vertices) {
+    vertices.resize(compact.size());
+    for (size_t v = 0; v < compact.size(); v++) {
+        const CompactAnimatedVertex& src = compact[v];
+        AnimatedVertex& dst = vertices[v];
+        dst.position = src.position;
+        dst.normal = src.normal;
+        dst.tangent = src.tangent;
+        dst.texCoord = src.texCoord;
+        for (int k = 0; k < NUM_BONES_PER_VERTEX; k++) {
+            if (k < NUM_COMPACT_BONES_PER_VERTEX) {
+                dst.boneIDs[k] = (float)src.boneIDs[k];
+                dst.boneWeights[k] = src.boneWeights[k] / 65535.0f;
+            } else {
+                dst.boneIDs[k] = 0;
+                dst.boneWeights[k] = 0;
+            }
+        }
+    }
+}
+
+void SkeletonMesh::keepBindVertices(bool keep) {
+    for(auto it = mSubMeshList.begin();it != mSubMeshList.end();++it) {
+        SubMesh* sm = *it;
+        if (!keep) {
+            std::vector<AnimatedVertex>().swap(sm->mBindVertices);
+            std::vector<Vertex>().swap(sm->mSkinnedVertices);
+            continue;
+        }
+        if (!sm->mBindVertices.empty()) {
+            continue;
+        }
+
+        IGPUVertexBuffer* vb = static_cast<IGPUVertexBuffer*>(sm->getVertexBuffer());
+        const uint32_t vertexCount = vb->getVertexCount();
+        if (vertexCount == 0) {
+            continue;
+        }
+        if (mCompactVertices) {
+            // the CPU skinning sees the same (quantized) weights as the shaders
+            std::vector<CompactAnimatedVertex> compact(vertexCount);
+            vb->readData(&compact[0], vertexCount * sizeof(CompactAnimatedVertex));
+            expandCompactVertices(compact, sm->mBindVertices);
+        } else {
+            sm->mBindVertices.resize(vertexCount);
+            vb->readData(&sm->mBindVertices[0], vertexCount * sizeof(AnimatedVertex));
+        }
+    }
+}
+
+void SkeletonMesh::skinVertices() {
+    const glm::mat4* palette = mBonePalette.data();
+    const int boneCount = (int)mBonePalette.size();
+
+    for(auto it = mSubMeshList.begin();it != mSubMeshList.end();++it) {
+        SubMesh* sm = *it;
+        const std::vector<AnimatedVertex>& source = sm->mBindVertices;
+        std::vector<Vertex>& skinned = sm->mSkinnedVertices;
+        skinned.resize(source.size());
+
+        for (size_t v = 0; v < source.size(); v++) {
+            const AnimatedVertex& src = source[v];
+            Vertex& dst = skinned[v];
+
+#if defined(__SSE__)
+            // weighted sum of the bone matrices, one column per register
+            __m128 c0 = _mm_setzero_ps();
+            __m128 c1 = _mm_setzero_ps();
+            __m128 c2 = _mm_setzero_ps();
+            __m128 c3 = _mm_setzero_ps();
+            for (int k = 0; k < NUM_BONES_PER_VERTEX; k++) {
+                const float weight = src.boneWeights[k];
+                const int boneID = (int)src.boneIDs[k];
+                if (weight == 0.0f || boneID >= boneCount) {
+                    continue;
+                }
+                const float* m = &palette[boneID][0][0];
+                const __m128 w = _mm_set1_ps(weight);
+                c0 = _mm_add_ps(c0, _mm_mul_ps(w, _mm_loadu_ps(m)));
+                c1 = _mm_add_ps(c1, _mm_mul_ps(w, _mm_loadu_ps(m + 4)));
+                c2 = _mm_add_ps(c2, _mm_mul_ps(w, _mm_loadu_ps(m + 8)));
+                c3 = _mm_add_ps(c3, _mm_mul_ps(w, _mm_loadu_ps(m + 12)));
+            }
+
+            float out[4];
+            __m128 p = _mm_add_ps(_mm_add_ps(_mm_mul_ps(c0, _mm_set1_ps(src.position.x)),
+                                             _mm_mul_ps(c1, _mm_set1_ps(src.position.y))),
+                                  _mm_add_ps(_mm_mul_ps(c2, _mm_set1_ps(src.position.z)), c3));
+            _mm_storeu_ps(out, p);
+            dst.position = glm::vec3(out[0], out[1], out[2]);
+
+            __m128 n = _mm_add_ps(_mm_add_ps(_mm_mul_ps(c0, _mm_set1_ps(src.normal.x)),
+                                             _mm_mul_ps(c1, _mm_set1_ps(src.normal.y))),
+                                  _mm_mul_ps(c2, _mm_set1_ps(src.normal.z)));
+            _mm_storeu_ps(out, n);
+            dst.normal = glm::vec3(out[0], out[1], out[2]);
+
+            __m128 t = _mm_add_ps(_mm_add_ps(_mm_mul_ps(c0, _mm_set1_ps(src.tangent.x)),
+                                             _mm_mul_ps(c1, _mm_set1_ps(src.tangent.y))),
+                                  _mm_mul_ps(c2, _mm_set1_ps(src.tangent.z)));
+            _mm_storeu_ps(out, t);
+            dst.tangent = glm::vec3(out[0], out[1], out[2]);
+#else
+            glm::mat4 boneTransform(0.0f);
+            for (int k = 0; k < NUM_BONES_PER_VERTEX; k++) {
+                const float weight = src.boneWeights[k];
+                const int boneID = (int)src.boneIDs[k];
+                if (weight == 0.0f || boneID >= boneCount) {
+                    continue;
+                }
+                boneTransform += palette[boneID] * weight;
+            }
+            dst.position = glm::vec3(boneTransform * glm::vec4(src.position, 1.0f));
+            dst.normal = glm::vec3(boneTransform * glm::vec4(src.normal, 0.0f));
+            dst.tangent = glm::vec3(boneTransform * glm::vec4(src.tangent, 0.0f));
+#endif
+            // bones may carry some scale
+            float normalLength = glm::length(dst.normal);
+            if (normalLength > 0.0f) {
+                dst.normal /= normalLength;
+            }
+            float tangentLength = glm::length(dst.tangent);
+            if (tangentLength > 0.0f) {
+                dst.tangent /= tangentLength;
+            }
+            dst.texCoord = src.texCoord;
+        }
+    }
+}
@@ -12,8 +12,6 @@ Player::Player(btDiscreteDynamicsWorld* dynamicsWorld, const glm::vec3& origin,
 
     mShakeAnimationTime = 0;
 
-    mHandTransform = &World::get()->getTransformComponent(mPlayerEntity);
-
     SkeletonMesh* mesh = World::get()->getMeshComponent(mPlayerEntity).mMesh->isSkeletonMesh();
     mSkeHands = mesh->getSkeleton();
 
@@ -34,48 +32,52 @@ Player::Player(btDiscreteDynamicsWorld* dynamicsWorld, const glm::vec3& origin,
     mAnimReload->setSpeed(1000);
 
     // Setup muzzle flash
-    SceneEntity* muzzleEntity = World::get()->createEntity("muzzle", mPlayerEntity);
-    mMuzzle = &World::get()->addBillboardComponent(muzzleEntity, Game::get()->mMuzzleTexture);
-    mMuzzle->Opacity = 0;
+    mMuzzleEntity = World::get()->createEntity("muzzle", mPlayerEntity);
+    BillboardComponent& muzzle = World::get()->addBillboardComponent(mMuzzleEntity, Game::get()->mMuzzleTexture);
+    muzzle.Opacity = 0;
 
     glm::quat qt2 = glm::quat(glm::vec3(glm::radians(0.0f), 0, glm::radians(20.0f)));
-    mMuzzleTransform = &World::get()->addTransformComponent(muzzleEntity, {-0.14, -0.03, 0.95}, qt2, {1, 1, 1});
-
     mMuzzleScale = 0.1f;
-    mMuzzleTransform->Scale = {1.8 * 0.3f * mMuzzleScale, 1 * 0.3f * mMuzzleScale, 1 * 0.3f * mMuzzleScale};
+    World::get()->addTransformComponent(mMuzzleEntity, {-0.14, -0.03, 0.95}, qt2, {1.8 * 0.3f * mMuzzleScale, 1 * 0.3f * mMuzzleScale, 1 * 0.3f * mMuzzleScale});
 
     // Muzzle flash light
-    mMuzzleLight = World::get()->addPointLightComponent(muzzleEntity, {0, 0, 0}, false);
+    mMuzzleLight = World::get()->addPointLightComponent(mMuzzleEntity, {0, 0, 0}, false);
     mMuzzleLight->setName("Gun Muzzle Flash");
     mMuzzleLight->setColor({0.8, 0.6, 0.2});
     mMuzzleLight->setEnabled(false);
 }
 
 void Player::triggerShoot() {
+    BillboardComponent& muzzle = World::get()->getBillboardComponent(mMuzzleEntity);
     if (mClipAmmo > 0) {
         mClipAmmo--;
         mShakeAnimationTime = 15;
-        mMuzzle->Opacity = 1;
+        muzzle.Opacity = 1;
         mMuzzleScale = 0.1f;
 
         mMuzzleLight->setIntensity(5);
         mMuzzleLight->setEnabled(true);
         mAnimShot->setTime(0); // Reset on each click
-        mSkeHands->setAnimationState(mAnimShot);
+        mSkeHands->crossFade(mAnimShot, 0.05f);
     } else {
-        mMuzzle->Opacity = 0;
-        mSkeHands->setAnimationState(mAnimReload);
+        muzzle.Opacity = 0;
+        if (mSkeHands->getCurrentAnimationState() != mAnimReload) {
+            mAnimReload->setTime(0);
+            mSkeHands->crossFade(mAnimReload, 0.15f);
+        }
     }
 }
 
 void Player::update(float dt) {
+    World* world = World::get();
+    BillboardComponent& muzzle = world->getBillboardComponent(mMuzzleEntity);
     //btTransform trans = getGhostObject()->getWorldTransform();
 
     if (mSkeHands->getCurrentAnimationState() == mAnimShot) {
         if (mAnimShot->hasEnded()) {
-            mAnimShot->setTime(0);
-            mSkeHands->setAnimationState(mAnimWalk);
-            mMuzzle->Opacity = 0;
+            // shot holds its last frame while it fades out
+            mSkeHands->crossFade(mAnimWalk, 0.2f);
+            muzzle.Opacity = 0;
             mMuzzleScale = 0.1f;
             mMuzzleLight->setEnabled(false);
         } else {
@@ -84,10 +86,10 @@ void Player::update(float dt) {
 
             light -= dt * 40;
 
-            mMuzzle->Opacity -= dt * 10;
+            muzzle.Opacity -= dt * 10;
             mMuzzleScale += dt * 25;
-            if ( mMuzzle->Opacity < 0) {
-                mMuzzle->Opacity = 0;
+            if ( muzzle.Opacity < 0) {
+                muzzle.Opacity = 0;
             }
             if (mMuzzleScale > 1) {
                 mMuzzleScale = 1;
@@ -100,15 +102,14 @@ void Player::update(float dt) {
             mMuzzleLight->setIntensity(light);
         }
 
-        mMuzzleTransform->Scale = {1.8 * 0.3f * mMuzzleScale, 1 * 0.3f * mMuzzleScale, 1 * 0.3f * mMuzzleScale};
+        world->setScale(mMuzzleEntity, {1.8 * 0.3f * mMuzzleScale, 1 * 0.3f * mMuzzleScale, 1 * 0.3f * mMuzzleScale});
     }
 
     if (mSkeHands->getCurrentAnimationState() == mAnimReload) {
         if (mAnimReload->hasEnded()) {
             mClipAmmo = mMaxClipAmmo;
             mAmmo -= mClipAmmo;
-            mAnimReload->setTime(0);
-            mSkeHands->setAnimationState(mAnimWalk);
+            mSkeHands->crossFade(mAnimWalk, 0.2f);
         }
     }
 
@@ -124,7 +125,7 @@ void Player::update(float dt) {
     float offset_factor = sin(mAnimationTime);
 
     // add some shake effect
-    mHandTransform->Position = {2, -7 + (offset_factor * 0.1), -5};
+    world->setPosition(mPlayerEntity, {2, -7 + (offset_factor * 0.1), -5});
     mCamera->setShakeOffset(mShakeAnimationTime * 0.05);
 
     // do bobbing math
@@ -36,9 +36,62 @@ void Renderer::bindQuadBuffer(QuadBufferIndexed* qb) {
     bindResource(qb->getIndexBuffer());
 }
 
+uint64_t RenderQueue::makeKey(uint32_t pass, bool transparent, uint32_t shader, uint32_t material, uint32_t mesh, float depth) {
+    const uint64_t depthBits = (uint64_t)(std::min(std::max(depth, 0.0f), 1.0f) * 0xFFFFFF);
 
+    uint64_t key = (uint64_t)(pass & 0x7) << 61;
+    key |= (uint64_t)(shader & 0xF) << 56;
+    if (transparent) {
+        key |= (uint64_t)1 << 60;
+        key |= (0xFFFFFF - depthBits) << 32;
+        key |= (uint64_t)(material & 0xFFFF) << 16;
+        key |= (uint64_t)(mesh & 0xFFFF);
+    } else {
+        key |= (uint64_t)(material & 0xFFFF) << 40;
+        key |= (uint64_t)(mesh & 0xFFFF) << 24;
+        key |= depthBits;
+    }
+    return key;
+}
 
+void RenderQueue::sort() {
+    const uint32_t count = (uint32_t)mKeys.size();
+    mOrder.resize(count);
+    for (uint32_t i = 0; i < count; i++) {
+        mOrder[i] = i;
+    }
+    if (count < 2) {
+        return;
+    }
+    mTempKeys.resize(count);
+    mTempOrder.resize(count);
 
+    // keys and order get sorted together, the items themselves never move
+    for (uint32_t shift = 0; shift < 64; shift += 8) {
+        uint32_t histogram[256] = {};
+        for (uint32_t i = 0; i < count; i++) {
+            histogram[(mKeys[i] >> shift) & 0xFF]++;
+        }
+        // every key has the same byte here, nothing to do
+        if (histogram[(mKeys[0] >> shift) & 0xFF] == count) {
+            continue;
+        }
+        uint32_t offset = 0;
+        for (uint32_t b = 0; b < 256; b++) {
+            const uint32_t n = histogram[b];
+            histogram[b] = offset;
+            offset += n;
+        }
+        for (uint32_t i = 0; i < count; i++) {
+            const uint32_t dst = histogram[(mKeys[i] >> shift) & 0xFF]++;
+            mTempKeys[dst] = mKeys[i];
+            mTempOrder[dst] = mOrder[i];
+        }
+        mKeys.swap(mTempKeys);
+        mOrder.swap(mTempOrder);
+    }
+}
 
-
-
+uint32_t RenderQueue::lowerBound(uint64_t key) const {
+    return (uint32_t)(std::lower_bound(mKeys.begin(), mKeys.end(), key) - mKeys.begin());
+}
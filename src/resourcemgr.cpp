@@ -52,7 +52,7 @@ std::string loadFile(const char * file_path) {
 	return VertexShaderCode;
 }
 
-ResourceManager::ResourceManager() {
+ResourceManager::ResourceManager() : mMaterialCount(0) {
     mCommonShaderCodes = loadFile("shaders/glsl/common.glsl");
 }
 
@@ -88,8 +88,22 @@ IGPUShaderProgram* ResourceManager::loadShaders(const char* vertex_file_path, co
     return p;
 }
 
+IGPUShaderProgram* ResourceManager::loadComputeShader(const char* compute_file_path) {
+	std::string ComputeShaderCode = loadFile(compute_file_path);
+
+	ComputeShaderCode = mCommonShaderCodes + "\r\n\r\n" + ComputeShaderCode;
+
+	Renderer* rs = Engine::get()->getRenderingSystem();
+
+	IGPUResource* cs = rs->createComputeShader(ComputeShaderCode);
+
+    IGPUShaderProgram* p = rs->createGPUComputeProgram(cs);
+    return p;
+}
+
 Material* ResourceManager::createMaterial(const std::string& name) {
     Material* tex = new Material(name);
+    tex->mSortId = mMaterialCount++;
     mResources.push_back(tex);
     return tex;
 }
@@ -118,11 +132,11 @@ SkeletonMesh* ResourceManager::createSkeletonMesh(const std::string& name) {
     return mesh;
 }
 
-Mesh* ResourceManager::loadMesh(const std::string& path, const std::string& name, bool createCollisionMesh) {
+Mesh* ResourceManager::loadMesh(const std::string& path, const std::string& name, bool createCollisionMesh, bool keepGeometry) {
     Renderer* rend = Engine::get()->getRenderingSystem();
     ObjLoader* loader = new ObjLoader(rend);
     Mesh* mesh = this->createMesh(name);
-    if (!loader->loadFromFile(path, mesh, createCollisionMesh)) {
+    if (!loader->loadFromFile(path, mesh, createCollisionMesh, keepGeometry)) {
         std::cout << "ERROR: Failed to load mesh: " << path << std::endl;
         delete mesh;
         delete loader;
@@ -192,7 +206,55 @@ void buildMeshTransforms(const aiScene* scene, aiNode* pNode) {
     }
 }
 
-SkeletonMesh* ResourceManager::loadSkeletonMesh(const std::string& path, const std::string& name) {
+// Keeps the 4 strongest influences of every vertex and renormalizes their weights,
+// returns how many vertices lost some influences
+static uint32_t compactSkinnedVertices(const std::vector<AnimatedVertex>& vertices, std::vector<CompactAnimatedVertex>& compact) {
+    uint32_t truncatedCount = 0;
+
+    compact.resize(vertices.size());
+    for (size_t v = 0; v < vertices.size(); v++) {
+        const AnimatedVertex& src = vertices[v];
+        CompactAnimatedVertex& dst = compact[v];
+        dst.position = src.position;
+        dst.normal = src.normal;
+        dst.tangent = src.tangent;
+        dst.texCoord = src.texCoord;
+
+        // strongest first
+        int order[NUM_BONES_PER_VERTEX];
+        for (int k = 0; k < NUM_BONES_PER_VERTEX; k++) {
+            order[k] = k;
+        }
+        std::sort(order, order + NUM_BONES_PER_VERTEX, [&src](int a, int b) {
+            return src.boneWeights[a] > src.boneWeights[b];
+        });
+        if (src.boneWeights[order[NUM_COMPACT_BONES_PER_VERTEX]] > 0.0f) {
+            truncatedCount++;
+        }
+
+        float total = 0.0f;
+        for (int k = 0; k < NUM_COMPACT_BONES_PER_VERTEX; k++) {
+            total += src.boneWeights[order[k]];
+        }
+
+        uint32_t quantizedTotal = 0;
+        for (int k = 0; k < NUM_COMPACT_BONES_PER_VERTEX; k++) {
+            float weight = total > 0.0f ? src.boneWeights[order[k]] / total : 0.0f;
+            int boneID = (int)src.boneIDs[order[k]];
+            assert(boneID >= 0 && boneID < 256);
+            dst.boneIDs[k] = (uint8_t)boneID;
+            dst.boneWeights[k] = (uint16_t)(weight * 65535.0f + 0.5f);
+            quantizedTotal += dst.boneWeights[k];
+        }
+        // rounding leftovers go to the strongest influence so the weights add up exactly
+        if (total > 0.0f) {
+            dst.boneWeights[0] = (uint16_t)((int)dst.boneWeights[0] + (65535 - (int)quantizedTotal));
+        }
+    }
+    return truncatedCount;
+}
+
+SkeletonMesh* ResourceManager::loadSkeletonMesh(const std::string& path, const std::string& name, bool compactVertices, float bakeFrameRate) {
     // Create an instance of the Importer class
     Assimp::Importer importer;
     // And have it read the given file with some example postprocessing
@@ -217,6 +279,7 @@ SkeletonMesh* ResourceManager::loadSkeletonMesh(const std::string& path, const s
     } else {
         std::cout << "Creating Model..." << std::endl;
         mAnimatedMesh = createSkeletonMesh(name);
+        mAnimatedMesh->mCompactVertices = compactVertices;
 
         std::cout << "Total " << scene->mNumMeshes << " Meshes" << std::endl;
 
@@ -398,11 +461,22 @@ SkeletonMesh* ResourceManager::loadSkeletonMesh(const std::string& path, const s
 
             Renderer* rend = Engine::get()->getRenderingSystem();
 
-            auto vb = rend->createGPUAnimatedVertexBuffer(&vertices[0], vertices.size());
+            IGPUVertexBuffer* vb = nullptr;
+            if (compactVertices) {
+                std::vector<CompactAnimatedVertex> compact;
+                uint32_t truncatedCount = compactSkinnedVertices(vertices, compact);
+                if (truncatedCount > 0) {
+                    printf("WARNING: mesh %s, %d vertices have more than %d bones\n", meshName.c_str(), truncatedCount, NUM_COMPACT_BONES_PER_VERTEX);
+                }
+                vb = rend->createGPUAnimatedVertexBuffer(&compact[0], compact.size());
+            } else {
+                vb = rend->createGPUAnimatedVertexBuffer(&vertices[0], vertices.size());
+            }
             auto ib = rend->createGPUIndexBuffer(&indices[0], indices.size());
 
             SubMesh* sm = mAnimatedMesh->createSubMesh(vb, ib);
             sm->tempMat = meshTransformation;
+            sm->tempMatInverse = glm::inverse(meshTransformation);
             sm->setMaterial(matMap[mesh->mMaterialIndex]);
             sm->setLocalBoundingBox(bbSubMesh);
 
@@ -410,10 +484,13 @@ SkeletonMesh* ResourceManager::loadSkeletonMesh(const std::string& path, const s
         }
 
         mAnimatedMesh->setBoundingBox(boundingBox);
+        mAnimatedMesh->mAnimatedBoundingBox = AABB(boundingBox.getCenter(), glm::length(boundingBox.getDiagonal()) * 0.5f);
 
         //std::cout << "Building skeleton..." << std::endl;
         buildSkeleton(skeleton, scene, scene->mRootNode, nullptr);
         assert(skeleton->mRootBoneList.size() > 0);
+        skeleton->_buildBoneList();
+        mAnimatedMesh->_resolveBones();
         //printf("total %d bones\n", mAnimatedMesh->mBoneInfoMap.size());
         assert(mAnimatedMesh->mBoneInfoMap.size() < MAX_BONES);
 
@@ -423,6 +500,10 @@ SkeletonMesh* ResourceManager::loadSkeletonMesh(const std::string& path, const s
             readKeyFrames(skeleton, scene);
 
             skeleton->_initAnimationStates();
+
+            if (bakeFrameRate > 0.0f) {
+                mAnimatedMesh->bakeAnimations(bakeFrameRate);
+            }
         }
 
         //skeleton->mRootBone = glm::rotate(skeleton->mRootBone, M_DEGTORAD * 90, glm::vec3( 0, 1, 0));
@@ -451,6 +532,7 @@ void readKeyFrames(Skeleton* skeleton, const aiScene* scene) {
         printf("reading animation %s\n", pAnimation.mName.data);
 
         SkeletonAnimation* anim = skeleton->createAnimation(pAnimation.mName.data, pAnimation.mDuration-1, pAnimation.mTicksPerSecond);
+        AnimationCompressionStats stats;
 
         for (uint32_t i = 0 ; i < pAnimation.mNumChannels ; i++) {
             const aiNodeAnim* pNodeAnim = pAnimation.mChannels[i];
@@ -507,8 +589,15 @@ void readKeyFrames(Skeleton* skeleton, const aiScene* scene) {
                     track->insertScaleKey(data);
                     //mScales.push_back(data);
                 }
+
+                track->compress(stats);
             }
         }
+
+        printf("animation %s: %d -> %d keys, %.1f -> %.1f KB, max error %f (position) %f deg (rotation) %f (scale)\n",
+            pAnimation.mName.data, stats.RawKeyCount, stats.KeyCount,
+            stats.RawSize / 1024.0f, stats.CompressedSize / 1024.0f,
+            stats.MaxPositionError, stats.MaxRotationError / M_DEGTORAD, stats.MaxScaleError);
     }
 }
 
@@ -5,9 +5,32 @@
 #include "camera.h"
 #include "light.h"
 #include "mesh.h"
+#include "jobsystem.h"
 
 World* World::sWorld = nullptr;
 
+// Animation LOD levels, the first one whose ScreenSize the skeleton covers gets picked
+struct AnimationLOD
+{
+    // share of the screen height
+    float ScreenSize;
+    // the pose gets sampled every UpdateInterval ticks
+    uint32_t UpdateInterval;
+    // share of the bones (root first) that get animated
+    float BoneFraction;
+};
+
+static const AnimationLOD sAnimationLODs[ANIMATION_LOD_COUNT] = {
+    { 0.25f, 1, 1.0f },
+    { 0.1f, 2, 1.0f },
+    { 0.04f, 4, 0.5f },
+    { 0.0f, 8, 0.25f },
+};
+
+// mHierarchyDirty flags
+static const uint8_t LOCAL_DIRTY = 1;
+static const uint8_t PARENT_DIRTY = 2;
+
 SceneEntity::SceneEntity(const std::string& name, Entity_T id)
     : mId(id), mName(name), mParent(nullptr) {
 
@@ -28,12 +51,24 @@ void SceneEntity::addChild(SceneEntity* child) {
     mChildren.push_back(child);
 }
 
+void SceneEntity::removeChild(SceneEntity* child) {
+    auto it = std::find(mChildren.begin(), mChildren.end(), child);
+    if (it != mChildren.end()) {
+        mChildren.erase(it);
+    }
+}
+
 void SceneEntity::update(float dt) {
 
 }
 
 World::World()
-    : mViewTarget(nullptr), mSunLight(nullptr) {
+    : mFirstDirtySlot(ComponentArray<glm::mat4>::INVALID_INDEX), mHierarchyChanged(false),
+    mEntityCount(0), mViewTarget(nullptr), mSunLight(nullptr), mUpdateTime(0), mTransformUpdateCount(0),
+    mSkinningMode(SkinningMode::VertexShader) {
+    for (int i = 0; i < ANIMATION_LOD_COUNT; i++) {
+        mAnimationLODCounts[i] = 0;
+    }
     if (World::sWorld != nullptr) {
         assert(0);
     }
@@ -42,47 +77,121 @@ World::World()
 
 World::~World() {
     for(auto it = mEntityList.begin(); it!= mEntityList.end();++it) {
-        delete it->second;
+        delete *it;
     }
     mEntityList.clear();
     for(auto it = mPointLightComponents.begin(); it!= mPointLightComponents.end();++it) {
-        delete it->second;
+        delete *it;
     }
     if (mSunLight)
         delete mSunLight;
 }
 
+Entity_T World::_allocateEntityId() {
+    // reuse a destroyed entity's slot first, bumping its generation
+    if (!mFreeEntityIds.empty()) {
+        Entity_T oldId = mFreeEntityIds.back();
+        mFreeEntityIds.pop_back();
+        return makeEntityId(getEntityIndex(oldId), getEntityGeneration(oldId) + 1);
+    }
+    uint32_t slot = (uint32_t)mEntityList.size();
+    assert(slot <= ENTITY_INDEX_MASK);
+    mEntityList.push_back(nullptr);
+    return makeEntityId(slot, 0);
+}
+
+void World::_registerEntity(SceneEntity* entity) {
+    mEntityList[getEntityIndex(entity->getId())] = entity;
+    mEntityCount++;
+    mHierarchyChanged = true;
+}
+
 SceneEntity* World::createEntity(const std::string& name) {
-    Entity_T newId = mEntityList.size();
-    SceneEntity* newEntity = new SceneEntity(name, newId);
-    mEntityList[newId] = newEntity;
+    SceneEntity* newEntity = new SceneEntity(name, _allocateEntityId());
+    _registerEntity(newEntity);
     return newEntity;
 }
 
 SceneEntity* World::createEntity(const std::string& name, SceneEntity* parent) {
-    Entity_T newId = mEntityList.size();
-    SceneEntity* newEntity = new SceneEntity(name, newId, parent);
-    mEntityList[newId] = newEntity;
+    SceneEntity* newEntity = new SceneEntity(name, _allocateEntityId(), parent);
+    _registerEntity(newEntity);
     return newEntity;
 }
 
 CameraEntity* World::createCamera(const std::string& name) {
-    Entity_T newId = mEntityList.size();
-    CameraEntity* newEntity = new CameraEntity(name, newId, {0, 0, 0});
-    mEntityList[newId] = newEntity;
+    CameraEntity* newEntity = new CameraEntity(name, _allocateEntityId(), {0, 0, 0});
+    _registerEntity(newEntity);
     return newEntity;
 }
 
+void World::destroyEntity(SceneEntity* entity) {
+    // children go first, copy the list since they unlink themselves
+    const std::vector<SceneEntity*> children = entity->getChildren();
+    for(auto it = children.begin(); it != children.end();++it) {
+        destroyEntity(*it);
+    }
+
+    if (entity->mParent) {
+        entity->mParent->removeChild(entity);
+    }
+
+    Entity_T id = entity->getId();
+
+    PointLight** light = mPointLightComponents.find(id);
+    if (light) {
+        delete *light;
+    }
+
+    mTransformComponents.remove(id);
+    mMeshComponents.remove(id);
+    mInteractComponents.remove(id);
+    mBillboardComponents.remove(id);
+    mPointLightComponents.remove(id);
+    mAnimationComponents.remove(id);
+    mCrowdComponents.remove(id);
+    mWorldTransforms.remove(id);
+
+    if (mViewTarget == entity) {
+        mViewTarget = nullptr;
+    }
+
+    mEntityList[getEntityIndex(id)] = nullptr;
+    // a slot at the last generation is retired, reusing it would wrap
+    // the generation and let an old id match the new entity
+    if (getEntityGeneration(id) < ENTITY_GENERATION_MASK) {
+        mFreeEntityIds.push_back(id);
+    }
+    mEntityCount--;
+    mHierarchyChanged = true;
+
+    delete entity;
+}
+
+SceneEntity* World::getEntity(Entity_T id) {
+    uint32_t slot = getEntityIndex(id);
+    if (slot < mEntityList.size() && mEntityList[slot] && mEntityList[slot]->getId() == id) {
+        return mEntityList[slot];
+    }
+    return nullptr;
+}
+
 MeshComponent& World::addMeshComponent(SceneEntity* entity, Mesh* mesh) {
     Entity_T entityID = entity->getId();
     MeshComponent mc;
     mc.mMesh = mesh;
-    mMeshComponents[entityID] = mc;
-    return mMeshComponents[entityID];
+    mc.mStaticBatched = false;
+    return mMeshComponents.insert(entityID, mc);
 }
 
 MeshComponent& World::getMeshComponent(SceneEntity* entity) {
-    return mMeshComponents[entity->getId()];
+    return mMeshComponents.get(entity->getId());
+}
+
+static void composeTransform(TransformComponent& tc) {
+    tc.Transform = glm::mat4(1.0f);
+    tc.Transform = glm::translate(tc.Transform, tc.Position);
+    tc.Transform = tc.Transform * glm::toMat4(tc.Orientation);
+    tc.Transform = glm::scale(tc.Transform, tc.Scale);
 }
 
 TransformComponent& World::addTransformComponent(SceneEntity* entity, const glm::vec3& pos, const glm::quat& qt, const glm::vec3& scale) {
@@ -91,83 +200,133 @@ TransformComponent& World::addTransformComponent(SceneEntity* entity, const glm:
     tc.Position = pos;
     tc.Orientation = qt;
     tc.Scale = scale;
-    tc.Transform = glm::mat4(1.0f);
-    tc.Transform = glm::translate(tc.Transform, tc.Position);
-    tc.Transform = tc.Transform * glm::toMat4(tc.Orientation);
-    tc.Transform = glm::scale(tc.Transform, tc.Scale);
-    mTransformComponents[entityID] = tc;
-    return mTransformComponents[entityID];
+    composeTransform(tc);
+    markTransformDirty(entity);
+    return mTransformComponents.insert(entityID, tc);
 }
 
 TransformComponent& World::getTransformComponent(SceneEntity* entity) {
-    return mTransformComponents[entity->getId()];
+    return mTransformComponents.get(entity->getId());
 }
 
 bool World::hasTransformComponent(SceneEntity* entity) {
-    return mTransformComponents.find(entity->getId()) != mTransformComponents.end();
+    return mTransformComponents.has(entity->getId());
+}
+
+void World::setPosition(SceneEntity* entity, const glm::vec3& pos) {
+    TransformComponent& tc = getTransformComponent(entity);
+    if (tc.Position != pos) {
+        tc.Position = pos;
+        markTransformDirty(entity);
+    }
+}
+
+void World::setOrientation(SceneEntity* entity, const glm::quat& qt) {
+    TransformComponent& tc = getTransformComponent(entity);
+    if (tc.Orientation != qt) {
+        tc.Orientation = qt;
+        markTransformDirty(entity);
+    }
+}
+
+void World::setScale(SceneEntity* entity, const glm::vec3& scale) {
+    TransformComponent& tc = getTransformComponent(entity);
+    if (tc.Scale != scale) {
+        tc.Scale = scale;
+        markTransformDirty(entity);
+    }
+}
+
+void World::markTransformDirty(SceneEntity* entity) {
+    // everything gets recomputed after a rebuild anyway
+    if (mHierarchyChanged) {
+        return;
+    }
+    uint32_t slot = mWorldTransforms.indexOf(entity->getId());
+    assert(slot != ComponentArray<glm::mat4>::INVALID_INDEX);
+    mHierarchyDirty[slot] |= LOCAL_DIRTY;
+    mFirstDirtySlot = std::min(mFirstDirtySlot, slot);
 }
 
 InteractComponent& World::addInteractComponent(SceneEntity* entity, float distance) {
     Entity_T entityID = entity->getId();
     InteractComponent tc;
     tc.Distance = distance;
-    mInteractComponents[entityID] = tc;
-    return mInteractComponents[entityID];
+    return mInteractComponents.insert(entityID, tc);
 }
 
 InteractComponent& World::getInteractComponent(SceneEntity* entity) {
-    return mInteractComponents[entity->getId()];
+    return mInteractComponents.get(entity->getId());
 }
 
 bool World::hasInteractComponent(SceneEntity* entity) {
-    return mInteractComponents.find(entity->getId()) != mInteractComponents.end();
+    return mInteractComponents.has(entity->getId());
 }
 
 BillboardComponent& World::addBillboardComponent(SceneEntity* entity, Texture* tex) {
     Entity_T entityID = entity->getId();
     BillboardComponent tc;
     tc.Image = tex;
-    mBillboardComponents[entityID] = tc;
-    return mBillboardComponents[entityID];
+    return mBillboardComponents.insert(entityID, tc);
 }
 
 BillboardComponent& World::getBillboardComponent(SceneEntity* entity) {
-    return mBillboardComponents[entity->getId()];
+    return mBillboardComponents.get(entity->getId());
 }
 
 bool World::hasBillboardComponent(SceneEntity* entity) {
-    return mBillboardComponents.find(entity->getId()) != mBillboardComponents.end();
+    return mBillboardComponents.has(entity->getId());
 }
 
 AnimationComponent& World::addAnimationComponent(SceneEntity* entity, float length) {
     Entity_T entityID = entity->getId();
     AnimationComponent tc;
     tc.Length = length;
-    mAnimationComponents[entityID] = tc;
-    return mAnimationComponents[entityID];
+    return mAnimationComponents.insert(entityID, tc);
 }
 
 AnimationComponent& World::getAnimationComponent(SceneEntity* entity) {
-    return mAnimationComponents[entity->getId()];
+    return mAnimationComponents.get(entity->getId());
 }
 
 bool World::hasAnimationComponent(SceneEntity* entity) {
-    return mAnimationComponents.find(entity->getId()) != mAnimationComponents.end();
+    return mAnimationComponents.has(entity->getId());
+}
+
+CrowdComponent& World::addCrowdComponent(SceneEntity* entity, SkeletonMesh* mesh, uint32_t clip, float timeOffset) {
+    if (clip >= mesh->mBakedClips.size()) {
+        printf("Crowd mesh %s has no baked clip %d\n", mesh->getName().c_str(), (int)clip);
+        assert(0);
+    }
+    Entity_T entityID = entity->getId();
+    CrowdComponent tc;
+    tc.Mesh = mesh;
+    tc.Clip = clip;
+    tc.TimeOffset = timeOffset;
+    tc.Speed = 1.0f;
+    return mCrowdComponents.insert(entityID, tc);
+}
+
+CrowdComponent& World::getCrowdComponent(SceneEntity* entity) {
+    return mCrowdComponents.get(entity->getId());
+}
+
+bool World::hasCrowdComponent(SceneEntity* entity) {
+    return mCrowdComponents.has(entity->getId());
 }
 
 PointLight* World::addPointLightComponent(SceneEntity* entity, const glm::vec3& pos, bool castShadow) {
     Entity_T entityID = entity->getId();
     PointLight* light = new PointLight(pos, castShadow);
-    mPointLightComponents[entityID] = light;
-    return mPointLightComponents[entityID];
+    return mPointLightComponents.insert(entityID, light);
 }
 
 PointLight* World::getPointLightComponent(SceneEntity* entity) {
-    return mPointLightComponents[entity->getId()];
+    return mPointLightComponents.get(entity->getId());
 }
 
 bool World::hasPointLightComponent(SceneEntity* entity) {
-    return mPointLightComponents.find(entity->getId()) != mPointLightComponents.end();
+    return mPointLightComponents.has(entity->getId());
 }
 
 DirectionalLight* World::createSunLight(bool castShadow) {
@@ -182,20 +341,23 @@ float getScaleFactor(float lastTimeStamp, float nextTimeStamp, float animationTi
     float midWayLength = animationTime - lastTimeStamp;
     float framesDiff = nextTimeStamp - lastTimeStamp;
     scaleFactor = midWayLength / framesDiff;
-    return scaleFactor;
+    // don't extrapolate past the first/last key
+    return glm::clamp(scaleFactor, 0.0f, 1.0f);
 }
 
 void World::update(float dt) {
+    double startTime = glfwGetTime();
 
     // update all the root entities (the ones with no parent entity)
-    for(auto itEnt = mEntityList.begin(); itEnt != mEntityList.end();++itEnt) {
-        SceneEntity* entity = itEnt->second;
-        entity->update(dt);
+    for(size_t i = 0; i < mEntityList.size();++i) {
+        SceneEntity* entity = mEntityList[i];
+        if (entity) {
+            entity->update(dt);
+        }
     }
 
-    for(auto itEnt = mAnimationComponents.begin(); itEnt != mAnimationComponents.end();++itEnt) {
-        SceneEntity* entity = mEntityList[itEnt->first];
-        AnimationComponent& anim = itEnt->second;
+    for(size_t i = 0; i < mAnimationComponents.size();++i) {
+        AnimationComponent& anim = mAnimationComponents.at(i);
 
         if (anim.Play) {
 
@@ -235,41 +397,18 @@ void World::update(float dt) {
                 anim.KeyFrames[p1Index].Rotation, scaleFactor);
             finalRotation = glm::normalize(finalRotation);
 
-            TransformComponent& trans = getTransformComponent(entity);
+            SceneEntity* entity = mEntityList[getEntityIndex(mAnimationComponents.getEntity(i))];
 
-            trans.Orientation = finalRotation;
+            setOrientation(entity, finalRotation);
         }
     }
 
     // update all the bones
-    for(auto itEnt = mMeshComponents.begin(); itEnt != mMeshComponents.end();++itEnt) {
-        const MeshComponent& comp = itEnt->second;
-        Mesh* mesh = comp.mMesh;
-
-        SkeletonMesh* skeMesh = mesh->isSkeletonMesh();
-        if (skeMesh) {
-            Skeleton* skeleton = skeMesh->getSkeleton();
-            skeleton->update(dt);
-        }
-    }
+    _updateSkeletons(dt);
 
-    for(auto itEnt = mTransformComponents.begin(); itEnt != mTransformComponents.end();++itEnt) {
-        TransformComponent& tc = itEnt->second;
-
-        tc.Transform = glm::mat4(1.0f);
-        tc.Transform = glm::translate(tc.Transform, tc.Position);
-        tc.Transform = tc.Transform * glm::toMat4(tc.Orientation);
-        tc.Transform = glm::scale(tc.Transform, tc.Scale);
-    }
+    _updateWorldTransforms();
 
-    // update all the root entities (the ones with no parent entity)
-    for(auto itEnt = mEntityList.begin(); itEnt != mEntityList.end();++itEnt) {
-        SceneEntity* entity = itEnt->second;
-        // we skip ones with parent (cause it will get updated in the recursive func when finding children)
-        if (entity->isRootEntity()) {
-            _updateEntityWorldTransform(entity, nullptr);
-        }
-    }
+    mUpdateTime = float((glfwGetTime() - startTime) * 1000.0);
 /*
     // update world space bounding boxes for all the meshes
     for(auto itEnt = mMeshComponents.begin(); itEnt != mMeshComponents.end();++itEnt) {
@@ -301,51 +440,364 @@ void World::update(float dt) {
 */
 }
 
-void World::_updateEntityWorldTransform(SceneEntity* entity, SceneEntity* parent) {
+ComponentBenchmarkResult World::runComponentBenchmark(uint32_t count, uint32_t passes) {
+    // ids scattered over the slots like in a world that has been creating and destroying things for a while
+    std::vector<Entity_T> ids(count);
+    for (uint32_t i = 0; i < count; i++) {
+        ids[i] = makeEntityId(i, i % 3);
+    }
+    std::mt19937 rng(1234);
+    std::shuffle(ids.begin(), ids.end(), rng);
+
+    ComponentArray<TransformComponent> packed;
+    std::unordered_map<Entity_T, TransformComponent> map;
+    packed.reserve(count);
+    map.reserve(count);
+    for (uint32_t i = 0; i < count; i++) {
+        TransformComponent tc;
+        tc.Position = glm::vec3(float(i % 100), float((i / 100) % 100), float(i / 10000));
+        tc.Orientation = glm::quat(glm::vec3(0, float(i % 360), 0));
+        tc.Scale = glm::vec3(1, 1, 1);
+        tc.Transform = glm::mat4(1.0f);
+        packed.insert(ids[i], tc);
+        map[ids[i]] = tc;
+    }
 
-    // if an entity has a local transform component,
-    // then we must have to compute a world transform for it
-    // by visiting through its hiarochy
-    Entity_T id = entity->getId();
+    // summed up and printed so the loops can't be thrown away
+    float checksum = 0;
 
-    glm::mat4 localTransform;
+    auto start = std::chrono::high_resolution_clock::now();
+    for (uint32_t p = 0; p < passes; p++) {
+        for(auto it = packed.begin(); it != packed.end();++it) {
+            composeTransform(*it);
+            checksum += (*it).Transform[3].x;
+        }
+    }
+    auto middle = std::chrono::high_resolution_clock::now();
+    for (uint32_t p = 0; p < passes; p++) {
+        for(auto it = map.begin(); it != map.end();++it) {
+            composeTransform(it->second);
+            checksum += it->second.Transform[3].x;
+        }
+    }
+    auto end = std::chrono::high_resolution_clock::now();
+
+    ComponentBenchmarkResult result;
+    result.PackedMs = std::chrono::duration<double, std::milli>(middle - start).count() / double(passes);
+    result.MapMs = std::chrono::duration<double, std::milli>(end - middle).count() / double(passes);
+    printf("Component benchmark: %d transforms, %.3f ms packed, %.3f ms map (checksum %f)\n",
+           (int)count, result.PackedMs, result.MapMs, checksum);
+    return result;
+}
 
-    auto itTrans = mTransformComponents.find(id);
-    if (itTrans != mTransformComponents.end()) {
-        localTransform = itTrans->second.Transform;;
-    } else {
-        localTransform = glm::mat4(1.0);
+// Breadth first over the trees rooted in entities, which ends up holding all of their entities
+// in slot order. A parent's slot always comes before its children's
+static void flattenHierarchy(std::vector<SceneEntity*>& entities, ComponentArray<glm::mat4>& worldTransforms, std::vector<int32_t>& parents) {
+    for(auto itEnt = entities.begin(); itEnt != entities.end();++itEnt) {
+        worldTransforms.insert((*itEnt)->getId(), glm::mat4(1.0f));
+        parents.push_back(-1);
     }
 
-    if (parent != nullptr) {
-        Entity_T parentId = parent->getId();
-        auto itParentTrans = mTransformComponents.find(parentId);
-        if (itParentTrans != mTransformComponents.end()) {
+    // children get appended behind the slot we are visiting
+    for(size_t i = 0; i < entities.size();++i) {
+        const auto& children = entities[i]->getChildren();
+        for(auto itEnt = children.begin(); itEnt != children.end();++itEnt) {
+            SceneEntity* child = *itEnt;
+            entities.push_back(child);
+            worldTransforms.insert(child->getId(), glm::mat4(1.0f));
+            parents.push_back((int32_t)i);
+        }
+    }
+}
 
-            auto itParentWorldTrans = mWorldTransforms.find(parentId);
-            assert(itParentWorldTrans != mWorldTransforms.end());
+// One linear pass from firstDirty, parents are always updated before their children.
+// an entity with no transform component just inherits its parent's world transform.
+// Returns how many world transforms got recomputed
+static uint32_t updateHierarchy(uint32_t firstDirty, const std::vector<int32_t>& parents, std::vector<uint8_t>& dirtyFlags,
+    ComponentArray<TransformComponent>& transforms, ComponentArray<glm::mat4>& worldTransforms) {
+    const uint32_t count = (uint32_t)parents.size();
+    if (firstDirty >= count) {
+        return 0;
+    }
 
-            mWorldTransforms[id] = mWorldTransforms[parentId] * localTransform;
+    uint32_t updateCount = 0;
+    for(uint32_t i = firstDirty; i < count;++i) {
+        int32_t parent = parents[i];
+        uint8_t dirty = dirtyFlags[i];
 
+        if (parent >= 0 && dirtyFlags[parent] != 0) {
+            dirty |= PARENT_DIRTY;
+        }
+        if (dirty == 0) {
+            continue;
+        }
+        dirtyFlags[i] = dirty;
+
+        TransformComponent* tc = transforms.find(worldTransforms.getEntity(i));
+        if (tc && (dirty & LOCAL_DIRTY)) {
+            composeTransform(*tc);
+        }
+
+        glm::mat4& world = worldTransforms.at(i);
+        if (parent >= 0) {
+            world = tc ? worldTransforms.at(parent) * tc->Transform : worldTransforms.at(parent);
         } else {
-            mWorldTransforms[id] = localTransform;
+            world = tc ? tc->Transform : glm::mat4(1.0f);
         }
-    } else {
-        mWorldTransforms[id] = localTransform;
+        updateCount++;
+    }
+
+    std::fill(dirtyFlags.begin() + firstDirty, dirtyFlags.end(), 0);
+    return updateCount;
+}
+
+// how world transforms were worked out before the flattened hierarchy (everything dirty), kept for the benchmark
+static void updateWorldTransformRecursive(SceneEntity* entity, const glm::mat4& parentWorld,
+    std::unordered_map<Entity_T, TransformComponent>& transforms, std::unordered_map<Entity_T, glm::mat4>& worldTransforms) {
+    auto itTrans = transforms.find(entity->getId());
+    TransformComponent* tc = itTrans != transforms.end() ? &itTrans->second : nullptr;
+    if (tc) {
+        composeTransform(*tc);
     }
+    glm::mat4& world = worldTransforms[entity->getId()];
+    world = tc ? parentWorld * tc->Transform : parentWorld;
 
-    // visit and update the children
     const auto& children = entity->getChildren();
     for(auto itEnt = children.begin(); itEnt != children.end();++itEnt) {
-        SceneEntity* child = *itEnt;
-        _updateEntityWorldTransform(child, entity);
+        updateWorldTransformRecursive(*itEnt, world, transforms, worldTransforms);
+    }
+}
+
+HierarchyBenchmarkResult World::runHierarchyBenchmark(uint32_t count) {
+    const uint32_t chainLength = 500;
+    const uint32_t fanOut = 200;
+    assert(count <= ENTITY_INDEX_MASK);
+
+    // the entities never get registered, the world's own entities and ids stay out of it
+    std::vector<SceneEntity*> entities;
+    std::vector<SceneEntity*> roots;
+    entities.reserve(count);
+    ComponentArray<TransformComponent> transforms;
+    transforms.reserve(count);
+    std::unordered_map<Entity_T, TransformComponent> transformMap;
+    transformMap.reserve(count);
+
+    auto addEntity = [&entities, &roots, &transforms, &transformMap](SceneEntity* parent) {
+        Entity_T id = makeEntityId((uint32_t)entities.size(), 0);
+        SceneEntity* entity = parent ? new SceneEntity("benchmark", id, parent) : new SceneEntity("benchmark", id);
+
+        TransformComponent tc;
+        tc.Position = glm::vec3(1, 0, 0);
+        tc.Orientation = glm::quat(glm::vec3(0, 0.01f, 0));
+        tc.Scale = glm::vec3(1, 1, 1);
+        composeTransform(tc);
+        transforms.insert(id, tc);
+        transformMap[id] = tc;
+
+        entities.push_back(entity);
+        if (!parent) {
+            roots.push_back(entity);
+        }
+        return entity;
+    };
+
+    // deep: chains of chainLength entities
+    const uint32_t deepCount = count / 2;
+    while (entities.size() < deepCount) {
+        SceneEntity* parent = nullptr;
+        for (uint32_t d = 0; d < chainLength && entities.size() < deepCount; d++) {
+            parent = addEntity(parent);
+        }
+    }
+    // wide: a root with fanOut children, each with fanOut children of its own
+    while (entities.size() < count) {
+        SceneEntity* root = addEntity(nullptr);
+        for (uint32_t c = 0; c < fanOut && entities.size() < count; c++) {
+            SceneEntity* child = addEntity(root);
+            for (uint32_t g = 0; g < fanOut && entities.size() < count; g++) {
+                addEntity(child);
+            }
+        }
     }
+
+    HierarchyBenchmarkResult result;
+    result.EntityCount = (uint32_t)entities.size();
+
+    // same arrays the world keeps, built the way _rebuildHierarchy() builds them
+    std::vector<SceneEntity*> flattened;
+    ComponentArray<glm::mat4> worldTransforms;
+    std::vector<int32_t> parents;
+    std::vector<uint8_t> dirtyFlags;
+
+    auto start = std::chrono::high_resolution_clock::now();
+    flattened.reserve(entities.size());
+    flattened.assign(roots.begin(), roots.end());
+    worldTransforms.reserve(entities.size());
+    parents.reserve(entities.size());
+    flattenHierarchy(flattened, worldTransforms, parents);
+    dirtyFlags.assign(parents.size(), LOCAL_DIRTY);
+    auto end = std::chrono::high_resolution_clock::now();
+    result.RebuildMs = std::chrono::duration<double, std::milli>(end - start).count();
+
+    start = std::chrono::high_resolution_clock::now();
+    updateHierarchy(0, parents, dirtyFlags, transforms, worldTransforms);
+    end = std::chrono::high_resolution_clock::now();
+    result.FullUpdateMs = std::chrono::duration<double, std::milli>(end - start).count();
+
+    // what setPosition() + markTransformDirty() do on every 100th entity
+    uint32_t firstDirty = ComponentArray<glm::mat4>::INVALID_INDEX;
+    for (size_t i = 0; i < entities.size(); i += 100) {
+        Entity_T id = entities[i]->getId();
+        transforms.get(id).Position = glm::vec3(2, 0, 0);
+        uint32_t slot = worldTransforms.indexOf(id);
+        dirtyFlags[slot] |= LOCAL_DIRTY;
+        firstDirty = std::min(firstDirty, slot);
+    }
+    start = std::chrono::high_resolution_clock::now();
+    updateHierarchy(firstDirty, parents, dirtyFlags, transforms, worldTransforms);
+    end = std::chrono::high_resolution_clock::now();
+    result.PartialUpdateMs = std::chrono::duration<double, std::milli>(end - start).count();
+
+    std::unordered_map<Entity_T, glm::mat4> worldTransformMap;
+    worldTransformMap.reserve(entities.size());
+    start = std::chrono::high_resolution_clock::now();
+    for(auto itEnt = roots.begin(); itEnt != roots.end();++itEnt) {
+        updateWorldTransformRecursive(*itEnt, glm::mat4(1.0f), transformMap, worldTransformMap);
+    }
+    end = std::chrono::high_resolution_clock::now();
+    result.RecursiveMs = std::chrono::duration<double, std::milli>(end - start).count();
+
+    for(auto itEnt = entities.begin(); itEnt != entities.end();++itEnt) {
+        delete *itEnt;
+    }
+
+    printf("Hierarchy benchmark: %d entities, rebuild %.3f ms, full %.3f ms, 1%% dirty %.3f ms, recursive %.3f ms\n",
+           (int)result.EntityCount, result.RebuildMs, result.FullUpdateMs, result.PartialUpdateMs, result.RecursiveMs);
+    return result;
 }
 
+// Rough share of the screen height the mesh covers, 1 when we're inside its bounds
+float World::_getScreenSize(Entity_T entity, const Mesh* mesh, const glm::vec3& viewPosition, float tanHalfFOV) {
+    AABB bb = mesh->getBoundingBox();
+    if (bb.isNull()) {
+        return 1.0f;
+    }
+    const glm::mat4* worldTrans = mWorldTransforms.find(entity);
+    if (worldTrans) {
+        bb.transform(*worldTrans);
+    }
+    float radius = glm::length(bb.getDiagonal()) * 0.5f;
+    float distance = glm::length(bb.getCenter() - viewPosition);
+    if (distance <= radius) {
+        return 1.0f;
+    }
+    return radius / (distance * tanHalfFOV);
+}
 
+void World::_updateSkeletons(float dt) {
+    // entities sharing a mesh share its skeleton too, so make sure each one is updated only once
+    mSkeletonUpdateList.clear();
+    for(auto itEnt = mMeshComponents.begin(); itEnt != mMeshComponents.end();++itEnt) {
+        SkeletonMesh* skeMesh = (*itEnt).mMesh->isSkeletonMesh();
+        if (skeMesh) {
+            mSkeletonUpdateList.push_back(skeMesh);
+        }
+    }
+    std::sort(mSkeletonUpdateList.begin(), mSkeletonUpdateList.end());
+    mSkeletonUpdateList.erase(std::unique(mSkeletonUpdateList.begin(), mSkeletonUpdateList.end()), mSkeletonUpdateList.end());
+
+    // animation LOD from the screen size (last update's transforms are close enough)
+    mSkeletonScreenSizes.assign(mSkeletonUpdateList.size(), 1.0f);
+    if (mViewTarget) {
+        glm::vec3 viewPosition = getTransformComponent(mViewTarget).Position;
+        const glm::mat4* viewTrans = mWorldTransforms.find(mViewTarget->getId());
+        if (viewTrans) {
+            viewPosition = glm::vec3((*viewTrans)[3]);
+        }
+        const float tanHalfFOV = tanf(glm::radians(mViewTarget->getFOV()) * 0.5f);
+
+        std::fill(mSkeletonScreenSizes.begin(), mSkeletonScreenSizes.end(), 0.0f);
+        for(size_t i = 0; i < mMeshComponents.size();++i) {
+            SkeletonMesh* skeMesh = mMeshComponents.at(i).mMesh->isSkeletonMesh();
+            if (skeMesh) {
+                auto itMesh = std::lower_bound(mSkeletonUpdateList.begin(), mSkeletonUpdateList.end(), skeMesh);
+                float& screenSize = mSkeletonScreenSizes[itMesh - mSkeletonUpdateList.begin()];
+                screenSize = std::max(screenSize, _getScreenSize(mMeshComponents.getEntity(i), skeMesh, viewPosition, tanHalfFOV));
+            }
+        }
+    }
+    for (int l = 0; l < ANIMATION_LOD_COUNT; l++) {
+        mAnimationLODCounts[l] = 0;
+    }
+    for (size_t i = 0; i < mSkeletonUpdateList.size(); i++) {
+        Skeleton* skeleton = mSkeletonUpdateList[i]->getSkeleton();
+        int lod = 0;
+        while (lod < ANIMATION_LOD_COUNT - 1 && mSkeletonScreenSizes[i] < sAnimationLODs[lod].ScreenSize) {
+            lod++;
+        }
+        const AnimationLOD& level = sAnimationLODs[lod];
+        uint32_t boneCount = (uint32_t)(skeleton->mBones.size() * level.BoneFraction);
+        skeleton->setLOD(level.UpdateInterval, level.BoneFraction < 1.0f ? std::max(boneCount, 1u) : 0);
+        mAnimationLODCounts[lod]++;
+    }
 
+    // skeletons don't share any state, so they can be sampled in parallel (one job each).
+    // the job also builds the mesh's bone palette (and skins it with CPU skinning), the render passes only copy it
+    const bool skinOnCPU = (mSkinningMode == SkinningMode::CPU);
+    const uint32_t count = (uint32_t)mSkeletonUpdateList.size();
 
+    // only the CPU skinning reads the bind vertices, they come back from the GPU when it gets picked
+    for (uint32_t i = 0; i < count; i++) {
+        mSkeletonUpdateList[i]->keepBindVertices(skinOnCPU);
+    }
+    if (count == 1) {
+        mSkeletonUpdateList[0]->getSkeleton()->update(dt);
+        mSkeletonUpdateList[0]->updateBonePalette();
+        if (skinOnCPU) {
+            mSkeletonUpdateList[0]->skinVertices();
+        }
+    } else if (count > 1) {
+        JobCounter counter;
+        JobSystem::get()->parallelFor(count, 1, [this, dt, skinOnCPU](uint32_t start, uint32_t end) {
+            for (uint32_t i = start; i < end; i++) {
+                mSkeletonUpdateList[i]->getSkeleton()->update(dt);
+                mSkeletonUpdateList[i]->updateBonePalette();
+                if (skinOnCPU) {
+                    mSkeletonUpdateList[i]->skinVertices();
+                }
+            }
+        }, &counter);
+        JobSystem::get()->wait(&counter);
+    }
+}
 
+void World::_rebuildHierarchy() {
+    std::vector<SceneEntity*> entities;
+    entities.reserve(mEntityCount);
 
+    mWorldTransforms.clear();
+    mWorldTransforms.reserve(mEntityCount);
+    mHierarchyParents.clear();
+    mHierarchyParents.reserve(mEntityCount);
 
+    for(auto itEnt = mEntityList.begin(); itEnt != mEntityList.end();++itEnt) {
+        SceneEntity* entity = *itEnt;
+        if (entity && entity->isRootEntity()) {
+            entities.push_back(entity);
+        }
+    }
+    flattenHierarchy(entities, mWorldTransforms, mHierarchyParents);
+
+    mHierarchyDirty.assign(mHierarchyParents.size(), LOCAL_DIRTY);
+    mFirstDirtySlot = 0;
+    mHierarchyChanged = false;
+}
+
+void World::_updateWorldTransforms() {
+    if (mHierarchyChanged) {
+        _rebuildHierarchy();
+    }
 
+    mTransformUpdateCount = updateHierarchy(mFirstDirtySlot, mHierarchyParents, mHierarchyDirty, mTransformComponents, mWorldTransforms);
+    mFirstDirtySlot = ComponentArray<glm::mat4>::INVALID_INDEX;
+}